@@ -30,7 +30,7 @@
 
 #define CLOCK_PLL_PID_FILE          "/var/run/clockPll.pid"
 #define CLOCK_PLL_COMMAND_FIFO      "/tmp/clockPll.command"
-#define CLOCK_PLL_STATUS_FIFO       "/tmp/clockPll.status"
+#define CLOCK_PLL_SHARED_FILE       "/tmp/clockPll.shared"
 
 
 /* The synchronisation state is used to track the state of machine clock
@@ -42,3 +42,57 @@ typedef enum
     SYNC_TRACKING = 1,      // Tracking synchronisation (waiting for trigger)
     SYNC_SYNCHRONISED = 2,  // Fully synchronised
 } PLL_SYNC_STATE;
+
+
+/* Status from the clock PLL daemon is reported to the IOC through a block of
+ * memory shared through CLOCK_PLL_SHARED_FILE.  Each clock controller writes
+ * one status record per clock tick to its own ring buffer, and the IOC reads
+ * these at its leisure.  Commands to the daemon are passed back through a
+ * mailbox in the same block.
+ *
+ * Each ring and the mailbox has exactly one writer (with the IOC serialising
+ * its own writes to the mailbox), so no locking is needed: the writer fills
+ * in the entry and then advances Head, and readers detect overwritten ring
+ * entries by rechecking Head after copying.  Libera is a uniprocessor, so a
+ * compiler barrier is sufficient to order these writes. */
+
+#define CLOCK_PLL_SHARED_MAGIC      0x4C4C5043      // "CPLL"
+#define CLOCK_PLL_RING_SIZE         1024            // Must be a power of 2
+#define CLOCK_PLL_MAILBOX_SIZE      32              // Must be a power of 2
+#define CLOCK_PLL_COMMAND_LENGTH    32
+
+#define CLOCK_PLL_MC_RING           0
+#define CLOCK_PLL_SC_RING           1
+
+#define CLOCK_PLL_BARRIER()     __asm__ __volatile__("" ::: "memory")
+
+typedef struct
+{
+    struct timespec Timestamp;  // Time record was written
+    int Stage;                  // Current controller stage (LOCK)
+    int Synchronised;           // PLL_SYNC_STATE
+    int FrequencyError;
+    int PhaseError;
+    int Dac;
+} CLOCK_PLL_RECORD;
+
+typedef struct
+{
+    volatile unsigned int Head;     // Total number of records written
+    CLOCK_PLL_RECORD Records[CLOCK_PLL_RING_SIZE];
+} CLOCK_PLL_RING;
+
+typedef struct
+{
+    volatile unsigned int Head;     // Commands written by the IOC
+    volatile unsigned int Tail;     // Commands consumed by the daemon
+    char Commands[CLOCK_PLL_MAILBOX_SIZE][CLOCK_PLL_COMMAND_LENGTH];
+} CLOCK_PLL_MAILBOX;
+
+typedef struct
+{
+    /* Written last by the daemon once the rest of the block is ready. */
+    volatile unsigned int Magic;
+    CLOCK_PLL_RING Rings[2];        // Indexed by CLOCK_PLL_.._RING
+    CLOCK_PLL_MAILBOX Mailbox;
+} CLOCK_PLL_SHARED;
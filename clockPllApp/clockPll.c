@@ -40,6 +40,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <syslog.h>
@@ -126,65 +127,106 @@ void log_message(int Priority, const char * Format, ...)
 
 /*****************************************************************************/
 /*                                                                           */
-/*                         Status and Command Pipes                          */
+/*                      Shared Status and Command Pipe                       */
 /*                                                                           */
 /*****************************************************************************/
 
+/* Interval between polls of the shared command mailbox. */
+#define MAILBOX_POLL_INTERVAL   20000       // us
 
-/* Status reports are written here. */
-static int status_pipe = -1;
 
-/* Mutex for serialising writes to the status pipe. */
-static pthread_mutex_t status_mutex = PTHREAD_MUTEX_INITIALIZER;
-/* The status pipe can overflow: this flag records whether this has happened,
- * in which case we'll write a special command when we can.  We start with
- * this set to true to generate a reset command on startup. */
-static bool status_pipe_overflow = true;
+/* Status reports are written to this block, shared with the IOC, which also
+ * passes commands back to us through its mailbox. */
+static CLOCK_PLL_SHARED * Shared = NULL;
 
 
+/* Creates the shared status block.  This is built under a temporary name and
+ * only renamed into place once it is fully initialised, so that the IOC can
+ * never map a partially formed block. */
+
+static bool InitialiseSharedStatus()
+{
+    const char * NewFile = CLOCK_PLL_SHARED_FILE ".new";
+    unlink(NewFile);
+    int File;
+    void * Mapping = MAP_FAILED;
+    bool Ok =
+        TEST_IO(File = open(NewFile, O_RDWR | O_CREAT | O_EXCL, 0666))  &&
+        TEST_IO(ftruncate(File, sizeof(CLOCK_PLL_SHARED)))  &&
+        TEST_IO(Mapping = mmap(NULL, sizeof(CLOCK_PLL_SHARED),
+            PROT_READ | PROT_WRITE, MAP_SHARED, File, 0));
+    if (File != -1)
+        close(File);
+    if (Ok)
+    {
+        /* The file is created full of zeros, which is already a consistent
+         * empty state: all we need to do is sign it. */
+        Shared = Mapping;
+        CLOCK_PLL_BARRIER();
+        Shared->Magic = CLOCK_PLL_SHARED_MAGIC;
+        Ok = TEST_IO(rename(NewFile, CLOCK_PLL_SHARED_FILE));
+    }
+    return Ok;
+}
+
 
 /* Ensures that the required fifo resources are already available. */
 
 bool InitialiseCommandLoop()
 {
-    /* In case the fifos have been left behind, or some other nonsense is
-     * going on, remove them unconditionally first. */
+    /* In case the fifo has been left behind, or some other nonsense is going
+     * on, remove it unconditionally first. */
     unlink(CLOCK_PLL_COMMAND_FIFO);
-    unlink(CLOCK_PLL_STATUS_FIFO);
+    unlink(CLOCK_PLL_SHARED_FILE);
     return
-        /* Create the command and status FIFOs. */
-        TEST_IO(mkfifo(CLOCK_PLL_COMMAND_FIFO, 0666))  &&
-        TEST_IO(mkfifo(CLOCK_PLL_STATUS_FIFO,  0666))  &&
-        /* Open the status FIFO right away.  We do this now so that the
-         * machine and system clock threads can write freely.
-         *    The fifo is opened read-only first before opening write only as
-         * a special hack !!!??? why??? */
-        TEST_IO(open(CLOCK_PLL_STATUS_FIFO, O_RDONLY | O_NONBLOCK))  &&
-        TEST_IO(status_pipe = open(
-            CLOCK_PLL_STATUS_FIFO, O_WRONLY | O_NONBLOCK));
+        /* The shared block must exist before the clock threads start
+         * reporting their status. */
+        InitialiseSharedStatus()  &&
+        /* The command FIFO remains for manual control and diagnostics. */
+        TEST_IO(mkfifo(CLOCK_PLL_COMMAND_FIFO, 0666));
 }
 
 
 
 /* Dispatch incoming commands to the appropriate handler. */
 
-void DispatchCommand(char *Command)
+static void DispatchCommand(char *Command)
 {
-    char * Newline = strchr(Command, '\n');
-    if (Newline == NULL)
-        log_message(LOG_ERR, "Malformed command \"%s\"", Command);
-    else
+    switch (Command[0])
+    {
+        case 'm':   MachineClockCommand(Command + 1);       break;
+        case 's':   SystemClockCommand(Command + 1);        break;
+        case 'n':   SetNcoFrequency(atoi(Command + 1));     break;
+        default:
+            log_message(LOG_ERR, "Unknown command \"%s\"", Command);
+    }
+}
+
+
+/* Commands from the IOC arrive through the shared mailbox.  These are
+ * infrequent, so a simple poll is good enough. */
+
+static void * RunMailbox(void *Context)
+{
+    CLOCK_PLL_MAILBOX * Mailbox = &Shared->Mailbox;
+    while (true)
     {
-        *Newline = '\0';
-        switch (Command[0])
+        usleep(MAILBOX_POLL_INTERVAL);
+        while (Mailbox->Tail != Mailbox->Head)
         {
-            case 'm':   MachineClockCommand(Command + 1);       break;
-            case 's':   SystemClockCommand(Command + 1);        break;
-            case 'n':   SetNcoFrequency(atoi(Command + 1));     break;
-            default:
-                log_message(LOG_ERR, "Unknown command \"%s\"", Command);
+            char Command[CLOCK_PLL_COMMAND_LENGTH];
+            CLOCK_PLL_BARRIER();
+            memcpy(Command,
+                Mailbox->Commands[Mailbox->Tail % CLOCK_PLL_MAILBOX_SIZE],
+                sizeof(Command));
+            Command[sizeof(Command) - 1] = '\0';
+            /* Release the slot before acting on the command. */
+            CLOCK_PLL_BARRIER();
+            Mailbox->Tail += 1;
+            DispatchCommand(Command);
         }
     }
+    return NULL;
 }
 
 
@@ -193,12 +235,25 @@ void DispatchCommand(char *Command)
 
 bool RunCommandLoop()
 {
+    pthread_t ThreadId;
+    if (!TEST_0(pthread_create(&ThreadId, NULL, RunMailbox, NULL)))
+        return false;
+
     FILE * CommandPipe;
     while (TEST_NULL(CommandPipe = fopen(CLOCK_PLL_COMMAND_FIFO, "r")))
     {
         char Command[80];
         while (fgets(Command, sizeof(Command), CommandPipe) != NULL)
-            DispatchCommand(Command);
+        {
+            char * Newline = strchr(Command, '\n');
+            if (Newline == NULL)
+                log_message(LOG_ERR, "Malformed command \"%s\"", Command);
+            else
+            {
+                *Newline = '\0';
+                DispatchCommand(Command);
+            }
+        }
         fclose(CommandPipe);
     }
     /* Oops.  This really shouldn't have happened. */
@@ -207,26 +262,17 @@ bool RunCommandLoop()
 
 
 
-/* Sends a status message to the listening client. */
+/* Appends a status record to the selected ring.  Each ring has only one
+ * writer, so all we need to do is ensure that the record is complete before
+ * it is published by advancing Head. */
 
-void WriteStatus(const char *Format, ...)
+void WriteStatusRecord(int Ring, const CLOCK_PLL_RECORD *Record)
 {
-    va_list args;
-    va_start(args, Format);
-    char Message[128];
-    vsnprintf(Message, sizeof(Message), Format, args);
-
-    /* It turns out that although POSIX specifies that write is thread safe,
-     * in fact this is not to be relied on, so we write under a lock.  The
-     * story is here: http://lwn.net/Articles/180387/ and the referenced
-     * patch is not in the current Kernel. */
-    TEST_0(pthread_mutex_lock(&status_mutex));
-    if (status_pipe_overflow)
-        /* The x command is interpreted as loss of connection by the client. */
-        write(status_pipe, "x\n", 2);
-    int written = write(status_pipe, Message, strlen(Message));
-    status_pipe_overflow = (size_t) written != strlen(Message);
-    TEST_0(pthread_mutex_unlock(&status_mutex));
+    CLOCK_PLL_RING * Target = &Shared->Rings[Ring];
+    unsigned int Head = Target->Head;
+    Target->Records[Head % CLOCK_PLL_RING_SIZE] = *Record;
+    CLOCK_PLL_BARRIER();
+    Target->Head = Head + 1;
 }
 
 
@@ -272,9 +318,9 @@ static bool ProcessOptions(int argc, char *argv[], MC_PARAMETERS *Params)
 void ExitHandler(int signo) __attribute__((noreturn));
 void ExitHandler(int signo)
 {
-    /* Similarly destroy the command and status pipes. */
+    /* Similarly destroy the command pipe and shared status block. */
     unlink(CLOCK_PLL_COMMAND_FIFO);
-    unlink(CLOCK_PLL_STATUS_FIFO);
+    unlink(CLOCK_PLL_SHARED_FILE);
     /* Make sure we don't leave the PID file behind -- do this last of all. */
     unlink(CLOCK_PLL_PID_FILE);
     /* Die NOW! */
@@ -33,9 +33,8 @@
 extern int event_fd;
 
 
-/* Writes message to PLL status pipe. */
-void WriteStatus(const char *Format, ...)
-    __attribute__((format(printf, 1, 2)));
+/* Appends record to the selected shared status ring (CLOCK_PLL_.._RING). */
+void WriteStatusRecord(int Ring, const CLOCK_PLL_RECORD *Record);
 
 /* Writes message to system log (in daemon mode) or stdout (in interactive
  * mode). */
@@ -0,0 +1,472 @@
+/* This file is part of the Libera EPICS Driver,
+ *
+ * Copyright (C) 2008-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+/* Offline simulator for the clock PLL controller.  The unchanged controller
+ * framework and stage definitions for either the machine or system clock are
+ * run against a simulated VCXO and clock counter, as fast as possible, and a
+ * summary of the controller's behaviour is reported at the end of the run.
+ *
+ * The plant follows the model described in machineClock.c: on each tick the
+ * clock advances by the nominal prescale plus alpha times the DAC offset
+ * from its centre, with the DAC setting taking effect on the following tick.
+ * To this we add frequency drift, frequency noise, measurement jitter and
+ * occasional loss of the clock. */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/time.h>
+
+#include "driver/libera.h"
+#include "libera_pll.h"
+#include "test_error.h"
+
+#include "clockPll.h"
+#include "controller.h"
+#include "machineClock.h"
+#include "systemClock.h"
+
+
+/* Needed by machineClock.c and systemClock.c, but never used here. */
+int event_fd = -1;
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                          Simulation Parameters                            */
+/*                                                                           */
+/*****************************************************************************/
+
+static CONTROLLER * Controller = NULL;  // Controller under test
+
+static unsigned int TickCount = 1000000;    // Length of simulation
+static unsigned int Prescale = 12500000;    // Nominal clock advance per tick
+static unsigned int Seed = 1;               // Random number seed
+
+static double Alpha = 0.03;         // Clock advance per DAC unit per tick
+static int DacCentre = 30000;       // DAC setting for nominal frequency
+static double Drift = 0;            // Frequency drift per tick
+static double RandomWalk = 0;       // Frequency random walk per tick
+static double FrequencyNoise = 0;   // White frequency noise per tick
+static double Jitter = 0.3;         // Clock measurement jitter
+static double DropoutRate = 0;      // Probability of clock loss per tick
+static unsigned int DropoutLength = 10; // Duration of each clock loss
+
+/* An optional synchronisation slew: the clock jumps by SlewSize at SlewTick,
+ * bracketed by the same synchronisation commands as used by the IOC. */
+static unsigned int SlewTick = 0;
+static int SlewSize = 0;
+
+static bool Verbose = false;        // Echo controller log messages
+static FILE * TraceFile = NULL;     // Optional per tick trace output
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                             Simulated Plant                               */
+/*                                                                           */
+/*****************************************************************************/
+
+
+/* Plant state.  The true clock phase is accumulated in double precision,
+ * which leaves ample fractional resolution for the longest runs. */
+static unsigned int Tick = 0;
+static double Phase = 0;
+static double FrequencyOffset = 0;
+static int Dac = 0;
+static unsigned int Dropout = 0;
+
+/* Posted when the simulation is complete. */
+static sem_t Finished;
+
+
+/* Returns normally distributed random numbers with unit variance. */
+
+static double gaussian(void)
+{
+    double u = drand48();
+    double v = drand48();
+    return sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+}
+
+
+static void SendCommand(const char * Format, ...)
+    __attribute__((format(printf, 1, 2)));
+static void SendCommand(const char * Format, ...)
+{
+    va_list args;
+    va_start(args, Format);
+    char Command[CLOCK_PLL_COMMAND_LENGTH];
+    vsnprintf(Command, sizeof(Command), Format, args);
+    va_end(args);
+    ControllerCommand(Controller, Command);
+}
+
+
+/* Called by the controller to read the clock: this is where the simulation
+ * advances.  Note that the controller does not hold its interlock while
+ * reading the clock, so it is safe to send commands from here. */
+
+static bool SimulateGetClock(libera_hw_time_t *Clock)
+{
+    if (Tick >= TickCount)
+    {
+        /* Park the controller for good and let the main thread report. */
+        sem_post(&Finished);
+        while (true)
+            pause();
+    }
+    Tick += 1;
+
+    if (SlewSize != 0)
+    {
+        if (Tick == SlewTick)
+        {
+            SendCommand("s%d", SYNC_TRACKING);
+            Phase += SlewSize;
+        }
+        else if (Tick == SlewTick + 1)
+            SendCommand("s%d", SYNC_SYNCHRONISED);
+    }
+
+    /* Advance the plant using the DAC setting written on the previous
+     * tick. */
+    FrequencyOffset += Drift + RandomWalk * gaussian();
+    Phase += Prescale + Alpha * (Dac - DacCentre) +
+        FrequencyOffset + FrequencyNoise * gaussian();
+
+    if (Dropout == 0  &&  drand48() < DropoutRate)
+        Dropout = DropoutLength;
+    if (Dropout > 0)
+    {
+        Dropout -= 1;
+        return false;
+    }
+    else
+    {
+        *Clock = (libera_hw_time_t) floor(Phase + Jitter * gaussian());
+        return true;
+    }
+}
+
+
+static void SimulateSetDAC(int NewDac)
+{
+    Dac = NewDac;
+}
+
+
+static void SimulateNotifyDriver(
+    libera_hw_time_t Frequency, libera_hw_time_t Phase, bool PhaseLocked)
+{
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                          Controller Statistics                            */
+/*                                                                           */
+/*****************************************************************************/
+
+
+/* Statistics are gathered from the status records which the controller
+ * writes on every tick.  Phase and frequency statistics are only gathered
+ * while the final (narrow lock) stage is running. */
+
+static unsigned int FirstLockTick = 0;  // First tick in final stage
+static unsigned int LockLosses = 0;     // Number of drops from final stage
+static unsigned int ClockLosses = 0;    // Number of drops to stage 0
+static int LastStage = 0;
+
+static unsigned int LockedTicks = 0;
+static double PhaseSum = 0, PhaseSum2 = 0, FrequencySum2 = 0;
+static int MaxPhaseError = 0;
+static int MinDac = 0xFFFF, MaxDac = 0;
+static double DacChurn = 0;             // Sum of |DAC steps| while locked
+static int LastDac = 0;
+
+/* Slew statistics, measured from the start of the slew. */
+static bool Slewing = false;
+static unsigned int SlewTime = 0;       // Ticks to return to final stage
+static int SlewPeak = 0;                // Peak phase error during slew
+static bool SlewKeptSync = false;       // Synchronisation survived slew
+
+
+void WriteStatusRecord(int Ring, const CLOCK_PLL_RECORD *Record)
+{
+    int Stage = Record->Stage;
+    int PhaseError = Record->PhaseError;
+    bool Locked = Stage == Controller->StageCount;
+
+    if (Locked  &&  LastStage != Stage  &&  FirstLockTick == 0)
+        FirstLockTick = Tick;
+    if (LastStage == Controller->StageCount  &&  !Locked)
+        LockLosses += 1;
+    if (LastStage != 0  &&  Stage == 0)
+        ClockLosses += 1;
+
+    if (Locked)
+    {
+        LockedTicks += 1;
+        PhaseSum  += PhaseError;
+        PhaseSum2 += (double) PhaseError * PhaseError;
+        FrequencySum2 +=
+            (double) Record->FrequencyError * Record->FrequencyError;
+        if (abs(PhaseError) > MaxPhaseError)
+            MaxPhaseError = abs(PhaseError);
+        if (Record->Dac < MinDac)  MinDac = Record->Dac;
+        if (Record->Dac > MaxDac)  MaxDac = Record->Dac;
+        if (LastStage == Stage)
+            DacChurn += abs(Record->Dac - LastDac);
+    }
+
+    if (SlewSize != 0  &&  Tick == SlewTick)
+        Slewing = true;
+    if (Slewing)
+    {
+        if (abs(PhaseError) > SlewPeak)
+            SlewPeak = abs(PhaseError);
+        if (Tick > SlewTick + 1  &&  Locked  &&  abs(PhaseError) <= 2)
+        {
+            Slewing = false;
+            SlewTime = Tick - SlewTick;
+            SlewKeptSync = Record->Synchronised == SYNC_SYNCHRONISED;
+        }
+    }
+
+    if (TraceFile != NULL)
+        fprintf(TraceFile, "%u %d %d %d %d %d\n",
+            Tick, Stage, Record->Synchronised,
+            PhaseError, Record->FrequencyError, Record->Dac);
+
+    LastStage = Stage;
+    LastDac = Record->Dac;
+}
+
+
+static void Report(double Elapsed)
+{
+    printf("Controller %s, %u ticks in %.2fs (%.0f ticks/s)\n",
+        Controller->name, Tick, Elapsed, Tick / Elapsed);
+    if (FirstLockTick == 0)
+        printf("Never reached stage %d\n", Controller->StageCount);
+    else
+        printf("Lock time: %u ticks\n", FirstLockTick);
+    printf("Lock losses: %u, clock losses: %u\n", LockLosses, ClockLosses);
+    if (LockedTicks > 0)
+    {
+        double Mean = PhaseSum / LockedTicks;
+        printf("Locked for %u ticks (%.2f%%)\n",
+            LockedTicks, 100.0 * LockedTicks / Tick);
+        printf("Phase error: mean %.3f, std %.3f, max %d\n",
+            Mean, sqrt(PhaseSum2 / LockedTicks - Mean * Mean),
+            MaxPhaseError);
+        printf("Frequency error: rms %.3f\n",
+            sqrt(FrequencySum2 / LockedTicks));
+        printf("DAC: range %d..%d, mean step %.3f\n",
+            MinDac, MaxDac, DacChurn / LockedTicks);
+    }
+    if (SlewSize != 0)
+    {
+        if (Slewing  ||  SlewTime == 0)
+            printf("Slew of %d did not complete\n", SlewSize);
+        else
+            printf("Slew of %d: %u ticks, peak error %d, sync %s\n",
+                SlewSize, SlewTime, SlewPeak,
+                SlewKeptSync ? "kept" : "lost");
+    }
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                      Controller Framework Support                         */
+/*                                                                           */
+/*****************************************************************************/
+
+
+void print_error(const char * Message, const char * FileName, int LineNumber)
+{
+    fprintf(stderr, "%s (%s, %d)", Message, FileName, LineNumber);
+    if (errno != 0)
+        fprintf(stderr, ": (%d) %s", errno, strerror(errno));
+    fprintf(stderr, "\n");
+}
+
+
+void log_message(int Priority, const char * Format, ...)
+{
+    if (Verbose)
+    {
+        va_list args;
+        va_start(args, Format);
+        printf("%u: ", Tick);
+        vprintf(Format, args);
+        printf("\n");
+        va_end(args);
+    }
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                                 Startup                                   */
+/*                                                                           */
+/*****************************************************************************/
+
+
+static void Usage(const char * Name)
+{
+    printf(
+"Usage: %s [options]\n"
+"Runs the clock PLL controller against a simulated clock.  Options:\n"
+"   -c m|s  Select machine (default) or system clock controller\n"
+"   -n:     Number of ticks to simulate (default %u)\n"
+"   -p:     Nominal clock advance per tick (default %u)\n"
+"   -a:     Clock advance per DAC unit per tick (default %g)\n"
+"   -z:     DAC setting for nominal frequency (default %d)\n"
+"   -d:     Frequency drift per tick (default %g)\n"
+"   -w:     Frequency random walk per tick (default %g)\n"
+"   -f:     White frequency noise (default %g)\n"
+"   -j:     Clock measurement jitter (default %g)\n"
+"   -l rate[:length]\n"
+"           Probability per tick of losing clock for length ticks\n"
+"   -s tick:size\n"
+"           Simulate synchronisation slewing the clock by size at tick\n"
+"   -r:     Random number seed (default %u)\n"
+"   -o:     Write per tick trace to file\n"
+"   -v      Show controller log messages\n"
+"   -h      Show this help\n",
+        Name, TickCount, Prescale, Alpha, DacCentre, Drift, RandomWalk,
+        FrequencyNoise, Jitter, Seed);
+}
+
+
+static bool ProcessOptions(int argc, char *argv[])
+{
+    int ch;
+    while(ch = getopt(argc, argv, "c:n:p:a:z:d:w:f:j:l:s:r:o:vh"), ch != -1)
+    {
+        switch (ch)
+        {
+            case 'c':
+                switch (optarg[0])
+                {
+                    case 'm':   Controller = &MC_Controller;    break;
+                    case 's':   Controller = &SC_Controller;    break;
+                    default:
+                        fprintf(stderr, "Invalid controller %s\n", optarg);
+                        return false;
+                }
+                break;
+            case 'n':   TickCount      = atol(optarg);      break;
+            case 'p':   Prescale       = atol(optarg);      break;
+            case 'a':   Alpha          = atof(optarg);      break;
+            case 'z':   DacCentre      = atoi(optarg);      break;
+            case 'd':   Drift          = atof(optarg);      break;
+            case 'w':   RandomWalk     = atof(optarg);      break;
+            case 'f':   FrequencyNoise = atof(optarg);      break;
+            case 'j':   Jitter         = atof(optarg);      break;
+            case 'l':
+                sscanf(optarg, "%lf:%u", &DropoutRate, &DropoutLength);
+                break;
+            case 's':
+                if (sscanf(optarg, "%u:%d", &SlewTick, &SlewSize) != 2)
+                {
+                    fprintf(stderr, "Invalid slew %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'r':   Seed           = atol(optarg);      break;
+            case 'o':
+                TraceFile = fopen(optarg, "w");
+                if (TraceFile == NULL)
+                {
+                    perror(optarg);
+                    return false;
+                }
+                break;
+            case 'v':   Verbose = true;                     break;
+            case 'h':   Usage(argv[0]);                     exit(0);
+            default:
+                fprintf(stderr, "Try `%s -h` for help\n", argv[0]);
+                return false;
+        }
+    }
+    errno = 0;  // For TEST_OK failure reporting
+    return
+        TEST_OK(optind == argc)  &&
+        TEST_OK(Prescale != 0)  &&
+        TEST_OK(TickCount > 0);
+}
+
+
+int main(int argc, char *argv[])
+{
+    Controller = &MC_Controller;
+    if (!ProcessOptions(argc, argv))
+        return 1;
+
+    /* Replace the hardware interface of the selected controller with our
+     * simulation, leaving its stages and parameters untouched. */
+    Controller->prescale = Prescale;
+    Controller->GetClock = SimulateGetClock;
+    Controller->SetDAC = SimulateSetDAC;
+    Controller->NotifyDriver = SimulateNotifyDriver;
+    srand48(Seed);
+
+    struct timeval Start, End;
+    gettimeofday(&Start, NULL);
+    bool Ok =
+        TEST_IO(sem_init(&Finished, 0, 0))  &&
+        spawn_controller(Controller)  &&
+        TEST_IO(sem_wait(&Finished));
+    gettimeofday(&End, NULL);
+    if (!Ok)
+        return 1;
+
+    Report((End.tv_sec - Start.tv_sec) + 1e-6 * (End.tv_usec - Start.tv_usec));
+    if (TraceFile != NULL)
+        fclose(TraceFile);
+    return 0;
+}
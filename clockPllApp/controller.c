@@ -44,6 +44,7 @@
 #include <syslog.h>
 #include <pthread.h>
 #include <limits.h>
+#include <sys/time.h>
 
 #include "driver/libera.h"
 #include "test_error.h"
@@ -52,19 +53,7 @@
 #include "clockPll.h"
 
 #include "controller.h"
-
-
-
-#define INITIALISE_HISTORY(array, value) \
-    for (unsigned int i = 0; i < sizeof(array) / sizeof(array[0]); i ++) \
-        array[i] = value
-
-/* Adds a point to the start of a history array, moving all other entries up
- * by one position.  The first argument is the array: this must be implicitly
- * sized at the point of call, a pointer will not work. */
-#define ADD_TO_HISTORY(array, value) \
-    memmove(array + 1, array, sizeof(array) - sizeof(array[0])); \
-    array[0] = (value)
+#include "history.h"
 
 
 
@@ -217,29 +206,23 @@ static void ReportState(CONTROLLER *Controller)
     if (LogMessage != NULL)
         log_message(LOG_INFO, "%s: %s", Controller->name, LogMessage);
 
-    Controller->ReportAge += 1;
-    if (Controller->CurrentStage != Controller->PreviousStage  ||
-        Controller->WasSynchronised != Controller->Synchronised  ||
-        Controller->ReportAge > Controller->StatusReportInterval)
-    {
-        WriteStatus("%cs%d %d\n",
-            Controller->status_prefix,
-            Controller->CurrentStage,
-            Controller->Synchronised);
-        Controller->ReportAge = 0;
-    }
-
-    if (Controller->Verbose)
-        WriteStatus("%cv%d %d %d\n",
-            Controller->status_prefix,
-            Controller->FrequencyError,
-            Controller->PhaseError,
-            Controller->Dac);
+    /* Every tick is recorded in the shared status ring: the IOC picks out
+     * state changes and builds its own history from these. */
+    struct timeval Now;
+    gettimeofday(&Now, NULL);
+    CLOCK_PLL_RECORD Record = {
+        .Timestamp = { .tv_sec = Now.tv_sec, .tv_nsec = 1000 * Now.tv_usec },
+        .Stage = Controller->CurrentStage,
+        .Synchronised = Controller->Synchronised,
+        .FrequencyError = Controller->FrequencyError,
+        .PhaseError = Controller->PhaseError,
+        .Dac = Controller->Dac,
+    };
+    WriteStatusRecord(Controller->status_ring, &Record);
 
     /* Update history. */
     Controller->WasPhaseLocked = Controller->PhaseLocked;
     Controller->PreviousStage = Controller->CurrentStage;
-    Controller->WasSynchronised = Controller->Synchronised;
 }
 
 
@@ -318,8 +301,8 @@ int run_PI(CONTROLLER *Controller, const void *Context)
     /* Initialise the DAC history buffer with our initial DAC reading so that
      * at least we start with something sensible.  However, this should all be
      * swept out by the time we read this. */
-    int dac_history[DAC_HISTORY];
-    INITIALISE_HISTORY(dac_history, nominal_dac);
+    DECLARE_HISTORY(dac_history, DAC_HISTORY);
+    InitialiseHistory(&dac_history, nominal_dac);
 
     while (UpdateClock(Controller, false, PHASE_LOCK_WIDE))
     {
@@ -328,7 +311,7 @@ int run_PI(CONTROLLER *Controller, const void *Context)
             Params->KP * Controller->PhaseError +
             Params->KI * tI;
         /* Remember the DAC setting for breakout. */
-        ADD_TO_HISTORY(dac_history, target_dac);
+        AddToHistory(&dac_history, target_dac);
 
         /* If the DAC hits the limits we have a problem.  If we let the
          * integrator continue to run then we end up overcompensating, and
@@ -358,9 +341,7 @@ int run_PI(CONTROLLER *Controller, const void *Context)
             /* Compute the average DAC value that we've been settling around
              * for the last few cycles and assign this as the "best" DAC
              * value for the fine control filter. */
-            int NewDac = 0;
-            for (int i = 0; i < DAC_HISTORY; i ++)  NewDac += dac_history[i];
-            Controller->Dac = NewDac / DAC_HISTORY;
+            Controller->Dac = (int) HistoryMean(&dac_history);
             /* Hand off to the next stage. */
             return +1;
         }
@@ -380,10 +361,10 @@ int run_IIR(CONTROLLER *Controller, const void *Context)
     /* IIR: we have to keep a history of the last N terms and corrections
      * where N is the order of the filter.  Initialise the history to 0, it's
      * the best we can do! */
-    float last_error[Params->Order];
-    float last_out  [Params->Order];
-    INITIALISE_HISTORY(last_error, 0.0);
-    INITIALISE_HISTORY(last_out, 0.0);
+    DECLARE_HISTORY(last_error, Params->Order);
+    DECLARE_HISTORY(last_out,   Params->Order);
+    InitialiseHistory(&last_error, 0.0);
+    InitialiseHistory(&last_out, 0.0);
 
     int nominal_dac = Controller->Dac;
     while (UpdateClock(Controller, false, PHASE_LOCK_NARROW))
@@ -400,11 +381,11 @@ int run_IIR(CONTROLLER *Controller, const void *Context)
         float this_output = Params->Filter[0].B * adjusted_error;
         for (int i = 0; i < Params->Order; i ++)
             this_output +=
-                Params->Filter[i+1].B * last_error[i] -
-                Params->Filter[i+1].A * last_out[i];
+                Params->Filter[i+1].B * HistoryAt(&last_error, i) -
+                Params->Filter[i+1].A * HistoryAt(&last_out, i);
         /* Advance the historical records. */
-        ADD_TO_HISTORY(last_error, adjusted_error);
-        ADD_TO_HISTORY(last_out,   this_output);
+        AddToHistory(&last_error, adjusted_error);
+        AddToHistory(&last_out,   this_output);
 
         /* The output is generated as an offset from the nominal DAC entry on
          * entry. */
@@ -647,12 +628,10 @@ static void WriteToController(CONTROLLER *Controller, char *Command)
  *  o   Detune: adds offset to the managed frequency
  *  p   Phase offset: moves phase relative to synchronisation point
  *  s   Synchronisation flag control
- *  v   Controls verbosity of status reports
  *
  * The following commands are only intended for diagnostic use:
  *  c   Selects open loop control: DAC is only set externally by d command
  *  d   Set DAC value directly if open loop mode selected
- *  i   Status report interval
  */
 
 void ControllerCommand(CONTROLLER *Controller, char *Command)
@@ -667,8 +646,6 @@ void ControllerCommand(CONTROLLER *Controller, char *Command)
         case 'c':   Controller->OpenLoop = arg;                 break;
         case 'd':   if (Controller->OpenLoop)
                         SetDAC(Controller, arg);                break;
-        case 'v':   Controller->Verbose = arg;                  break;
-        case 'i':   Controller->StatusReportInterval = arg;     break;
 
         case 'W':   WriteToController(Controller, Command);     break;
         default:
@@ -688,15 +665,11 @@ bool spawn_controller(CONTROLLER *Controller)
     /* Start the DAC in the middle of its range on startup. */
     Controller->Dac = 0x8000;
     Controller->OpenLoop = false;
-    Controller->Verbose = false;
-    Controller->StatusReportInterval = 10;
 
     Controller->WasPhaseLocked = false;
     Controller->PreviousStage = 0;
-    Controller->ReportAge = 0;
 
     Controller->Synchronised = SYNC_NO_SYNC;
-    Controller->WasSynchronised = SYNC_NO_SYNC;
     Controller->Slewing = false;
 
     /* Sensible initial defaults for first reports. */
@@ -62,7 +62,7 @@ typedef struct CONTROLLER
     int max_slew_phase_error;   // Maximum phase allowed during slewing
 
     const char * name;          // Name of controller for logging
-    char status_prefix;         // Prefix character used for reporting
+    int status_ring;            // Shared status ring used for reporting
 
     /* Returns true and the current clock reading, or returns false if the
      * clock cannot be read. */
@@ -91,15 +91,11 @@ typedef struct CONTROLLER
     bool Slewing;               // True during programmed slewing
 
     /* Status reporting control. */
-    bool Verbose;               // Enables error and DAC reporting
-    int StatusReportInterval;   // How often status is reported
     bool WasPhaseLocked;
     int PreviousStage;
-    int ReportAge;
 
     /* Synchronisation holding. */
     PLL_SYNC_STATE Synchronised;    // Synchronisation state
-    PLL_SYNC_STATE WasSynchronised;
 
     pthread_mutex_t Interlock;  // Interlock between commands and control
 
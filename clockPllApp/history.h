@@ -0,0 +1,86 @@
+/* This file is part of the Libera EPICS Driver,
+ *
+ * Copyright (C) 2008-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+/* Fixed length circular history buffers for the PLL controllers.
+ *
+ * Adding a point to a history costs the same however long the history is:
+ * the oldest point is simply overwritten, and a running sum is maintained so
+ * that the mean over the whole history is available without rescanning it.
+ *
+ * Histories are declared on the stack with DECLARE_HISTORY, which provides
+ * the storage for the history. */
+
+typedef struct
+{
+    unsigned int Length;        // Number of points in history
+    unsigned int Newest;        // Index of most recent point in Values
+    double Sum;                 // Sum of all points in history
+    float *Values;              // Circular buffer of points
+} HISTORY;
+
+#define DECLARE_HISTORY(name, length) \
+    float name##_values[length]; \
+    HISTORY name = { \
+        .Length = (length), \
+        .Values = name##_values }
+
+
+/* Adds a point to the history, overwriting the oldest point. */
+static inline void AddToHistory(HISTORY *History, float Value)
+{
+    unsigned int Index = (History->Newest + 1) % History->Length;
+    History->Sum += (double) Value - History->Values[Index];
+    History->Values[Index] = Value;
+    History->Newest = Index;
+}
+
+
+/* Fills the history with the given value.  This must be called before any
+ * other history operation. */
+static inline void InitialiseHistory(HISTORY *History, float Value)
+{
+    for (unsigned int i = 0; i < History->Length; i ++)
+        History->Values[i] = Value;
+    History->Newest = History->Length - 1;
+    History->Sum = (double) Value * History->Length;
+}
+
+
+/* Returns the point added Age points ago: age 0 is the most recent point.
+ * Age must be less than the history length. */
+static inline float HistoryAt(const HISTORY *History, unsigned int Age)
+{
+    return History->Values[
+        (History->Newest + History->Length - Age) % History->Length];
+}
+
+static inline double HistoryMean(const HISTORY *History)
+{
+    return History->Sum / History->Length;
+}
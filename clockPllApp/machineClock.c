@@ -199,7 +199,7 @@ static IIR_PARAMS IIR_params =
 };
 
 
-static CONTROLLER MC_Controller =
+CONTROLLER MC_Controller =
 {
     .frequency_offset = 0,
     .phase_offset = 0,
@@ -207,7 +207,7 @@ static CONTROLLER MC_Controller =
     .max_slew_phase_error = 30000,  // Allow large error during sync slew
 
     .name = "MC",
-    .status_prefix = 'm',
+    .status_ring = CLOCK_PLL_MC_RING,
 
     .GetClock     = GetMachineTime,
     .SetDAC       = SetMachineClockDAC,
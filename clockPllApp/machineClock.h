@@ -36,5 +36,8 @@ typedef struct
 
 bool InitialiseMachineClock(MC_PARAMETERS *Params);
 
+/* The controller definition is exposed for the offline simulator. */
+extern struct CONTROLLER MC_Controller;
+
 bool SetNcoFrequency(int nco_offset);
 void MachineClockCommand(char *Command);
@@ -101,7 +101,7 @@ static IIR_PARAMS IIR_params =
 };
 
 
-static CONTROLLER SC_Controller =
+CONTROLLER SC_Controller =
 {
     .prescale = 12500000,   // 125 MHz reference clock sampled at 10Hz
     .frequency_offset = 0,
@@ -110,7 +110,7 @@ static CONTROLLER SC_Controller =
     .max_slew_phase_error = 10,
 
     .name = "SC",
-    .status_prefix = 's',
+    .status_ring = CLOCK_PLL_SC_RING,
 
     .GetClock     = GetSystemTime,
     .SetDAC       = SetSystemClockDAC,
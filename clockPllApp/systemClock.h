@@ -29,4 +29,7 @@
 
 bool InitialiseSystemClock();
 
+/* The controller definition is exposed for the offline simulator. */
+extern struct CONTROLLER SC_Controller;
+
 void SystemClockCommand(char *Command);
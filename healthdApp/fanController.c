@@ -0,0 +1,193 @@
+/* This file is part of the Libera EPICS Driver,
+ *
+ * Copyright (C) 2007 Instrumentation Technologies
+ * Copyright (C) 2009 Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+/* Fan speed controllers for the health daemon. */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "fanController.h"
+
+
+
+/* Clips the fan speed to the allowed range, returning true if the speed was
+ * clipped. */
+
+static bool ClipFanSpeed(int *speed)
+{
+    if (*speed > MAX_FAN_SPEED)
+    {
+        *speed = MAX_FAN_SPEED;
+        return true;
+    }
+    else if (*speed < MIN_FAN_SPEED)
+    {
+        *speed = MIN_FAN_SPEED;
+        return true;
+    }
+    else
+        return false;
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                            Simple PI Control                              */
+/*                                                                           */
+/*****************************************************************************/
+
+/* We run a very simple PI control loop, setting the fan speeds to regulate
+ * the selected temperature sensor. */
+
+static int pi_integral;
+
+static void ResetPi(const FAN_PARAMETERS *Params)
+{
+    pi_integral = 0;
+}
+
+static int StepPi(const FAN_PARAMETERS *Params, const FAN_INPUTS *Inputs)
+{
+    int temp = (int) Inputs->Temperature;
+    int error = temp - Params->Target;
+    pi_integral += error;
+    int new_speed = INITIAL_FAN_SPEED +
+        error * Params->KP + pi_integral * Params->KI;
+
+    if (Params->Verbosity > 0)
+        log_message(LOG_INFO,
+            "temp = %d, error = %d, integral = %d, new_speed = %d",
+            temp, error, pi_integral, new_speed);
+
+    /* Prevent integrator windup when speed reaches its limits. */
+    if (ClipFanSpeed(&new_speed))
+        pi_integral -= error;
+    return new_speed;
+}
+
+const FAN_CONTROLLER PiFanController =
+{
+    .Name = "pi",
+    .Reset = ResetPi,
+    .Step = StepPi,
+};
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                       Model Based Feed Forward Control                    */
+/*                                                                           */
+/*****************************************************************************/
+
+/* Most of the heat in the box is dissipated at a roughly constant rate, but
+ * the CPU adds a significant load which comes and goes with the IOC's
+ * workload.  Waiting for this to show up as a temperature error means the
+ * loop always corrects late, so instead we model the resulting temperature
+ * rise as a first order lag on the CPU load and add a matching fan speed
+ * offset directly, leaving the PI terms to correct the residual (ambient
+ * changes and model error).
+ *
+ * The temperature is used at full sensor resolution, rather than whole
+ * degrees, and fan speed changes smaller than MinStep are suppressed: both
+ * of these reduce fan speed churn, which otherwise shows up as RF board
+ * temperature ripple. */
+
+static struct
+{
+    bool valid;             // Set once the load model has been seeded
+    double load;            // Modelled thermal effect of CPU load
+    double integral;        // Integrated temperature error
+    int speed;              // Last fan speed returned
+} model;
+
+static void ResetModel(const FAN_PARAMETERS *Params)
+{
+    model.valid = false;
+    model.load = 0;
+    model.integral = 0;
+    model.speed = INITIAL_FAN_SPEED;
+}
+
+static int StepModel(const FAN_PARAMETERS *Params, const FAN_INPUTS *Inputs)
+{
+    /* Advance the load model.  On the first step assume the current load
+     * has been present long enough to have settled. */
+    if (model.valid)
+        model.load += (Inputs->Load - model.load) *
+            Params->Interval / (Params->LoadTau + Params->Interval);
+    else
+        model.load = Inputs->Load;
+    model.valid = true;
+
+    double error = Inputs->Temperature - Params->Target;
+    model.integral += error;
+    double feed_forward = Params->KF * model.load;
+    int new_speed = INITIAL_FAN_SPEED + (int) (feed_forward +
+        error * Params->KP + model.integral * Params->KI);
+
+    if (Params->Verbosity > 0)
+        log_message(LOG_INFO,
+            "temp = %.2f, load = %.2f, model = %.2f, integral = %.2f, "
+            "new_speed = %d",
+            Inputs->Temperature, Inputs->Load, model.load, model.integral,
+            new_speed);
+
+    if (ClipFanSpeed(&new_speed))
+        model.integral -= error;
+    /* Ignore trivial changes, but always allow the limits to be reached. */
+    if (abs(new_speed - model.speed) >= Params->MinStep  ||
+        new_speed == MIN_FAN_SPEED  ||  new_speed == MAX_FAN_SPEED)
+        model.speed = new_speed;
+    return model.speed;
+}
+
+const FAN_CONTROLLER ModelFanController =
+{
+    .Name = "model",
+    .Reset = ResetModel,
+    .Step = StepModel,
+};
+
+
+
+const FAN_CONTROLLER * FindFanController(const char *Name)
+{
+    static const FAN_CONTROLLER * Controllers[] =
+        { &PiFanController, &ModelFanController };
+    for (unsigned int i = 0; i < sizeof(Controllers)/sizeof(Controllers[0]);
+         i ++)
+        if (strcmp(Name, Controllers[i]->Name) == 0)
+            return Controllers[i];
+    return NULL;
+}
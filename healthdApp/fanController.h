@@ -0,0 +1,99 @@
+/* This file is part of the Libera EPICS Driver,
+ *
+ * Copyright (C) 2007 Instrumentation Technologies
+ * Copyright (C) 2009 Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+/* Pluggable fan speed controllers for the health daemon.
+ *
+ * A controller is stepped once per loop interval with the latest sensor
+ * readings and returns the fan speed to set, which must lie within the
+ * limits below.  Controllers hold their own private state, but all share the
+ * parameters in FAN_PARAMETERS, which can be changed at any time. */
+
+
+/* Limits on controlled fan speeds: the controller won't attempt to push
+ * beyond these limits. */
+#define MAX_FAN_SPEED   5700
+/* This minimum speed of 4,300 RPM is specified by Instrumentation
+ * Technologies.  If the fans are driven at lower speeds then their drive
+ * transistors can be overloaded!  This constraint was reported in an e-mail
+ * from Matjaz Znidarcic dated 1st July 2009.  A minimum set speed of 4,100
+ * appears to be acceptable, according to i-Tech. */
+#define MIN_FAN_SPEED   4100
+
+/* It really doesn't matter hugely how we start, so to simplify things we
+ * assume an initial fan speed of 4,500 RPM.  The controller will settle
+ * quickly enough anyhow.
+ *    The one disadvantage of not reading the fan speed at startup is that
+ * restarting the health daemon will force the controller to hunt for the
+ * right speed again.  Not a big deal. */
+#define INITIAL_FAN_SPEED   4500
+
+
+typedef struct
+{
+    int Target;         // Target temperature in degrees
+    int Interval;       // Loop interval in seconds
+    int KP;             // Proportional gain, RPM per degree
+    int KI;             // Integral gain, RPM per degree per interval
+    int KF;             // Feed forward gain, RPM per unit of CPU load
+    int LoadTau;        // Thermal time constant for load in seconds
+    int MinStep;        // Smallest fan speed change worth making
+    int Verbosity;
+} FAN_PARAMETERS;
+
+typedef struct
+{
+    double Temperature; // Controlled temperature in degrees
+    double Load;        // CPU load as a fraction between 0 and 1
+} FAN_INPUTS;
+
+typedef struct
+{
+    const char * Name;
+    /* Called before the first step and whenever control is resumed. */
+    void (*Reset)(const FAN_PARAMETERS *Params);
+    /* Returns the fan speed to set for the given inputs. */
+    int (*Step)(const FAN_PARAMETERS *Params, const FAN_INPUTS *Inputs);
+} FAN_CONTROLLER;
+
+
+/* The original fixed gain PI controller working on whole degrees. */
+extern const FAN_CONTROLLER PiFanController;
+/* PI controller with feed forward from a first order model of the thermal
+ * load due to the CPU, and suppression of trivial fan speed changes. */
+extern const FAN_CONTROLLER ModelFanController;
+
+/* Looks up a controller by name, returns NULL if not found. */
+const FAN_CONTROLLER * FindFanController(const char *Name);
+
+
+/* Writes message to system log (in daemon mode) or stdout (in interactive
+ * mode). */
+void log_message(int Priority, const char * Format, ...)
+    __attribute__((format(printf, 2, 3)));
@@ -45,28 +45,10 @@
 
 #include "test_error.h"
 #include "healthd.h"
+#include "fanController.h"
 
 
 
-/* Limits on controlled fan speeds: the controller won't attempt to push
- * beyond these limits. */
-#define MAX_FAN_SPEED   5700
-/* This minimum speed of 4,300 RPM is specified by Instrumentation
- * Technologies.  If the fans are driven at lower speeds then their drive
- * transistors can be overloaded!  This constraint was reported in an e-mail
- * from Matjaz Znidarcic dated 1st July 2009.  A minimum set speed of 4,100
- * appears to be acceptable, according to i-Tech. */
-#define MIN_FAN_SPEED   4100
-
-/* It really doesn't matter hugely how we start, so to simplify things we
- * assume an initial fan speed of 4,500 RPM.  The controller will settle
- * quickly enough anyhow.
- *    The one disadvantage of not reading the fan speed at startup is that
- * restarting the health daemon will force the controller to hunt for the
- * right speed again.  Not a big deal. */
-#define INITIAL_FAN_SPEED   4500
-
-
 /* Macro to set specified variable to defaults below. */
 #define SET_DEFAULT(value, class) \
     if (value == -1) \
@@ -84,6 +66,11 @@
 #define CONTROLLER_KP_MB        40
 #define CONTROLLER_KI_MB        40
 
+/* Default feed forward model parameters, common to both sensors. */
+#define CONTROLLER_KF           300
+#define LOAD_TIME_CONSTANT      600
+#define MIN_SPEED_STEP          20
+
 
 /*****************************************************************************/
 /*                                                                           */
@@ -94,23 +81,32 @@
 /* Parameters read from the control line. */
 static bool daemon_mode = true;
 static bool use_rf_sensor = false;
-static int loop_interval = 60;
 static const char * panic_action = NULL;
 /* Panic temperatures used to force reboot (or configured panic action). */
 static int max_temperature_MB = PANIC_TEMP_MB;
 static int max_temperature_RF = PANIC_TEMP_RF;
 
-/* These paramters are all sensor dependent.  If they are not specified then
- * defaults will be configured. */
-static int target_temperature = -1;
-static int controller_KP = -1;
-static int controller_KI = -1;
+/* Controller parameters.  The target temperature and PI gains are sensor
+ * dependent: if they are not specified then defaults will be configured. */
+static FAN_PARAMETERS params =
+{
+    .Target = -1,
+    .Interval = 60,
+    .KP = -1,
+    .KI = -1,
+    .KF = CONTROLLER_KF,
+    .LoadTau = LOAD_TIME_CONSTANT,
+    .MinStep = MIN_SPEED_STEP,
+    .Verbosity = 0,
+};
+
+/* Selected controller.  Changing this resets the control loop. */
+static const FAN_CONTROLLER * volatile controller = &PiFanController;
+static volatile bool controller_changed = false;
 
 /* The health daemon can be externally turned on and off. */
 static volatile bool enabled = true;
 
-static int verbosity = 0;
-
 
 /*****************************************************************************/
 /*                                                                           */
@@ -159,8 +155,6 @@ void print_error(const char * Message, const char * FileName, int LineNumber)
 }
 
 
-void log_message(int Priority, const char * Format, ...)
-    __attribute__((format(printf, 2, 3)));
 void log_message(int Priority, const char * Format, ...)
 {
     va_list args;
@@ -215,15 +209,29 @@ static bool SetParameter(char Option, const char * Value)
     bool Ok = true;
     switch (Option)
     {
-        case 'T':   Ok = ParseInt(Value, &target_temperature);  break;
+        case 'T':   Ok = ParseInt(Value, &params.Target);       break;
         case 'm':   Ok = ParseInt(Value, &max_temperature_MB);  break;
         case 'e':   Ok = ParseInt(Value, &max_temperature_RF);  break;
-        case 't':   Ok = ParseInt(Value, &loop_interval);       break;
-        case 'p':   Ok = ParseInt(Value, &controller_KP);       break;
-        case 'i':   Ok = ParseInt(Value, &controller_KI);       break;
-        case 'v':   Ok = ParseInt(Value, &verbosity);           break;
+        case 't':   Ok = ParseInt(Value, &params.Interval);     break;
+        case 'p':   Ok = ParseInt(Value, &params.KP);           break;
+        case 'i':   Ok = ParseInt(Value, &params.KI);           break;
+        case 'f':   Ok = ParseInt(Value, &params.KF);           break;
+        case 'l':   Ok = ParseInt(Value, &params.LoadTau);      break;
+        case 's':   Ok = ParseInt(Value, &params.MinStep);      break;
+        case 'v':   Ok = ParseInt(Value, &params.Verbosity);    break;
         case 'E':   use_rf_sensor = true;                       break;
         case 'M':   use_rf_sensor = false;                      break;
+        case 'c':
+        {
+            const FAN_CONTROLLER * NewController = FindFanController(Value);
+            Ok = NewController != NULL;
+            if (Ok)
+            {
+                controller = NewController;
+                controller_changed = true;
+            }
+            break;
+        }
         default:
             return false;
     }
@@ -303,21 +311,23 @@ static const char *sensor_fan1;     // Rear fan set speed
 static bool UseSys;     // Whether we're using /sys or /proc
 
 
-static bool ReadTemperature(const char * temp_sensor, int *temp)
+/* Temperatures are returned at full sensor resolution. */
+
+static bool ReadTemperature(const char * temp_sensor, double *temp)
 {
     FILE * input;
     bool Ok = TEST_NULL(input = fopen(temp_sensor, "r"));
     if (Ok)
     {
-        Ok = TEST_OK(fscanf(input, UseSys ? "%d" : "%*d\t%*d\t%d", temp) == 1);
-        if (UseSys)
-            *temp /= 1000;
+        int raw;
+        Ok = TEST_OK(fscanf(input, UseSys ? "%d" : "%*d\t%*d\t%d", &raw) == 1);
+        *temp = UseSys ? raw / 1000.0 : raw;
         fclose(input);
     }
     return Ok;
 }
 
-static bool ReadTemperatures(int *temp_MB, int *temp_RF)
+static bool ReadTemperatures(double *temp_MB, double *temp_RF)
 {
     *temp_RF = 0;
     bool Ok = ReadTemperature(sensor_temp_MB, temp_MB);
@@ -327,6 +337,32 @@ static bool ReadTemperatures(int *temp_MB, int *temp_RF)
 }
 
 
+/* Returns the fraction of CPU time spent busy since the last call. */
+
+static double ReadLoad(void)
+{
+    static unsigned long long last_busy, last_total;
+    double load = 0;
+    FILE * input;
+    if (TEST_NULL(input = fopen("/proc/stat", "r")))
+    {
+        unsigned long long user, nice, system, idle;
+        if (TEST_OK(fscanf(input, "cpu %llu %llu %llu %llu",
+                &user, &nice, &system, &idle) == 4))
+        {
+            unsigned long long busy = user + nice + system;
+            unsigned long long total = busy + idle;
+            if (total > last_total)
+                load = (double) (busy - last_busy) / (total - last_total);
+            last_busy = busy;
+            last_total = total;
+        }
+        fclose(input);
+    }
+    return load;
+}
+
+
 static bool WriteDevice(const char * device, const char * format, ...)
     __attribute__((format(printf, 2, 3)));
 static bool WriteDevice(const char * device, const char * format, ...)
@@ -345,7 +381,7 @@ static bool WriteDevice(const char * device, const char * format, ...)
 
 static void SetFanSpeed(int speed)
 {
-    if (verbosity > 0)
+    if (params.Verbosity > 0)
         log_message(LOG_INFO,
             "Setting fan speed %d => %s, %s", speed, sensor_fan0, sensor_fan1);
     WriteDevice(sensor_fan0, "%d", speed);
@@ -398,14 +434,16 @@ static bool InitialiseController(void)
 
 
     /* Assign defaults to all unassigned parameters. */
-    SET_DEFAULT(target_temperature, TARGET_TEMP);
-    SET_DEFAULT(controller_KP,      CONTROLLER_KP);
-    SET_DEFAULT(controller_KI,      CONTROLLER_KI);
+    SET_DEFAULT(params.Target, TARGET_TEMP);
+    SET_DEFAULT(params.KP,     CONTROLLER_KP);
+    SET_DEFAULT(params.KI,     CONTROLLER_KI);
 
     log_message(LOG_INFO,
         "Health daemon started: sensor: %s, target: %d, KP: %d, KI: %d",
-        use_rf_sensor ? "RF" : "MB", target_temperature,
-        controller_KP, controller_KI);
+        use_rf_sensor ? "RF" : "MB", params.Target, params.KP, params.KI);
+    log_message(LOG_INFO,
+        "  controller: %s, KF: %d, load time constant: %d, min step: %d",
+        controller->Name, params.KF, params.LoadTau, params.MinStep);
     if (use_rf_sensor)
         log_message(LOG_INFO,
             "  MB panic temperature %d, RF panic temperature %d",
@@ -421,10 +459,11 @@ static bool InitialiseController(void)
 }
 
 
-static void PressPanicButton(const char *Reason, int temp_MB, int temp_RF)
+static void PressPanicButton(
+    const char *Reason, double temp_MB, double temp_RF)
 {
     log_message(LOG_ERR,
-        "healthd panic, %s, MB: (%d, %d), RF: (%d, %d)",
+        "healthd panic, %s, MB: (%.1f, %d), RF: (%.1f, %d)",
         Reason, temp_MB, max_temperature_MB, temp_RF, max_temperature_RF);
     if (panic_action == NULL)
         log_message(LOG_ERR, "No panic action specified");
@@ -437,42 +476,24 @@ static void PressPanicButton(const char *Reason, int temp_MB, int temp_RF)
 }
 
 
-/* We run a very simple PI control loop, setting the fan speeds to regulate
- * the selected temperature sensor. */
+/* Reads the sensors and steps the selected controller. */
 
-static void StepControlLoop(int *integral)
+static void StepControlLoop(const FAN_CONTROLLER *active)
 {
-    int temp_MB, temp_RF;
+    double temp_MB, temp_RF;
     if (ReadTemperatures(&temp_MB, &temp_RF))
     {
-        if (temp_MB > max_temperature_MB  ||  temp_RF > max_temperature_RF)
+        /* Panic limits are checked in whole degrees, as always. */
+        if ((int) temp_MB > max_temperature_MB  ||
+            (int) temp_RF > max_temperature_RF)
             PressPanicButton("Over temperature", temp_MB, temp_RF);
 
-        int temp = use_rf_sensor ? temp_RF : temp_MB;
-        int error = temp - target_temperature;
-        *integral += error;
-        int new_speed = INITIAL_FAN_SPEED +
-            error * controller_KP + *integral * controller_KI;
-
-        if (verbosity > 0)
-            log_message(LOG_INFO,
-                "temp = %d, error = %d, integral = %d, new_speed = %d",
-                temp, error, *integral, new_speed);
-
-        /* Prevent integrator windup when speed reaches its limits. */
-        if (new_speed > MAX_FAN_SPEED)
-        {
-            new_speed = MAX_FAN_SPEED;
-            *integral -= error;
-        }
-        else if (new_speed < MIN_FAN_SPEED)
-        {
-            new_speed = MIN_FAN_SPEED;
-            *integral -= error;
-        }
-
+        FAN_INPUTS inputs = {
+            .Temperature = use_rf_sensor ? temp_RF : temp_MB,
+            .Load = ReadLoad(),
+        };
         /* Write the new target fan speed. */
-        SetFanSpeed(new_speed);
+        SetFanSpeed(active->Step(&params, &inputs));
     }
     else
         PressPanicButton("Unable to read temperature", 0, 0);
@@ -481,22 +502,31 @@ static void StepControlLoop(int *integral)
 
 static void RunControlLoop(void)
 {
-    int integral = 0;
+    const FAN_CONTROLLER * active = controller;
+    active->Reset(&params);
     bool was_enabled = enabled;
     while (true)
     {
+        if (controller_changed)
+        {
+            controller_changed = false;
+            active = controller;
+            active->Reset(&params);
+            log_message(LOG_INFO, "Selected %s controller", active->Name);
+        }
+
         bool is_enabled = enabled;
         if (is_enabled)
-            StepControlLoop(&integral);
+            StepControlLoop(active);
         else if (was_enabled)
         {
             /* On transition from enabled to not enabled set the fan speed to
              * a sensible idle speed and reset the control loop. */
             SetFanSpeed(INITIAL_FAN_SPEED);
-            integral = 0;
+            active->Reset(&params);
         }
         was_enabled = is_enabled;
-        sleep(loop_interval);
+        sleep(params.Interval);
     }
 }
 
@@ -522,6 +552,10 @@ static void Usage(const char *Name)
 "    -t:    Specify loop interval in seconds (default is 60 seconds)\n"
 "    -p:    Specify KP parameter for control loop\n"
 "    -i:    Specify KI parameter for control loop\n"
+"    -c:    Select controller: pi (default) or model\n"
+"    -f:    Specify feed forward gain in RPM per unit CPU load (model only)\n"
+"    -l:    Specify CPU load time constant in seconds (model only)\n"
+"    -s:    Specify minimum fan speed change (model only)\n"
 "    -m:    Specify maximum motherboard temperature\n"
 "    -e:    Specify maximum RF board temperature\n"
 "    -E     Use RF board temperature sensor (default is motherboard)\n"
@@ -536,7 +570,7 @@ static bool ProcessOptions(int argc, char *argv[])
 {
     while (true)
     {
-        int opt = getopt(argc, argv, "+hnT:t:p:i:m:e:EMx:v:");
+        int opt = getopt(argc, argv, "+hnT:t:p:i:f:l:s:c:m:e:EMx:v:");
         switch (opt)
         {
             case 'h':
@@ -548,7 +582,8 @@ static bool ProcessOptions(int argc, char *argv[])
             case 'x':   panic_action = optarg;  break;
 
             case 'T':   case 'm':   case 'e':   case 't':   case 'v':
-            case 'p':   case 'i':   case 'E':   case 'M':
+            case 'p':   case 'i':   case 'E':   case 'M':   case 'f':
+            case 'l':   case 's':   case 'c':
                 if (!SetParameter(opt, optarg))
                 {
                     fprintf(stderr, "Invalid value \"%s\" for option -%c\n",
@@ -0,0 +1,395 @@
+/* This file is part of the Libera EPICS Driver,
+ *
+ * Copyright (C) 2009-2011 Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+/* Offline simulation bench for the health daemon fan controllers.
+ *
+ * The selected controller is stepped at the configured loop interval against
+ * a simulated thermal plant, driven through a profile of CPU load and ambient
+ * temperature changes, and the settling time after each change and the fan
+ * speed churn are reported.
+ *
+ * The plant is modelled as two thermal masses: the board carrying the
+ * temperature sensor, which is heated by a fixed load plus the CPU load, and
+ * the air inside the box, which is cooled by the fans with a conductance
+ * proportional to fan speed.  The fans follow their set speed with a short
+ * lag, and the sensor is quantised and noisy. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "fanController.h"
+
+
+#define MAX_EVENTS  64
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                          Simulation Parameters                            */
+/*                                                                           */
+/*****************************************************************************/
+
+static FAN_PARAMETERS params =
+{
+    .Target = 42,
+    .Interval = 60,
+    .KP = 40,
+    .KI = 40,
+    .KF = 300,
+    .LoadTau = 600,
+    .MinStep = 20,
+    .Verbosity = 0,
+};
+static const FAN_CONTROLLER * controller = &PiFanController;
+
+/* Plant parameters. */
+static double base_power = 20;      // Fixed heat load in W
+static double load_power = 3;       // Extra heat at full CPU load in W
+static double board_conductance = 5;    // Board to air in W/K
+static double fan_conductance = 0.342;  // Air to ambient in W/K per 1000 RPM
+static double board_capacity = 1500;    // J/K
+static double air_capacity = 300;       // J/K
+static double fan_lag = 5;              // Fan time constant in s
+static double resolution = 1;           // Sensor quantisation in degrees
+static double sensor_noise = 0.1;       // Sensor noise in degrees
+static double tolerance = 0.5;          // Settling band in degrees
+
+static FILE * trace_file = NULL;
+
+
+/* The profile is a list of step changes in load and ambient temperature.
+ * The last event marks the end of the simulation. */
+typedef struct
+{
+    double time;        // Time of change in s
+    double load;        // CPU load from 0 to 1
+    double ambient;     // Ambient temperature in degrees
+} EVENT;
+
+static EVENT events[MAX_EVENTS] =
+{
+    {     0, 0.2, 25 },
+    { 14400, 0.8, 25 },
+    { 28800, 0.2, 25 },
+    { 43200, 0.2, 27 },
+    { 57600, 0.2, 27 },
+};
+static int event_count = 5;
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                             Simulated Plant                               */
+/*                                                                           */
+/*****************************************************************************/
+
+static double board_temp;
+static double air_temp;
+static double fan_speed = INITIAL_FAN_SPEED;
+static int set_speed = INITIAL_FAN_SPEED;
+
+
+/* Returns normally distributed random numbers with unit variance. */
+
+static double gaussian(void)
+{
+    double u = drand48();
+    double v = drand48();
+    return sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+}
+
+
+/* Starts the plant in equilibrium at the initial fan speed. */
+
+static void InitialisePlant(const EVENT *event)
+{
+    double power = base_power + load_power * event->load;
+    air_temp = event->ambient + power / (fan_conductance * fan_speed / 1000);
+    board_temp = air_temp + power / board_conductance;
+}
+
+
+/* Advances the plant by one second. */
+
+static void StepPlant(const EVENT *event)
+{
+    double power = base_power + load_power * event->load;
+    double to_air = board_conductance * (board_temp - air_temp);
+    double to_ambient =
+        fan_conductance * fan_speed / 1000 * (air_temp - event->ambient);
+    board_temp += (power - to_air) / board_capacity;
+    air_temp += (to_air - to_ambient) / air_capacity;
+    fan_speed += (set_speed - fan_speed) / fan_lag;
+}
+
+
+static double ReadSensor(void)
+{
+    double reading = board_temp + sensor_noise * gaussian();
+    return resolution * floor(reading / resolution);
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                               Statistics                                  */
+/*                                                                           */
+/*****************************************************************************/
+
+/* Per event statistics: time from the event to the last excursion outside
+ * the settling band, and the peak error. */
+static double settle_time[MAX_EVENTS];
+static double peak_error[MAX_EVENTS];
+
+static double error_sum2;
+static int speed_changes;
+static double speed_churn;
+static int min_speed = MAX_FAN_SPEED, max_speed = MIN_FAN_SPEED;
+
+
+static void UpdateStatistics(int event, double time)
+{
+    double error = board_temp - params.Target;
+    error_sum2 += error * error;
+    if (fabs(error) > peak_error[event])
+        peak_error[event] = fabs(error);
+    if (fabs(error) > tolerance)
+        settle_time[event] = time - events[event].time + 1;
+}
+
+
+static void Report(double duration)
+{
+    printf("Controller %s, %d events over %.1f hours\n",
+        controller->Name, event_count - 1, duration / 3600);
+    for (int i = 0; i < event_count - 1; i ++)
+    {
+        double length = events[i + 1].time - events[i].time;
+        printf("  %6.0fs: load %.2f, ambient %.1f: ",
+            events[i].time, events[i].load, events[i].ambient);
+        if (settle_time[i] >= length)
+            printf("not settled");
+        else
+            printf("settled in %.0fs", settle_time[i]);
+        printf(", peak error %.2f\n", peak_error[i]);
+    }
+    printf("RMS error %.3f degrees\n", sqrt(error_sum2 / duration));
+    printf("Fan speed %d..%d, %d changes, %.0f RPM total movement\n",
+        min_speed, max_speed, speed_changes, speed_churn);
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                               Simulation                                  */
+/*                                                                           */
+/*****************************************************************************/
+
+
+void log_message(int Priority, const char * Format, ...)
+{
+    if (params.Verbosity > 0)
+    {
+        va_list args;
+        va_start(args, Format);
+        vprintf(Format, args);
+        printf("\n");
+        va_end(args);
+    }
+}
+
+
+static void RunSimulation(void)
+{
+    InitialisePlant(&events[0]);
+    controller->Reset(&params);
+
+    double duration = events[event_count - 1].time;
+    int event = 0;
+    for (int time = 0; time < duration; time ++)
+    {
+        while (event + 1 < event_count  &&  time >= events[event + 1].time)
+            event += 1;
+
+        if (time % params.Interval == 0)
+        {
+            FAN_INPUTS inputs = {
+                .Temperature = ReadSensor(),
+                .Load = events[event].load,
+            };
+            int new_speed = controller->Step(&params, &inputs);
+            if (new_speed != set_speed)
+            {
+                speed_changes += 1;
+                speed_churn += abs(new_speed - set_speed);
+            }
+            set_speed = new_speed;
+            if (set_speed < min_speed)  min_speed = set_speed;
+            if (set_speed > max_speed)  max_speed = set_speed;
+        }
+
+        StepPlant(&events[event]);
+        UpdateStatistics(event, time);
+        if (trace_file != NULL)
+            fprintf(trace_file, "%d %.3f %.3f %.0f %d\n",
+                time, board_temp, air_temp, fan_speed, set_speed);
+    }
+    Report(duration);
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                                 Startup                                   */
+/*                                                                           */
+/*****************************************************************************/
+
+
+/* Reads a profile of events, one per line as
+ *      time load ambient
+ * The last line marks the end of the simulation. */
+
+static bool ReadProfile(const char *FileName)
+{
+    FILE * input = fopen(FileName, "r");
+    if (input == NULL)
+    {
+        perror(FileName);
+        return false;
+    }
+    event_count = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), input)  &&  event_count < MAX_EVENTS)
+    {
+        EVENT *event = &events[event_count];
+        if (line[0] != '#'  &&  sscanf(line, "%lf %lf %lf",
+                &event->time, &event->load, &event->ambient) == 3)
+            event_count += 1;
+    }
+    fclose(input);
+    if (event_count < 2)
+    {
+        fprintf(stderr, "Profile %s needs at least two events\n", FileName);
+        return false;
+    }
+    return true;
+}
+
+
+static void Usage(const char *Name)
+{
+    printf(
+"Usage: %s [options]\n"
+"Simulates health daemon fan control against a thermal model\n"
+"\n"
+"Options:\n"
+"    -h     Writes out this usage description.\n"
+"    -c:    Select controller: pi (default) or model\n"
+"    -T:    Specify target temperature in degrees (default %d)\n"
+"    -t:    Specify loop interval in seconds (default %d)\n"
+"    -p:    Specify KP parameter for control loop (default %d)\n"
+"    -i:    Specify KI parameter for control loop (default %d)\n"
+"    -f:    Specify feed forward gain (default %d)\n"
+"    -l:    Specify CPU load time constant in seconds (default %d)\n"
+"    -s:    Specify minimum fan speed change (default %d)\n"
+"    -P:    Specify profile file of \"time load ambient\" lines\n"
+"    -q:    Specify sensor resolution in degrees (default %g)\n"
+"    -N:    Specify sensor noise in degrees (default %g)\n"
+"    -o:    Write per second trace to file\n"
+"    -v:    Specify verbosity for debug and diagnostics\n",
+        Name, params.Target, params.Interval, params.KP, params.KI,
+        params.KF, params.LoadTau, params.MinStep, resolution, sensor_noise);
+}
+
+
+static bool ProcessOptions(int argc, char *argv[])
+{
+    int opt;
+    while (opt = getopt(argc, argv, "hc:T:t:p:i:f:l:s:P:q:N:o:v:"), opt != -1)
+    {
+        switch (opt)
+        {
+            case 'h':   Usage(argv[0]);                     exit(0);
+            case 'c':
+                controller = FindFanController(optarg);
+                if (controller == NULL)
+                {
+                    fprintf(stderr, "Unknown controller %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'T':   params.Target    = atoi(optarg);    break;
+            case 't':   params.Interval  = atoi(optarg);    break;
+            case 'p':   params.KP        = atoi(optarg);    break;
+            case 'i':   params.KI        = atoi(optarg);    break;
+            case 'f':   params.KF        = atoi(optarg);    break;
+            case 'l':   params.LoadTau   = atoi(optarg);    break;
+            case 's':   params.MinStep   = atoi(optarg);    break;
+            case 'v':   params.Verbosity = atoi(optarg);    break;
+            case 'q':   resolution       = atof(optarg);    break;
+            case 'N':   sensor_noise     = atof(optarg);    break;
+            case 'P':
+                if (!ReadProfile(optarg))
+                    return false;
+                break;
+            case 'o':
+                trace_file = fopen(optarg, "w");
+                if (trace_file == NULL)
+                {
+                    perror(optarg);
+                    return false;
+                }
+                break;
+            default:
+                fprintf(stderr, "Try `%s -h` for help\n", argv[0]);
+                return false;
+        }
+    }
+    return optind == argc  &&  params.Interval > 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (!ProcessOptions(argc, argv))
+        return 1;
+    srand48(1);
+    RunSimulation();
+    if (trace_file != NULL)
+        fclose(trace_file);
+    return 0;
+}
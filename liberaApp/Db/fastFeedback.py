@@ -30,8 +30,7 @@
 import sys
 from math import *
 
-from support import *
-from iocbuilder import *
+from common import *
 
 FA_ID_COUNT = 512
 
@@ -58,14 +57,6 @@ def FastFeedback():
         longIn('HARD_ERR',     DESC = 'Total hard error count'),
         longIn('RXFIFO',       DESC = 'Max RX FIFO length'),
         longIn('TXFIFO',       DESC = 'Max TX FIFO length'),
-        Waveform('TOA_MIN', FA_ID_COUNT, 'FLOAT',
-            DESC = 'Min Time of Arrival'),
-        Waveform('TOA_MAX', FA_ID_COUNT, 'FLOAT',
-            DESC = 'Max Time of Arrival'),
-        Waveform('RCB', FA_ID_COUNT,   DESC = 'Receive Count'),
-        Waveform('MISSED', FA_ID_COUNT,   DESC = 'Missed Count'),
-        Waveform('PRESENT', FA_ID_COUNT, 'UCHAR',
-            DESC = 'Signal received flag'),
     ] + [
         field
         for i in (1, 2, 3, 4)
@@ -85,6 +76,25 @@ def FastFeedback():
             longIn('LINK%d:TXFIFO' % i,    DESC = 'TX FIFO length'),
         ]]
 
+    # Per ID diagnostics are only updated when something has changed.
+    Trigger(False, [
+        Waveform('TOA_MIN', FA_ID_COUNT, 'FLOAT',
+            DESC = 'Min Time of Arrival'),
+        Waveform('TOA_MAX', FA_ID_COUNT, 'FLOAT',
+            DESC = 'Max Time of Arrival'),
+        Waveform('RCB', FA_ID_COUNT,   DESC = 'Receive Count'),
+        Waveform('MISSED', FA_ID_COUNT,   DESC = 'Missed Count'),
+        Waveform('PRESENT', FA_ID_COUNT, 'UCHAR',
+            DESC = 'Signal received flag'),
+        Waveform('RCB_DELTA', FA_ID_COUNT,
+            DESC = 'Change in receive count'),
+        Waveform('CHANGED_IDS', FA_ID_COUNT,
+            DESC = 'IDs changed in last update'),
+        Waveform('CHANGES', FA_ID_COUNT,
+            DESC = 'Number of updates for each ID'),
+        longIn('CHANGED', 0, FA_ID_COUNT, DESC = 'Number of IDs changed'),
+        longIn('UPDATES', DESC = 'Total diagnostic updates')])
+
     boolOut('PROCESS',
         DESC = 'Update FF fields',
         SCAN = '1 second', FLNK = create_fanout('FANOUT', *inputs))
@@ -62,6 +62,7 @@ def MaxAdc(Name = 'MAXADC'):
 def FirstTurn():
     LONG_LENGTH = 1024
     SHORT_LENGTH = LONG_LENGTH // 4 - 1
+    MAX_TRAINS = 16
 
     SetChannelName('FT')
     Enable()
@@ -70,6 +71,8 @@ def FirstTurn():
     charge = aIn('CHARGE', 0, 2000, 1e-6, 'nC', 2,
         DESC = 'Charge of bunch train')
     max_S = longIn('MAXS', DESC = 'Maximum S in waveform')
+    trains = longIn('TRAINS', 0, MAX_TRAINS,
+        DESC = 'Number of bunch trains detected')
 
     Trigger(True,
         # Raw waveforms as read from the ADC rate buffer
@@ -78,13 +81,21 @@ def FirstTurn():
         # ADC data reduced by 1/4 by recombination
         ABCD_wf(SHORT_LENGTH) + XYQS_wf(SHORT_LENGTH) +
         # Buttons and positions computed within selected window
-        ABCD_() + XYQS_(2))
+        ABCD_() + XYQS_(2) +
+        # Automatically detected bunch trains
+        [trains,
+         Waveform('TRAINOFF', MAX_TRAINS, DESC = 'Start of each bunch train'),
+         Waveform('TRAINLEN', MAX_TRAINS,
+            DESC = 'Length of each bunch train')] +
+        XYQS_wf(MAX_TRAINS, 'TRAIN'))
 
     # Sample window control
     longOut('OFF', 0, SHORT_LENGTH - 1,
         DESC = 'Sample window start position')
     longOut('LEN', 1, SHORT_LENGTH,
         DESC = 'Sample window length')
+    longOut('TRAINTHR', 1, 100, EGU = '%',
+        DESC = 'Bunch train detection threshold')
 
     Waveform('AXIS', SHORT_LENGTH, 'FLOAT', PINI='YES',
         DESC = 'FT waveform axis')
@@ -98,6 +109,12 @@ def Booster():
     SHORT_LENGTH = Parameter('BN_SHORT', 'Length of short BN waveform')
     LONG_LENGTH  = Parameter('BN_LONG', 'Length of long BN waveform')
 
+    def BlockStats(stat, description):
+        return [
+            Waveform(stat + position, LONG_LENGTH,
+                DESC = 'BN block %s of %s' % (description, position))
+            for position in 'XYQS']
+
     SetChannelName('BN')
     Enable()
 
@@ -109,14 +126,24 @@ def Booster():
         # Decimated /64 positions
         XYQS_wf(LONG_LENGTH) +
         # Decimated /1024 positions
-        XYQS_wf(SHORT_LENGTH, 'WFS'))
+        XYQS_wf(SHORT_LENGTH, 'WFS') +
+        # Block statistics of /64 positions
+        BlockStats('MEAN', 'mean') + BlockStats('MIN', 'minimum') +
+        BlockStats('MAX', 'maximum') + BlockStats('STD', 'deviation'))
 
-    # Axes for user friendly graphs, used to label the WF and WFS waveforms.
-    # Each labels the time axis in milliseconds.
+    # Axes for user friendly graphs, used to label the WF, WFS and block
+    # statistics waveforms.  Each labels the time axis in milliseconds.
     Waveform('AXIS',  LONG_LENGTH,  'FLOAT', PINI='YES',
         DESC = 'BN long waveform axis')
     Waveform('AXISS', SHORT_LENGTH, 'FLOAT', PINI='YES',
         DESC = 'BN short waveform axis')
+    axisb = Waveform('AXISB', LONG_LENGTH, 'FLOAT', PINI='YES',
+        DESC = 'BN block statistics axis')
+
+    # Block statistics control.  The block axis is updated when the block
+    # size changes.
+    longOut('RATIO', 1, LONG_LENGTH, FLNK = axisb,
+        DESC = 'BN points per statistics block')
 
     UnsetChannelName()
 
@@ -183,6 +210,9 @@ def FreeRunning():
 
     # Trigger capture offset
     longOut('DELAY', DESC = 'Trigger capture offset')
+    # Software decimation
+    longOut('DECIMATE', 1, 1024,
+        DESC = 'FR software decimation factor')
 
     # Average length
     longOut('AVERAGE', 0, 16,
@@ -249,6 +279,8 @@ def TurnByTurn():
     # Decimation control
     boolOut('DECIMATION', '1:1', '1:64',
         DESC = 'Decimation from turn-by-turn')
+    longOut('DECIMATE', 1, 1024,
+        DESC = 'TT readout decimation factor')
     # Controls whether to update windowed data on capture.
     boolOut('DOREFRESH', 'Stale Data', 'Update Data',
         DESC = 'Update displayed data on trigger')
@@ -275,6 +307,36 @@ def SlowAcquisition():
     current = aIn('CURRENT', 0, 500, 1e-5, 'mA', 3,
         DESC = 'SA input current')
     Trigger(False, ABCD_() + ABCD_N() + XYQS_(4) + [power, current] + MaxAdc())
+
+    # Reports loss of SA updates from the driver.
+    stalled = boolIn('STALLED', 'Ok', 'Stalled',
+        ZSV  = 'NO_ALARM',  OSV  = 'MAJOR',
+        SCAN = 'I/O Intr',  PINI = 'YES',
+        DESC = 'SA updates stalled')
+    ExtraHealthRecords.append(CP(stalled))
+    longIn('STALLS', SCAN = 'I/O Intr', PINI = 'YES',
+        DESC = 'Number of SA stalls')
+
+    # SA history held in the IOC, read out on demand.
+    HISTORY = Parameter('SA_HISTORY', 'Length of SA history readout')
+    mbbOut('HIST:LEVEL',
+        ('10Hz, 1 hour', 0), ('10s, 1 day', 1), ('5min, 10 days', 2),
+        DESC = 'SA history resolution')
+    mbbOut('HIST:FIELD',
+        ('A', 0), ('B', 1), ('C', 2), ('D', 3),
+        ('X', 4), ('Y', 5), ('Q', 6), ('S', 7),
+        ('Power', 8), ('Current', 9),
+        DESC = 'SA history field')
+    longOut('HIST:WINDOW', 1, 864000, EGU = 's',
+        DESC = 'SA history readout window')
+    boolOut('HIST:READ', 'Read', DESC = 'Read SA history')
+    Trigger(False, [
+        Waveform('HIST:' + stat, HISTORY, DESC = 'SA history %s' % description)
+        for stat, description in [
+            ('MIN', 'minimum'), ('MEAN', 'mean'), ('MAX', 'maximum')]] + [
+        Waveform('HIST:T', HISTORY, FTVL = 'FLOAT', EGU = 's',
+            DESC = 'SA history time axis')],
+        TRIG = 'HIST:TRIG', DONE = 'HIST:DONE')
     UnsetChannelName()
 
 
@@ -681,7 +743,13 @@ def ClockStatus(id, name):
         longIn('%s_PHASE_E' % id,
             DESC = '%s clock phase error' % name),
         longIn('%s_FREQ_E' % id,
-            DESC = '%s clock freq error' % name)]
+            DESC = '%s clock freq error' % name),
+        longIn('%s_LOST' % id,
+            DESC = '%s clock status records lost' % name),
+        Waveform('%s_PHASE_WF' % id, 1024,
+            DESC = '%s clock phase error history' % name),
+        Waveform('%s_FREQ_WF' % id, 1024,
+            DESC = '%s clock freq error history' % name)]
     Trigger(False, detail,
         TRIG = '%s_V_TRIG' % id, DONE = '%s_V_DONE' % id)
 
@@ -779,7 +847,13 @@ def Clock():
             LOW  = 0,   LSV  = 'MAJOR',         # Probably does not occur now
             HIGH = 16,  HSV  = 'MAJOR',         # Unspecified stratum
             DESC = 'NTP stratum level'),
-        stringIn('SERVER', DESC = 'Synchronised NTP server')]
+        stringIn('SERVER', DESC = 'Synchronised NTP server'),
+        aIn('NTPOFF', -1000, 1000, 1e-3, 'ms', 3,
+            DESC = 'Clock offset from NTP server'),
+        aIn('NTPDELAY', 0, 1000, 1e-3, 'ms', 3,
+            DESC = 'NTP server round trip delay'),
+        aIn('NTPJITTER', 0, 1000, 1e-3, 'ms', 3,
+            DESC = 'NTP offset jitter')]
 
 
     clock_health = AggregateSeverity('HEALTH', 'Clock status',
@@ -910,6 +984,10 @@ def Sensors():
         aIn('EPICSUP', 0, 24*3600*5, 1./3600, 'h', 2,
             DESC = 'Time since EPICS started'),
 
+        # Memory allocated to waveforms, fixed at startup
+        aIn('WFMEM', 0, 64, 1./MB, 'MB', 2,
+            DESC = 'Waveform memory allocated'),
+
         # Channel access counters
         longIn('CAPVS',  DESC = 'Number of connected PVs'),
         longIn('CACLNT', DESC = 'Number of connected clients'),
@@ -926,7 +1004,37 @@ def Sensors():
         aIn('NWMRX', 0, 1e4, 0.1, 'pkt/s', 1,
             DESC = 'Multicast received per second'),
         aIn('NWMTX', 0, 1e4, 0.1, 'pkt/s', 1,
-            DESC = 'Multicast sent per second')]
+            DESC = 'Multicast sent per second'),
+        aIn('IOINTR', 0, 1e4, 1, 'scan/s', 0,
+            DESC = 'I/O Intr scans per second')]
+
+    # Scheduling policy and worst wakeup latency of time critical threads
+    for thread, description in (
+            ('EVENTS',   'Event receiver'),
+            ('DISPATCH', 'Event dispatcher'),
+            ('SC',       'Signal conditioning'),
+            ('SA',       'Slow acquisition'),
+            ('SENSORS',  'Sensors'),
+            ('PERSIST',  'Persistent state')):
+        extras.extend([
+            stringIn('SCHED_%s' % thread,
+                DESC = '%s scheduling' % description),
+            aIn('JITTER_%s' % thread, 0, 10000, 1, 'us', 0,
+                DESC = '%s wakeup latency' % description)])
+
+    # Worst hold and wait times of the hardware access locks
+    for lock, description in (
+            ('CFG', 'Driver config'),
+            ('DSC', 'DSC state'),
+            ('ADC', 'ADC waveform'),
+            ('DD',  'Turn by turn'),
+            ('PM',  'Postmortem'),
+            ('REG', 'FPGA register')):
+        extras.extend([
+            aIn('LOCK_%s' % lock, 0, 100000, 1, 'us', 0,
+                DESC = '%s lock hold time' % description),
+            aIn('LOCKWAIT_%s' % lock, 0, 100000, 1, 'us', 0,
+                DESC = '%s lock wait time' % description)])
 
     # Aggregate all the alarm generating records into a single "health"
     # record.  Only the alarm status of this record is meaningful.
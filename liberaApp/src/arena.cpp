@@ -0,0 +1,130 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Permanent memory arena for waveform buffers. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "hardware.h"
+#include "device.h"
+#include "publish.h"
+
+#include "arena.h"
+
+
+/* Small allocations are taken from blocks of this size.  Anything larger
+ * than half a block gets a block of its own. */
+#define ARENA_BLOCK_SIZE    (256 * 1024)
+
+
+static pthread_mutex_t ArenaMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The block currently being allocated from. */
+static char * CurrentBlock = NULL;
+static size_t CurrentOffset = 0;
+static size_t CurrentSize = 0;
+
+/* Total memory mapped and memory successfully locked, both in bytes. */
+static int ArenaSize = 0;
+static int ArenaLocked = 0;
+static bool LockFailed = false;
+
+
+/* Maps a fresh block of memory, prefaulting it and locking it into RAM.  If
+ * locking fails (for instance, if we don't have the privilege) we carry on
+ * without, but report the failure once. */
+
+static char * MapBlock(size_t Size)
+{
+    void * Block = mmap(NULL, Size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (Block == MAP_FAILED)
+    {
+        perror("Unable to map waveform memory");
+        abort();
+    }
+
+    ArenaSize += Size;
+    if (mlock(Block, Size) == 0)
+        ArenaLocked += Size;
+    else if (!LockFailed)
+    {
+        perror("Unable to lock waveform memory");
+        LockFailed = true;
+    }
+    return (char *) Block;
+}
+
+
+void * ArenaAllocate(size_t Size, size_t Alignment)
+{
+    size_t PageSize = sysconf(_SC_PAGESIZE);
+    void * Result;
+
+    TEST_0(pthread_mutex_lock(&ArenaMutex));
+    if (Size > ARENA_BLOCK_SIZE / 2)
+        /* Large allocations get their own block, which is page aligned. */
+        Result = MapBlock((Size + PageSize - 1) & ~(PageSize - 1));
+    else
+    {
+        size_t Offset = (CurrentOffset + Alignment - 1) & ~(Alignment - 1);
+        if (CurrentBlock == NULL  ||  Offset + Size > CurrentSize)
+        {
+            CurrentBlock = MapBlock(ARENA_BLOCK_SIZE);
+            CurrentSize = ARENA_BLOCK_SIZE;
+            Offset = 0;
+        }
+        Result = CurrentBlock + Offset;
+        CurrentOffset = Offset + Size;
+    }
+    TEST_0(pthread_mutex_unlock(&ArenaMutex));
+
+    /* Fresh anonymous mappings are already zero filled. */
+    return Result;
+}
+
+
+bool InitialiseArena()
+{
+    Publish_ai("SE:WFMEM", ArenaSize);
+    return true;
+}
+
+
+void ReportArena()
+{
+    printf("Waveform memory: %d kB allocated, %d kB locked\n",
+        ArenaSize / 1024, ArenaLocked / 1024);
+}
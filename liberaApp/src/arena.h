@@ -0,0 +1,59 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Permanent memory arena for waveform buffers.
+ *
+ * All waveform buffers live for the lifetime of the IOC, so rather than
+ * allocating them from the heap they are carved out of a small number of
+ * large blocks which are faulted in and locked into RAM as they are
+ * allocated.  This ensures that the first capture into a waveform doesn't
+ * take a page fault on every page, and records exactly how much memory the
+ * configured waveform lengths consume. */
+
+#include <new>
+
+/* Alignment of arena allocations.  This matches the ARM926 cache line. */
+#define ARENA_ALIGNMENT     32
+
+/* Allocates Size bytes from the arena.  The memory is zero filled and is
+ * never freed.  Safe to call concurrently. */
+void * ArenaAllocate(size_t Size, size_t Alignment = ARENA_ALIGNMENT);
+
+/* Allocates and default constructs an array of Count objects of type T. */
+template<class T> T * ArenaNew(size_t Count)
+{
+    T * Result = (T *) ArenaAllocate(Count * sizeof(T));
+    for (size_t i = 0; i < Count; i ++)
+        new (&Result[i]) T;
+    return Result;
+}
+
+/* Publishes the arena size and reports how much memory has been allocated. */
+bool InitialiseArena();
+void ReportArena();
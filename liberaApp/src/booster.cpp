@@ -43,11 +43,13 @@
 #include "events.h"
 #include "convert.h"
 #include "waveform.h"
+#include "decimate.h"
 
 #include "booster.h"
 
 
 #define DECIMATION      64              // Libera decimation factor
+#define SHORT_DECIMATION 16             // Further decimation for short data
 
 
 /* Fill out each axis waveform with an appropriate linear scale running
@@ -60,35 +62,55 @@ void FillAxis(FLOAT_WAVEFORM &Axis, int Length, float Duration)
 }
 
 
-class BOOSTER : I_EVENT
+class BOOSTER : I_EVENT, LOCKED
 {
 public:
     BOOSTER(int ShortWaveformLength, float FRev) :
         ShortWaveformLength(ShortWaveformLength),
-        LongWaveformLength(16*ShortWaveformLength),
+        LongWaveformLength(SHORT_DECIMATION * ShortWaveformLength),
         LongIq(LongWaveformLength),
         LongAbcd(LongWaveformLength),
         LongXyqs(LongWaveformLength),
         ShortXyqs(ShortWaveformLength),
+        BlockMean(LongWaveformLength),
+        BlockMin(LongWaveformLength),
+        BlockMax(LongWaveformLength),
+        BlockStd(LongWaveformLength),
         LongAxis(LongWaveformLength),
-        ShortAxis(ShortWaveformLength)
+        ShortAxis(ShortWaveformLength),
+        BlockAxis(LongWaveformLength)
     {
         /* Build the linear scales so that we can see booster data against a
          * sensible time scale (in milliseconds).
          *    Each point in the short waveform corresponds to 1024 points at
          * revolution frequency, hence the calculation below. */
-        float RampDuration = 1024 * 1e3 * ShortWaveformLength / FRev;
+        RampDuration = 1024 * 1e3 * ShortWaveformLength / FRev;
         FillAxis(LongAxis,  LongWaveformLength,  RampDuration);
         FillAxis(ShortAxis, ShortWaveformLength, RampDuration);
 
+        /* By default the block statistics are computed over the same blocks
+         * as are used for the short waveform. */
+        BlockRatio = SHORT_DECIMATION;
+        Persistent("BN:RATIO", BlockRatio);
+        if (BlockRatio < 1  ||  BlockRatio > LongWaveformLength)
+            BlockRatio = SHORT_DECIMATION;
+        FillBlockAxis();
+
         /* Publish the PVs associated with Booster data. */
         LongIq.Publish("BN");
         LongAbcd.Publish("BN");
         LongXyqs.Publish("BN");
         ShortXyqs.Publish("BN", "WFS");
 
+        BlockMean.Publish("BN", "MEAN");
+        BlockMin.Publish("BN", "MIN");
+        BlockMax.Publish("BN", "MAX");
+        BlockStd.Publish("BN", "STD");
+        PUBLISH_METHOD_OUT(longout, "BN:RATIO", SetBlockRatio, BlockRatio);
+
         Publish_waveform("BN:AXIS", LongAxis);
         Publish_waveform("BN:AXISS", ShortAxis);
+        Publish_waveform("BN:AXISB", BlockAxis);
 
         /* Trigger and interlock. */
         Interlock.Publish("BN", true);
@@ -113,37 +135,65 @@ public:
         LongIq.Capture(DECIMATION);
         LongAbcd.CaptureCordic(LongIq);
         LongXyqs.CaptureConvert(LongAbcd);
-        ProcessShortWaveforms();
+        /* Decimate the long waveform of positions to produce the fully
+         * decimated short waveform, for a total decimation of 1:1024. */
+        ShortXyqs.CaptureDecimated(LongXyqs, 0, SHORT_DECIMATION);
+        ProcessBlockStatistics();
 
         Interlock.Ready(LongIq.GetTimestamp());
     }
 
 
 private:
-    void ProcessShortWaveforms()
+    /* Computes the mean, minimum, maximum and standard deviation of each
+     * block of BlockRatio points in the long position waveforms, all in a
+     * single pass, so that the envelope of the ramp can be seen. */
+    void ProcessBlockStatistics()
+    {
+        /* BlockRatio can be changed by EPICS while we run. */
+        THREAD_LOCK(this);
+        size_t Blocks = BlockStatistics(BlockRatio,
+            (const int *) (const void *) LongXyqs.Waveform(),
+            LongXyqs.WorkingLength(), sizeof(XYQS_ROW) / sizeof(int),
+            (int *) (void *) BlockMean.Waveform(),
+            (int *) (void *) BlockMin.Waveform(),
+            (int *) (void *) BlockMax.Waveform(),
+            (int *) (void *) BlockStd.Waveform());
+        BlockMean.SetLength(Blocks, true);
+        BlockMin.SetLength(Blocks, true);
+        BlockMax.SetLength(Blocks, true);
+        BlockStd.SetLength(Blocks, true);
+        THREAD_UNLOCK();
+    }
+
+    bool SetBlockRatio(int Ratio)
     {
-        /* Work through all of the fields in the ABCD waveform block and
-         * compute a block average over each 16 points in the long waveform.
-         * We write this as the fully decimated short waveform, producing a
-         * total decimation of 1:1024. */
-        const int Fields[] = { FIELD_A, FIELD_B, FIELD_C, FIELD_D };
-        for (size_t i = 0; i < ARRAY_SIZE(Fields); i ++)
+        if (1 <= Ratio  &&  Ratio <= LongWaveformLength)
         {
-            const int Field = Fields[i];
-            int Long[LongWaveformLength];
-            int Short[ShortWaveformLength];
-            LongXyqs.Read(Field, Long, LongWaveformLength);
-            /* Work through each long waveform averaging together 16
-             * successive points to form one short waveform point. */
-            for (int j = 0; j < ShortWaveformLength; j ++)
-            {
-                int Total = 0;
-                for (int k = 0; k < 16; k ++)
-                    Total += Long[16*j + k] >> 4;
-                Short[j] = Total;
-            }
-            ShortXyqs.Write(Field, Short, ShortWaveformLength);
+            THREAD_LOCK(this);
+            BlockRatio = Ratio;
+            FillBlockAxis();
+            THREAD_UNLOCK();
+            return true;
         }
+        else
+        {
+            printf("BN:RATIO %d is out of range\n", Ratio);
+            return false;
+        }
+    }
+
+    /* The block axis labels each block at the time of its centre point on
+     * the long waveform axis. */
+    void FillBlockAxis()
+    {
+        float *a = BlockAxis.Array();
+        int Blocks = LongWaveformLength / BlockRatio;
+        for (int i = 0; i < Blocks; i ++)
+            a[i] = (RampDuration * (i * BlockRatio + (BlockRatio - 1) / 2.))
+                / (LongWaveformLength - 1);
+        for (int i = Blocks; i < LongWaveformLength; i ++)
+            a[i] = 0;
     }
 
     /* Startup configurable dimensions. */
@@ -151,17 +201,25 @@ private:
     const int LongWaveformLength;
 
     /* A full length waveform is captured in IQ form and convert to button
-     * values and positions.  From this positions are averaged to produce a
-     * short waveform of positions, with effectively one position per 1024
-     * turns. */
+     * values and positions.  From this positions are filtered and decimated
+     * to produce a short waveform of positions, with effectively one position
+     * per 1024 turns. */
     IQ_WAVEFORMS LongIq;
     ABCD_WAVEFORMS LongAbcd;
     XYQS_WAVEFORMS LongXyqs;
     XYQS_WAVEFORMS ShortXyqs;
-    /* The two axis waveforms are used to help the display of long and short
-     * waveforms in EDM by providing a time axis graduated in milliseconds. */
+    /* Block statistics of the long waveform of positions. */
+    XYQS_WAVEFORMS BlockMean, BlockMin, BlockMax, BlockStd;
+    /* Number of long waveform points in each block of statistics. */
+    int BlockRatio;
+    /* Duration of the complete waveform in milliseconds. */
+    float RampDuration;
+    /* The three axis waveforms are used to help the display of long, short
+     * and block waveforms in EDM by providing a time axis graduated in
+     * milliseconds. */
     FLOAT_WAVEFORM LongAxis;
     FLOAT_WAVEFORM ShortAxis;
+    FLOAT_WAVEFORM BlockAxis;
     /* Interlock for communication with EPICS. */
     INTERLOCK Interlock;
     ENABLE Enable;
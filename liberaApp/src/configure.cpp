@@ -45,6 +45,7 @@
 #include "conditioning.h"
 #include "waveform.h"
 #include "versions.h"
+#include "faFilter.h"
 
 #include "configure.h"
 
@@ -343,23 +344,12 @@ public:
         const char *name, const char *filename,
         void (*on_update)(const int *)):
 
-        DECIMATION_FILTER(name, filename, 5, on_update)
+        DECIMATION_FILTER(name, filename, NOTCH_FILTER_LENGTH, on_update)
     {
         /* After successfully loading NotchFilters[filter_index] compute the
-         * corresponding disabled filter.  This should have the same DC response
-         * as the original filter, computed as
-         *
-         *      2^17 * sum(numerator) / sum(denominator)
-         *
-         * where numerator is coefficients 0,1,2 and denominator is coefficients
-         * 1,2 together with a constant factor of 2^17. */
-        int numerator = filter[0] + filter[1] + filter[2];
-        int denominator = 0x20000 + filter[3] + filter[4];
-        int response = (int) ((0x20000LL * numerator) / denominator);
-        if (response >= 0x20000)
-            response = 0x1FFFF;
-        memset(disabled_filter, 0, sizeof(disabled_filter));
-        disabled_filter[0] = response;
+         * corresponding disabled filter.  This has the same DC response as
+         * the original filter. */
+        DisabledNotchFilter(filter, disabled_filter);
     }
 
 
@@ -368,7 +358,7 @@ private:
 
     /* Disabled version of notch filter with same response as original
      * version. */
-    int disabled_filter[5];
+    int disabled_filter[NOTCH_FILTER_LENGTH];
 };
 
 
@@ -0,0 +1,261 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Software decimation and block reduction of waveforms.
+ *
+ * The hardware only offers decimation of turn by turn data by 1 or 64, so to
+ * provide intermediate bandwidths we decimate captured waveforms here.  Each
+ * column is filtered by a cascaded integrator comb (CIC) filter: this
+ * requires only three additions per input point and no multiplications,
+ * which matters on our ARM.  The CIC filter has a passband droop which we
+ * compensate for with a three tap FIR filter run at the output rate. */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "decimate.h"
+
+
+/* Order of the CIC filter.  The gain of the filter is Factor^CIC_ORDER. */
+#define CIC_ORDER       3
+
+
+/* A third order CIC filter.  The integrators run at the input rate, the
+ * combs at the output rate.  All arithmetic is done modulo 2^64, which is
+ * harmless (and indeed the standard trick for CIC filters) so long as the
+ * final output fits: this is guaranteed by MAX_SOFT_DECIMATION.  The filter
+ * starts with all state zero, which corresponds to an input history of
+ * zeros. */
+
+class CIC_FILTER
+{
+public:
+    CIC_FILTER(int Factor) :
+        Factor(Factor),
+        Integrator1(0), Integrator2(0), Integrator3(0),
+        Comb1(0), Comb2(0), Comb3(0)
+    {
+    }
+
+    /* Feeds one block of Factor points through the integrators, reading
+     * each point Stride ints after the last, and returns the next filter
+     * output.  If Stride is zero then the same point is fed repeatedly. */
+    int64_t Block(const int * Source, size_t Stride)
+    {
+        for (int i = 0; i < Factor; i ++)
+        {
+            Integrator1 += (uint64_t) (int64_t) *Source;
+            Integrator2 += Integrator1;
+            Integrator3 += Integrator2;
+            Source += Stride;
+        }
+
+        uint64_t Delta1 = Integrator3 - Comb1;
+        Comb1 = Integrator3;
+        uint64_t Delta2 = Delta1 - Comb2;
+        Comb2 = Delta1;
+        uint64_t Delta3 = Delta2 - Comb3;
+        Comb3 = Delta2;
+        return (int64_t) Delta3;
+    }
+
+private:
+    const int Factor;
+    uint64_t Integrator1, Integrator2, Integrator3;
+    uint64_t Comb1, Comb2, Comb3;
+};
+
+
+/* Removes the CIC filter gain from a filter output with rounding.  If the
+ * decimation factor is a power of 2 then Shift will be non zero and we can
+ * avoid a costly 64 bit division. */
+
+static inline int Normalise(int64_t Value, int64_t Gain, int Shift)
+{
+    if (Shift > 0)
+        return (int) ((Value + (Gain >> 1)) >> Shift);
+    else if (Value >= 0)
+        return (int) ((Value + Gain / 2) / Gain);
+    else
+        return - (int) ((- Value + Gain / 2) / Gain);
+}
+
+
+/* Decimates a single column.  Output point j is computed after feeding input
+ * block j+1 into the CIC filter: this keeps the filter output approximately
+ * centred on block j, at the cost of needing one block of padding at the end
+ * of the waveform. */
+
+static void DecimateColumn(
+    int Factor, int64_t Gain, int Shift,
+    const int * Source, int * Target, size_t Columns, size_t OutLength)
+{
+    CIC_FILTER Filter(Factor);
+
+    /* Prime the filter with enough copies of the first point to fill its
+     * complete impulse response. */
+    for (int i = 0; i < CIC_ORDER; i ++)
+        Filter.Block(Source, 0);
+    /* The first block only contributes to the alignment delay. */
+    Filter.Block(Source, Columns);
+    Source += Factor * Columns;
+
+    for (size_t j = 1; j < OutLength; j ++)
+    {
+        *Target = Normalise(Filter.Block(Source, Columns), Gain, Shift);
+        Source += Factor * Columns;
+        Target += Columns;
+    }
+
+    /* Complete the last point by repeating the last input. */
+    *Target = Normalise(
+        Filter.Block(Source - Columns, 0), Gain, Shift);
+}
+
+
+/* Compensates for the CIC passband droop.  For large decimation factors the
+ * response of an order N CIC filter near DC is approximately 1 - N w^2/24
+ * (where w is frequency relative to the output sample rate), and the FIR
+ * filter [-a, 1+2a, -a] has response approximately 1 + a w^2.  For N = 3
+ * this gives a = 1/8, or the integer filter [-1, 10, -1]/8.  The ends of the
+ * waveform are extended by repetition. */
+
+static void CompensateColumn(int * Target, size_t Columns, size_t Length)
+{
+    int Previous = Target[0];
+    for (size_t j = 0; j < Length; j ++)
+    {
+        int Current = Target[0];
+        int Next = j + 1 < Length ? Target[Columns] : Current;
+        *Target = (int) ((
+            10 * (int64_t) Current - Previous - Next + 4) >> 3);
+        Previous = Current;
+        Target += Columns;
+    }
+}
+
+
+size_t DecimateRows(
+    int Factor, const int * Source, int * Target,
+    size_t Length, size_t Columns)
+{
+    if (Factor <= 1)
+    {
+        memcpy(Target, Source, Length * Columns * sizeof(int));
+        return Length;
+    }
+    if (Factor > MAX_SOFT_DECIMATION)
+        Factor = MAX_SOFT_DECIMATION;
+
+    size_t OutLength = Length / Factor;
+    if (OutLength == 0)
+        return 0;
+
+    /* Compute the filter gain, and if Factor is a power of 2 the equivalent
+     * shift. */
+    int64_t Gain = (int64_t) Factor * Factor * Factor;
+    int Shift = 0;
+    if ((Factor & (Factor - 1)) == 0)
+        while ((1LL << Shift) < Gain)
+            Shift += 1;
+
+    for (size_t Column = 0; Column < Columns; Column ++)
+    {
+        DecimateColumn(
+            Factor, Gain, Shift,
+            Source + Column, Target + Column, Columns, OutLength);
+        CompensateColumn(Target + Column, Columns, OutLength);
+    }
+    return OutLength;
+}
+
+
+
+/* Block statistics are computed in a single pass over the data, with all
+ * columns of each row processed together.  We accumulate deviations from the
+ * first point of each block rather than the raw values to preserve precision
+ * in the variance.  A single deviation can be as large as 2^32 (S runs up to
+ * 2^31), so the sums of squares are accumulated in double: an int64_t sum
+ * would overflow after only a handful of points.  The plain sums of
+ * deviations fit easily in 64 bits for any block length. */
+
+size_t BlockStatistics(
+    int Factor, const int * Source, size_t Length, size_t Columns,
+    int * Mean, int * Min, int * Max, int * Std)
+{
+    if (Factor < 1)
+        Factor = 1;
+    size_t Blocks = Length / Factor;
+
+    int First[Columns], Minimum[Columns], Maximum[Columns];
+    int64_t Total[Columns];
+    double TotalSquares[Columns];
+    for (size_t Block = 0; Block < Blocks; Block ++)
+    {
+        for (size_t c = 0; c < Columns; c ++)
+        {
+            First[c] = Minimum[c] = Maximum[c] = Source[c];
+            Total[c] = 0;
+            TotalSquares[c] = 0;
+        }
+
+        for (int i = 0; i < Factor; i ++)
+        {
+            for (size_t c = 0; c < Columns; c ++)
+            {
+                int Value = Source[c];
+                int64_t Delta = (int64_t) Value - First[c];
+                Total[c] += Delta;
+                TotalSquares[c] += (double) Delta * (double) Delta;
+                if (Value < Minimum[c])  Minimum[c] = Value;
+                if (Value > Maximum[c])  Maximum[c] = Value;
+            }
+            Source += Columns;
+        }
+
+        for (size_t c = 0; c < Columns; c ++)
+        {
+            int64_t MeanDelta = Total[c] / Factor;
+            double ExactMean = (double) Total[c] / Factor;
+            double Variance = TotalSquares[c] / Factor - ExactMean * ExactMean;
+            Mean[c] = (int) (First[c] + MeanDelta);
+            Min[c] = Minimum[c];
+            Max[c] = Maximum[c];
+            Std[c] = Variance > 0 ? (int) sqrt(Variance) : 0;
+        }
+        Mean += Columns;
+        Min  += Columns;
+        Max  += Columns;
+        Std  += Columns;
+    }
+    return Blocks;
+}
@@ -0,0 +1,58 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Software decimation and block reduction of waveforms. */
+
+/* Largest decimation factor supported.  This is limited by the headroom
+ * required by the CIC filter: the filter gain is Factor^3, and this must fit
+ * together with a 32 bit sample into a 64 bit accumulator. */
+#define MAX_SOFT_DECIMATION     1024
+
+/* Decimates Length rows of Columns interleaved integer columns from Source
+ * into Target by the given Factor, returning the number of rows written,
+ * which will be Length/Factor.  Source and Target may not overlap.
+ *
+ * Each output point is computed by a third order CIC filter followed by a
+ * short FIR filter at the output rate to compensate for the CIC passband
+ * droop.  The data is extended at each end by repeating the end points, and
+ * each output point is approximately centred on the block of Factor input
+ * points it replaces. */
+size_t DecimateRows(
+    int Factor, const int * Source, int * Target,
+    size_t Length, size_t Columns);
+
+/* Reduces Length rows of Columns interleaved integer columns from Source into
+ * statistics over successive blocks of Factor rows, returning the number of
+ * complete blocks processed.  For each block one row, with the same layout
+ * as Source, is written to each of Mean, Min, Max and Std, which hold
+ * respectively the mean, minimum, maximum and standard deviation of each
+ * column over the block. */
+size_t BlockStatistics(
+    int Factor, const int * Source, size_t Length, size_t Columns,
+    int * Mean, int * Min, int * Max, int * Std);
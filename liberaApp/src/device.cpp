@@ -63,6 +63,8 @@
 #include <mbboRecord.h>
 #include <waveformRecord.h>
 
+#include "hardware.h"
+#include "thread.h"
 #include "device.h"
 
 
@@ -98,53 +100,146 @@
  *    This interface is constructed here. */
 
 
-/* A simple lookup table class. */
+/* Lookup table for each record type.  The names of all records bound to this
+ * driver are generated at build time from the databases into one sorted
+ * table per record type, so each published name is located by binary search
+ * and checked against the database as it is published.  Once the database
+ * has been loaded we can report any drift in either direction: names the
+ * driver published which no record bound to, and records which looked for a
+ * name the driver never published.  Records may be published from several
+ * threads during startup, so the table is locked. */
 
-class LOOKUP
+#include "pvTable.h"
+
+class LOOKUP : public LOCKED
 {
 public:
-    LOOKUP()
+    LOOKUP(const char * RecordType, const char * const * Names, int Count) :
+        RecordType(RecordType),
+        Names(Names),
+        Count(Count),
+        Entries(new ENTRY[Count])
     {
-        List = NULL;
+        memset(Entries, 0, Count * sizeof(ENTRY));
+        /* Chain ourself onto the list of all lookup tables.  As this is done
+         * during static initialisation no locking is needed. */
+        NextLookup = AllLookups;
+        AllLookups = this;
     }
 
-    /* Method to look up by name.  Returns NULL if not found. */
+    /* Method to look up by name.  Returns NULL if not published, and in all
+     * cases marks the entry as sought by a record. */
     I_RECORD * Find(const char * Name)
     {
-        for (ENTRY * entry = List; entry != NULL; entry = entry->Next)
-            if (strcmp(entry->Name, Name) == 0)
-                return entry->Value;
-        return NULL;
+        I_RECORD * Result = NULL;
+        int Index = Search(Name);
+        if (Index >= 0)
+        {
+            THREAD_LOCK(this);
+            Entries[Index].Bound = true;
+            Result = Entries[Index].Value;
+            THREAD_UNLOCK();
+        }
+        return Result;
     }
 
-    /* Inserts a new entry into the lookup table.  Note that the given string
-     * is *NOT* copied, so the caller should ensure that it is persistent. */
+    /* Inserts a new entry into the lookup table.  Names not in the database
+     * are reported and discarded, as no record could ever bind to them.  If
+     * the name has already been published the new value replaces it.  The
+     * given name is not retained. */
     void Insert(const char * Name, I_RECORD * Value)
     {
-        ENTRY * Entry = new ENTRY;
-        Entry->Next = List;
-        Entry->Name = Name;
-        Entry->Value = Value;
-        List = Entry;
+        int Index = Search(Name);
+        if (Index < 0)
+            printf("Record %s:%s not in database\n", RecordType, Name);
+        else
+        {
+            bool Duplicate;
+            THREAD_LOCK(this);
+            Duplicate = Entries[Index].Value != NULL;
+            Entries[Index].Value = Value;
+            THREAD_UNLOCK();
+            if (Duplicate)
+                printf("Record %s:%s published twice\n", RecordType, Name);
+        }
+    }
+
+    /* Prints every entry in every table which was published but never bound
+     * to a record, or sought by a record but never published, returning the
+     * number found.  Entries for databases which were not loaded are neither
+     * published nor sought, and are not reported. */
+    static int ReportUnbound()
+    {
+        int Count = 0;
+        for (LOOKUP * Lookup = AllLookups; Lookup != NULL;
+             Lookup = Lookup->NextLookup)
+            for (int i = 0; i < Lookup->Count; i ++)
+            {
+                ENTRY & Entry = Lookup->Entries[i];
+                if (Entry.Bound != (Entry.Value != NULL))
+                {
+                    printf("Record %s:%s %s\n",
+                        Lookup->RecordType, Lookup->Names[i],
+                        Entry.Bound ? "not published" : "not bound");
+                    Count += 1;
+                }
+            }
+        return Count;
     }
 
 private:
+    /* Returns the index of Name in the table, or -1 if not present.  The
+     * table is constant, so no locking is needed. */
+    int Search(const char * Name)
+    {
+        int Low = 0;
+        int High = Count;
+        while (Low < High)
+        {
+            int Mid = (Low + High) / 2;
+            int Compare = strcmp(Name, Names[Mid]);
+            if (Compare == 0)
+                return Mid;
+            else if (Compare < 0)
+                High = Mid;
+            else
+                Low = Mid + 1;
+        }
+        return -1;
+    }
+
     struct ENTRY
     {
-        ENTRY * Next;
-        const char * Name;
         I_RECORD * Value;
+        bool Bound;
     };
 
-    ENTRY * List;
+    const char * const RecordType;
+    const char * const * const Names;
+    const int Count;
+    ENTRY * const Entries;
+
+    LOOKUP * NextLookup;
+    static LOOKUP * AllLookups;
 };
 
+LOOKUP * LOOKUP::AllLookups = NULL;
+
+
+void ReportUnboundRecords()
+{
+    int Count = LOOKUP::ReportUnbound();
+    if (Count > 0)
+        printf("%d records differ between driver and database\n", Count);
+}
+
 
 
 /* This macro builds the appropriate Publish_<record> and Search_<record>
  * methods and initialises any associated static state. */
 #define DEFINE_PUBLISH(record) \
-    static LOOKUP Lookup_##record; \
+    static LOOKUP Lookup_##record( \
+        #record, PvTable_##record, ARRAY_SIZE(PvTable_##record) - 1); \
     DECLARE_PUBLISH(record) \
     { \
         PRINTF("Publishing %s %s\n", Name, #record); \
@@ -179,13 +274,23 @@ DEFINE_PUBLISH(waveform);
 /*****************************************************************************/
 
 
-/* All record implementations use this class. */
+/* Count of I/O Intr scan requests.  This is updated without locking from
+ * any thread, so is only approximate, but it's only used for statistics. */
+static unsigned int IoIntrCount = 0;
+
+unsigned int GetIoIntrCount()
+{
+    return IoIntrCount;
+}
+
+
+/* All record implementations use this class: the generic part implements
+ * I/O Intr support and is shared by all record types. */
 
 class RECORD_BASE : public I_INTR
 {
 public:
-    RECORD_BASE(I_RECORD &iRecord) :
-        iRecord(iRecord)
+    RECORD_BASE(I_RECORD &iRecord)
     {
         ioscanpvt = NULL;
         IOSCANPVT newIoscanpvt;
@@ -205,6 +310,7 @@ public:
         else
         {
             scanIoRequest(ioscanpvt);
+            IoIntrCount += 1;
             return true;
         }
     }
@@ -215,15 +321,39 @@ public:
         *pIoscanpvt = ioscanpvt;
     }
 
-    inline I_RECORD * GetRecord() { return & iRecord; }
-
-
 private:
-    I_RECORD & iRecord;
     IOSCANPVT ioscanpvt;
 };
 
 
+/* The typed part of each record remembers the record interface with its
+ * full type, which is only looked up once when the record is initialised.
+ * A record's dpvt always points to the RECORD_BASE of a RECORD<I_record>
+ * for that record's type. */
+
+template<class I>
+class RECORD : public RECORD_BASE
+{
+public:
+    RECORD(I &iRecord) :
+        RECORD_BASE(iRecord),
+        iRecord(iRecord)
+    {
+    }
+
+    I & iRecord;
+};
+
+template<class I>
+static inline I * GetRecord(void * dpvt)
+{
+    if (dpvt == NULL)
+        return NULL;
+    else
+        return & static_cast<RECORD<I> *>((RECORD_BASE *) dpvt)->iRecord;
+}
+
+
 
 template<class T>
     bool I_WRITER<T>::_do_init(T &value)
@@ -322,9 +452,9 @@ static long get_ioint_(int, dbCommon *pr, IOSCANPVT *pIoscanpvt)
 /* Common record initialisation.  Performs the appropriate record
  * initialisation once the record implementation has been found. */
 
+template<class I>
 static bool init_record_(
-    const char * RecordType, const char * Name,
-    dbCommon *pr, I_RECORD *iRecord)
+    const char * RecordType, const char * Name, dbCommon *pr, I *iRecord)
 {
     /* If we successfully found a record then try binding to it.  If this
      * fails then record initialisation fails, otherwise we're done. */
@@ -340,7 +470,7 @@ static bool init_record_(
     }
     else
     {
-        pr->dpvt = new RECORD_BASE(*iRecord);
+        pr->dpvt = static_cast<RECORD_BASE *>(new RECORD<I>(*iRecord));
         return true;
     }
 }
@@ -452,10 +582,9 @@ static void post_process(dbCommon *pr, epicsEnum16 nsta, I_RECORD *iRecord)
 
 /* Helper code for extracting the appropriate I_record from the record. */
 #define GET_RECORD(record, pr, var) \
-    RECORD_BASE * base = (RECORD_BASE *) pr->dpvt; \
-    if (base == NULL) \
-        return ERROR; \
-    I_##record * var = dynamic_cast<I_##record *> (base->GetRecord())
+    I_##record * var = GetRecord<I_##record>(pr->dpvt); \
+    if (var == NULL) \
+        return ERROR
 
 #define SET_ALARM(pr, ACTION, iRecord) \
     (void) recGblSetSevr(pr, ACTION##_ALARM, iRecord->AlarmStatus())
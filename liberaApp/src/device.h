@@ -49,6 +49,10 @@ public:
     virtual bool IoIntr() = 0;
 };
 
+/* Returns the number of I/O Intr scan requests passed through to EPICS since
+ * startup, for monitoring. */
+unsigned int GetIoIntrCount();
+
 
 /* This class provides for support for I/O Intr scanning and notification,
  * and provides a default implementation without I/O Intr.  All record
@@ -231,3 +235,8 @@ DECLARE_PUBLISH(stringout);
 DECLARE_PUBLISH(mbbi);
 DECLARE_PUBLISH(mbbo);
 DECLARE_PUBLISH(waveform);
+
+
+/* Called once the database has been loaded to report any published records
+ * which no record bound to, and any records which found nothing published. */
+void ReportUnboundRecords();
@@ -0,0 +1,343 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Software model of the FPGA FA filter chain.
+ *
+ * Each stage works on complete rows of FA_COLUMNS buttons with the column
+ * loop innermost and of fixed length, so that the compiler can unroll (and
+ * on the host, vectorise) the button arithmetic. */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "faFilter.h"
+
+
+static int rem(int a, int b)
+{
+    int result = a % b;
+    return result >= 0 ? result : result + b;
+}
+
+
+void DisabledNotchFilter(
+    const int Notch[NOTCH_FILTER_LENGTH], int Disabled[NOTCH_FILTER_LENGTH])
+{
+    /* The DC response of the notch filter is
+     *
+     *      2^17 * sum(numerator) / sum(denominator)
+     *
+     * where numerator is coefficients 0,1,2 and denominator is coefficients
+     * 3,4 together with a constant factor of 2^17. */
+    int numerator = Notch[0] + Notch[1] + Notch[2];
+    int denominator = FA_FILTER_UNITY + Notch[3] + Notch[4];
+    int response = (int) (((int64_t) FA_FILTER_UNITY * numerator) / denominator);
+    if (response >= FA_FILTER_UNITY)
+        response = FA_FILTER_UNITY - 1;
+    memset(Disabled, 0, sizeof(int) * NOTCH_FILTER_LENGTH);
+    Disabled[0] = response;
+}
+
+
+
+FA_FILTER::FA_FILTER(const FA_FILTER_SETTINGS & Settings) :
+    SpikeRemoval(Settings.SpikeRemoval  &&  Settings.TurnsPerSwitch > 0),
+    TurnsPerSwitch(Settings.TurnsPerSwitch > 0 ? Settings.TurnsPerSwitch : 1),
+    AverageShift(Settings.AverageWindow),
+    SpikeHistory(NULL),
+    CicDecimation(Settings.CicDecimation > 1 ? Settings.CicDecimation : 1),
+    CicOrder(Settings.CicOrder > 1 ? Settings.CicOrder : 1),
+    FirDecimation(Settings.FirDecimation > 1 ? Settings.FirDecimation : 1),
+    FirLength(3 * FirDecimation),
+    Fir(new int[FirLength])
+{
+    /* Spike removal phases are reduced modulo the switching period, exactly
+     * as for the DLS FPGA: see WriteSpikeRemovalSettings(). */
+    int AverageLength = 1 << AverageShift;
+    AverageStart = rem(Settings.AverageStop - AverageLength, TurnsPerSwitch);
+    SpikeStart = rem(Settings.SpikeStart, TurnsPerSwitch);
+    SpikeWindow = Settings.SpikeWindow;
+    if (SpikeWindow > TurnsPerSwitch)
+        SpikeWindow = TurnsPerSwitch;
+    if (SpikeRemoval)
+        SpikeHistory = new int[SpikeDelay() + 1][FA_COLUMNS];
+
+    /* The CIC filter gain is CicDecimation^CicOrder, which we can remove by
+     * shifting if the decimation is a power of 2. */
+    CicGain = 1;
+    for (int i = 0; i < CicOrder; i ++)
+        CicGain *= CicDecimation;
+    CicShift = -1;
+    if ((CicDecimation & (CicDecimation - 1)) == 0)
+        for (CicShift = 0; (1LL << CicShift) < CicGain; CicShift ++)
+            ;
+    CicIntegrators = new uint64_t[CicOrder][FA_COLUMNS];
+    CicCombs = new uint64_t[CicOrder][FA_COLUMNS];
+
+    if (Settings.Fir == NULL)
+    {
+        /* No FIR given: use a unity gain boxcar. */
+        for (int i = 0; i < FirLength; i ++)
+            Fir[i] = 0;
+        for (int i = 0; i < FirDecimation; i ++)
+            Fir[FirDecimation + i] = FA_FILTER_UNITY / FirDecimation;
+    }
+    else
+        memcpy(Fir, Settings.Fir, sizeof(int) * FirLength);
+    FirHistory = new int[FirLength][FA_COLUMNS];
+
+    const int * Notches[2] = { Settings.Notch1, Settings.Notch2 };
+    for (int i = 0; i < 2; i ++)
+    {
+        NotchEnabled[i] = Notches[i] != NULL;
+        if (NotchEnabled[i])
+            memcpy(Notch[i], Notches[i], sizeof(Notch[i]));
+    }
+
+    Reset();
+}
+
+
+FA_FILTER::~FA_FILTER()
+{
+    delete [] SpikeHistory;
+    delete [] CicIntegrators;
+    delete [] CicCombs;
+    delete [] Fir;
+    delete [] FirHistory;
+}
+
+
+void FA_FILTER::Reset()
+{
+    if (SpikeRemoval)
+        memset(SpikeHistory, 0, sizeof(int[FA_COLUMNS]) * (SpikeDelay() + 1));
+    memset(SpikeAverage, 0, sizeof(SpikeAverage));
+    for (int i = 0; i < 4; i ++)
+        SpikePeriod[i] = -1;
+    Turn = 0;
+
+    memset(CicIntegrators, 0, sizeof(uint64_t[FA_COLUMNS]) * CicOrder);
+    memset(CicCombs, 0, sizeof(uint64_t[FA_COLUMNS]) * CicOrder);
+    CicCount = 0;
+
+    memset(FirHistory, 0, sizeof(int[FA_COLUMNS]) * FirLength);
+    FirIndex = 0;
+    FirCount = 0;
+
+    memset(NotchState, 0, sizeof(NotchState));
+}
+
+
+
+/* Spike removal replaces the turns in the spike window following each
+ * switch with the average of the turns in the averaging window before it.
+ * The two windows can overlap in time, so the output is delayed by two
+ * switching periods: this ensures that the average is always complete when
+ * it is needed.  Turn 0 of the input is taken to be a switch. */
+
+bool FA_FILTER::SpikeStage(const int * Row, int * Out)
+{
+    if (!SpikeRemoval)
+    {
+        memcpy(Out, Row, sizeof(int[FA_COLUMNS]));
+        return true;
+    }
+
+    const int Delay = SpikeDelay();
+    const int HistoryLength = Delay + 1;
+    int64_t Now = Turn ++;
+    memcpy(SpikeHistory[Now % HistoryLength], Row, sizeof(int[FA_COLUMNS]));
+
+    /* If this turn completes an averaging window then compute the average
+     * for its switching period. */
+    const int AverageLength = 1 << AverageShift;
+    int64_t AverageEnd = Now - AverageStart - AverageLength + 1;
+    if (AverageEnd >= 0  &&  AverageEnd % TurnsPerSwitch == 0)
+    {
+        int64_t Period = AverageEnd / TurnsPerSwitch;
+        int64_t Sum[FA_COLUMNS] = { 0, 0, 0, 0 };
+        for (int i = 0; i < AverageLength; i ++)
+        {
+            const int * History = SpikeHistory[(Now - i) % HistoryLength];
+            for (int c = 0; c < FA_COLUMNS; c ++)
+                Sum[c] += History[c];
+        }
+        for (int c = 0; c < FA_COLUMNS; c ++)
+            SpikeAverage[Period % 4][c] = (int) (Sum[c] >> AverageShift);
+        SpikePeriod[Period % 4] = Period;
+    }
+
+    if (Now < Delay)
+        return false;
+
+    /* Emit the delayed turn, replacing it if it falls in a spike window for
+     * which we have an average. */
+    int64_t Output = Now - Delay;
+    int64_t Spike = Output - SpikeStart;
+    int64_t Period = Spike / TurnsPerSwitch;
+    if (Spike >= 0  &&  Spike - Period * TurnsPerSwitch < SpikeWindow  &&
+        SpikePeriod[Period % 4] == Period)
+        memcpy(Out, SpikeAverage[Period % 4], sizeof(int[FA_COLUMNS]));
+    else
+        memcpy(Out, SpikeHistory[Output % HistoryLength],
+            sizeof(int[FA_COLUMNS]));
+    return true;
+}
+
+
+/* The CIC stage runs CicOrder integrators at turn rate and CicOrder combs at
+ * the decimated rate.  As usual the arithmetic is modulo 2^64, which is
+ * harmless so long as the final output fits. */
+
+bool FA_FILTER::CicStage(const int * Row, int * Out)
+{
+    if (CicDecimation == 1)
+    {
+        memcpy(Out, Row, sizeof(int[FA_COLUMNS]));
+        return true;
+    }
+
+    for (int c = 0; c < FA_COLUMNS; c ++)
+        CicIntegrators[0][c] += (uint64_t) (int64_t) Row[c];
+    for (int i = 1; i < CicOrder; i ++)
+        for (int c = 0; c < FA_COLUMNS; c ++)
+            CicIntegrators[i][c] += CicIntegrators[i - 1][c];
+
+    CicCount += 1;
+    if (CicCount < CicDecimation)
+        return false;
+    CicCount = 0;
+
+    for (int c = 0; c < FA_COLUMNS; c ++)
+    {
+        uint64_t Value = CicIntegrators[CicOrder - 1][c];
+        for (int i = 0; i < CicOrder; i ++)
+        {
+            uint64_t Delta = Value - CicCombs[i][c];
+            CicCombs[i][c] = Value;
+            Value = Delta;
+        }
+
+        /* Remove the filter gain, truncating towards minus infinity. */
+        int64_t Result = (int64_t) Value;
+        if (CicShift >= 0)
+            Out[c] = (int) (Result >> CicShift);
+        else if (Result >= 0)
+            Out[c] = (int) (Result / CicGain);
+        else
+            Out[c] = (int) - ((- Result + CicGain - 1) / CicGain);
+    }
+    return true;
+}
+
+
+/* The polyphase FIR computes one output for every FirDecimation inputs from
+ * the last 3*FirDecimation inputs, with coefficient 0 applied to the most
+ * recent. */
+
+bool FA_FILTER::FirStage(const int * Row, int * Out)
+{
+    memcpy(FirHistory[FirIndex], Row, sizeof(int[FA_COLUMNS]));
+    FirIndex += 1;
+    if (FirIndex == FirLength)
+        FirIndex = 0;
+
+    FirCount += 1;
+    if (FirCount < FirDecimation)
+        return false;
+    FirCount = 0;
+
+    int64_t Sum[FA_COLUMNS] = { 0, 0, 0, 0 };
+    int Index = FirIndex;           // Oldest entry in history
+    for (int k = FirLength - 1; k >= 0; k --)
+    {
+        const int * History = FirHistory[Index];
+        int64_t Coefficient = Fir[k];
+        for (int c = 0; c < FA_COLUMNS; c ++)
+            Sum[c] += Coefficient * History[c];
+        Index += 1;
+        if (Index == FirLength)
+            Index = 0;
+    }
+    for (int c = 0; c < FA_COLUMNS; c ++)
+        Out[c] = (int) (Sum[c] >> FA_FILTER_SHIFT);
+    return true;
+}
+
+
+/* Each notch filter is a direct form biquad computing
+ *
+ *      2^17 y[n] = a0 x[n] + a1 x[n-1] + a2 x[n-2] - a3 y[n-1] - a4 y[n-2] .
+ */
+
+void FA_FILTER::NotchStage(int Index, const int * Coefficients, int * Row)
+{
+    int (*State)[FA_COLUMNS] = NotchState[Index];
+    for (int c = 0; c < FA_COLUMNS; c ++)
+    {
+        int64_t Sum =
+            (int64_t) Coefficients[0] * Row[c] +
+            (int64_t) Coefficients[1] * State[0][c] +
+            (int64_t) Coefficients[2] * State[1][c] -
+            (int64_t) Coefficients[3] * State[2][c] -
+            (int64_t) Coefficients[4] * State[3][c];
+        int Result = (int) (Sum >> FA_FILTER_SHIFT);
+        State[1][c] = State[0][c];
+        State[0][c] = Row[c];
+        State[3][c] = State[2][c];
+        State[2][c] = Result;
+        Row[c] = Result;
+    }
+}
+
+
+size_t FA_FILTER::Process(const int * Source, size_t Length, int * Target)
+{
+    size_t Written = 0;
+    for (size_t i = 0; i < Length; i ++)
+    {
+        int Spike[FA_COLUMNS], Cic[FA_COLUMNS], Fa[FA_COLUMNS];
+        if (SpikeStage(Source, Spike)  &&
+            CicStage(Spike, Cic)  &&
+            FirStage(Cic, Fa))
+        {
+            for (int n = 0; n < 2; n ++)
+                if (NotchEnabled[n])
+                    NotchStage(n, Notch[n], Fa);
+            memcpy(Target, Fa, sizeof(Fa));
+            Target += FA_COLUMNS;
+            Written += 1;
+        }
+        Source += FA_COLUMNS;
+    }
+    return Written;
+}
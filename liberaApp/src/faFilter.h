@@ -0,0 +1,163 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Software model of the FPGA filter chain from turn by turn button
+ * magnitudes to FA data.
+ *
+ * The chain modelled is spike removal at turn by turn rate, a CIC decimation
+ * stage, the polyphase FIR decimation filter, and finally the two notch
+ * filters at FA rate.  Coefficients take the same form as those written to
+ * the FPGA through WriteFA_FIR() and WriteNotchFilter1/2(), and the spike
+ * removal parameters are those passed to WriteSpikeRemovalSettings().
+ *
+ * All arithmetic is integer and each stage truncates its output, as the FPGA
+ * does.  The structure of the CIC stage and the stage latencies are not
+ * visible through the register interface, so agreement with a particular
+ * FPGA build should be confirmed against a captured FA stream. */
+
+/* The four buttons A, B, C, D are processed together as interleaved rows, in
+ * the same layout as ABCD_ROW. */
+#define FA_COLUMNS      4
+
+/* Scaling of FIR and notch filter coefficients: the FIR coefficients should
+ * sum to this for unit gain, and the notch filter denominator is
+ * FA_FILTER_UNITY + a3 z^-1 + a4 z^-2. */
+#define FA_FILTER_SHIFT 17
+#define FA_FILTER_UNITY (1 << FA_FILTER_SHIFT)
+
+#define NOTCH_FILTER_LENGTH     5
+
+
+struct FA_FILTER_SETTINGS
+{
+    /* Spike removal.  Offsets are in turns relative to the switch, as set by
+     * the CF:SR: PVs, and AverageWindow is the log2 of the window length. */
+    bool SpikeRemoval;
+    int TurnsPerSwitch;
+    int AverageWindow;
+    int AverageStop;
+    int SpikeStart;
+    int SpikeWindow;
+
+    /* Decimation from turn by turn to FA rate: the CIC stage decimates by
+     * CicDecimation (VE:FACIC), then the FIR stage by FirDecimation
+     * (VE:FAFIR). */
+    int CicDecimation;
+    int CicOrder;
+    int FirDecimation;
+    const int * Fir;            // 3 * FirDecimation coefficients
+
+    /* Notch filters, each NOTCH_FILTER_LENGTH coefficients, or NULL to
+     * bypass the filter altogether. */
+    const int * Notch1;
+    const int * Notch2;
+};
+
+
+/* Computes the notch filter used when notch filters are disabled: this is a
+ * pure gain with the same DC response as Notch. */
+void DisabledNotchFilter(
+    const int Notch[NOTCH_FILTER_LENGTH], int Disabled[NOTCH_FILTER_LENGTH]);
+
+
+class FA_FILTER
+{
+public:
+    FA_FILTER(const FA_FILTER_SETTINGS & Settings);
+    ~FA_FILTER();
+
+    /* Returns the filter to its initial state with an input history of
+     * zeros, for example between unrelated waveforms. */
+    void Reset();
+
+    /* Filters Length turns of interleaved button data from Source, writing
+     * FA rows to Target and returning the number of rows written.  Target
+     * must have room for Length / FaDecimation() + 1 rows.  Filter state is
+     * carried between calls, so a long stream can be processed in blocks of
+     * any size. */
+    size_t Process(const int * Source, size_t Length, int * Target);
+
+    /* Number of turns per FA sample. */
+    int FaDecimation() const
+    {
+        return CicDecimation * FirDecimation;
+    }
+
+    /* Delay in turns added by spike removal, which needs to see the whole
+     * averaging window before it can replace a spike. */
+    int SpikeDelay() const
+    {
+        return SpikeRemoval ? 2 * TurnsPerSwitch : 0;
+    }
+
+private:
+    FA_FILTER(const FA_FILTER &);
+    FA_FILTER & operator=(const FA_FILTER &);
+
+    /* Each stage consumes one row of FA_COLUMNS values, and returns true if
+     * it has a row of output. */
+    bool SpikeStage(const int * Row, int * Out);
+    bool CicStage(const int * Row, int * Out);
+    bool FirStage(const int * Row, int * Out);
+    void NotchStage(int Index, const int * Coefficients, int * Row);
+
+    /* Spike removal. */
+    const bool SpikeRemoval;
+    const int TurnsPerSwitch;
+    const int AverageShift;
+    int AverageStart;           // Phase of averaging window in turns
+    int SpikeStart;             // Phase of spike window in turns
+    int SpikeWindow;
+    int (*SpikeHistory)[FA_COLUMNS];        // 2*TurnsPerSwitch+1 turns
+    int SpikeAverage[4][FA_COLUMNS];        // Averages by period modulo 4
+    int64_t SpikePeriod[4];                 // Period of each average
+    int64_t Turn;                           // Turns seen so far
+
+    /* CIC decimation. */
+    const int CicDecimation;
+    const int CicOrder;
+    int CicShift;               // Gain as a shift, or -1 if not power of 2
+    int64_t CicGain;
+    uint64_t (*CicIntegrators)[FA_COLUMNS];
+    uint64_t (*CicCombs)[FA_COLUMNS];
+    int CicCount;
+
+    /* Polyphase FIR decimation. */
+    const int FirDecimation;
+    const int FirLength;
+    int * const Fir;
+    int (*FirHistory)[FA_COLUMNS];          // Circular, FirLength rows
+    int FirIndex;
+    int FirCount;
+
+    /* Notch filters: coefficients and x[n-1], x[n-2], y[n-1], y[n-2]. */
+    bool NotchEnabled[2];
+    int Notch[2][NOTCH_FILTER_LENGTH];
+    int NotchState[2][4][FA_COLUMNS];
+};
@@ -0,0 +1,542 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Offline bench for the FA filter chain model.
+ *
+ * Runs turn by turn button data through FA_FILTER and writes the resulting
+ * FA data, or SA data formed by averaging FA data, as text.  The input can
+ * be text, turn by turn waveforms from a data stream capture (see replay.h),
+ * or a synthetic beam with switching artefacts.  The filters are read from
+ * files in the same format as /opt/lib on Libera, so a new filter can be
+ * evaluated here before it is installed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+
+#include "hardware.h"
+#include "replay.h"
+
+#include "faFilter.h"
+
+
+#define MAX_FIR_LENGTH  1024
+
+
+/* Filter chain settings, initialised to the IOC defaults. */
+static const char * FilterDirectory = "/opt/lib";
+static const char * Notch1File = NULL;
+static const char * Notch2File = NULL;
+static const char * FirFile = NULL;
+static bool NotchDisabled = false;
+static bool NotchBypassed = false;
+static FA_FILTER_SETTINGS Settings =
+{
+    false, 0, 3, -1, -3, 8,     // Spike removal, as in configure.cpp
+    1, 1, 1, NULL,              // Decimation and FIR
+    NULL, NULL,                 // Notch filters
+};
+
+/* Input and output. */
+static bool ReadCapture = false;
+static int GenerateTurns = 0;
+static double GenerateTune = 0.001;
+static int SaDecimation = 0;
+static double K_mm = 10;
+static bool Quiet = false;
+
+static int Notch1[NOTCH_FILTER_LENGTH];
+static int Notch2[NOTCH_FILTER_LENGTH];
+static int Fir[MAX_FIR_LENGTH];
+
+
+
+void print_error(const char * Message, const char * FileName, int LineNumber)
+{
+    fprintf(stderr, "%s (%s, %d)", Message, FileName, LineNumber);
+    if (errno != 0)
+        fprintf(stderr, ": (%d) %s", errno, strerror(errno));
+    fprintf(stderr, "\n");
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                               Filter Files                                */
+/*                                                                           */
+/*****************************************************************************/
+
+
+/* Reads up to MaxLength coefficients from a filter file in the format read
+ * by the IOC, returning the number read, or -1 on failure. */
+
+static int ReadFilterFile(
+    const char * File, const char * Default, int Filter[], int MaxLength)
+{
+    char Path[256];
+    if (File == NULL)
+    {
+        snprintf(Path, sizeof(Path), "%s/%s", FilterDirectory, Default);
+        File = Path;
+    }
+
+    FILE * Input;
+    if (!TEST_NULL(Input = fopen(File, "r")))
+    {
+        fprintf(stderr, "Unable to open filter file \"%s\"\n", File);
+        return -1;
+    }
+    int Length = 0;
+    while (Length < MaxLength  &&  fscanf(Input, "%i", &Filter[Length]) == 1)
+        Length += 1;
+    fclose(Input);
+    return Length;
+}
+
+
+static bool LoadFilters()
+{
+    int FirLength = ReadFilterFile(FirFile, "polyphase_fir", Fir,
+        MAX_FIR_LENGTH);
+    if (FirLength <= 0  ||  FirLength % 3 != 0)
+    {
+        fprintf(stderr, "FIR filter length must be a multiple of 3\n");
+        return false;
+    }
+    Settings.FirDecimation = FirLength / 3;
+    Settings.Fir = Fir;
+
+    if (!NotchBypassed)
+    {
+        if (ReadFilterFile(Notch1File, "notch1", Notch1,
+                NOTCH_FILTER_LENGTH) != NOTCH_FILTER_LENGTH  ||
+            ReadFilterFile(Notch2File, "notch2", Notch2,
+                NOTCH_FILTER_LENGTH) != NOTCH_FILTER_LENGTH)
+        {
+            fprintf(stderr, "Notch filters must have %d coefficients\n",
+                NOTCH_FILTER_LENGTH);
+            return false;
+        }
+        if (NotchDisabled)
+        {
+            DisabledNotchFilter(Notch1, Notch1);
+            DisabledNotchFilter(Notch2, Notch2);
+        }
+        Settings.Notch1 = Notch1;
+        Settings.Notch2 = Notch2;
+    }
+    return true;
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                                Input Data                                 */
+/*                                                                           */
+/*****************************************************************************/
+
+
+/* A block of turn by turn button data to be filtered from a fresh start. */
+struct INPUT_BLOCK
+{
+    int (*Rows)[FA_COLUMNS];
+    size_t Length;
+    size_t Allocated;
+};
+
+static INPUT_BLOCK * Blocks = NULL;
+static size_t BlockCount = 0;
+
+
+static INPUT_BLOCK & NewBlock()
+{
+    Blocks = (INPUT_BLOCK *) realloc(
+        Blocks, (BlockCount + 1) * sizeof(INPUT_BLOCK));
+    INPUT_BLOCK & Block = Blocks[BlockCount ++];
+    Block.Rows = NULL;
+    Block.Length = 0;
+    Block.Allocated = 0;
+    return Block;
+}
+
+static int * AddRow(INPUT_BLOCK & Block)
+{
+    if (Block.Length >= Block.Allocated)
+    {
+        Block.Allocated = Block.Allocated == 0 ? 4096 : 2 * Block.Allocated;
+        Block.Rows = (int (*)[FA_COLUMNS]) realloc(
+            Block.Rows, Block.Allocated * sizeof(int[FA_COLUMNS]));
+    }
+    return Block.Rows[Block.Length ++];
+}
+
+
+/* The FPGA works with button magnitudes: we approximate its conversion from
+ * IQ data. */
+static void IqToButtons(const int * Iq, int * Row)
+{
+    for (int c = 0; c < FA_COLUMNS; c ++)
+        Row[c] = (int) (hypot(Iq[2*c], Iq[2*c + 1]) + 0.5);
+}
+
+
+/* Reads text input with either 4 (ABCD) or 8 (IQ) integers per turn. */
+
+static bool ReadText(FILE * Input)
+{
+    INPUT_BLOCK & Block = NewBlock();
+    char Line[256];
+    while (fgets(Line, sizeof(Line), Input))
+    {
+        int Values[2 * FA_COLUMNS];
+        int Count = sscanf(Line, "%i %i %i %i %i %i %i %i",
+            &Values[0], &Values[1], &Values[2], &Values[3],
+            &Values[4], &Values[5], &Values[6], &Values[7]);
+        if (Count == 2 * FA_COLUMNS)
+            IqToButtons(Values, AddRow(Block));
+        else if (Count == FA_COLUMNS)
+            memcpy(AddRow(Block), Values, sizeof(int[FA_COLUMNS]));
+        else if (Count > 0)
+        {
+            fprintf(stderr, "Expected 4 or 8 values per line: %s", Line);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/* Reads each waveform in a data stream capture as a separate block. */
+
+static bool ReadStreamCapture(const char * FileName)
+{
+    int File;
+    uint32_t Magic = 0;
+    if (!TEST_IO(File = open(FileName, O_RDONLY))  ||
+        !TEST_OK(read(File, &Magic, sizeof(Magic)) == sizeof(Magic)))
+        return false;
+    if (Magic != STREAM_MAGIC)
+    {
+        fprintf(stderr, "%s is not a data stream capture\n", FileName);
+        return false;
+    }
+
+    bool Ok = true;
+    STREAM_HEADER Header;
+    while (Ok  &&  read(File, &Header, sizeof(Header)) == sizeof(Header))
+    {
+        char * Data = (char *) malloc(Header.Length);
+        Ok = TEST_OK(read(File, Data, Header.Length) ==
+            (ssize_t) Header.Length);
+        if (Ok  &&  Header.Block == STREAM_WAVEFORM  &&
+            Header.Length >= sizeof(STREAM_WAVEFORM_PREFIX))
+        {
+            const LIBERA_ROW * Rows = (const LIBERA_ROW *) (void *)
+                (Data + sizeof(STREAM_WAVEFORM_PREFIX));
+            size_t Length =
+                (Header.Length - sizeof(STREAM_WAVEFORM_PREFIX)) /
+                sizeof(LIBERA_ROW);
+            INPUT_BLOCK & Block = NewBlock();
+            for (size_t i = 0; i < Length; i ++)
+                IqToButtons(Rows[i], AddRow(Block));
+        }
+        free(Data);
+    }
+    close(File);
+    return Ok;
+}
+
+
+/* Generates a beam at constant intensity oscillating horizontally at the
+ * given tune, seen through switches with a slightly different gain for each
+ * button in each of eight switch positions and a transient at each switch.
+ * Without switching (-s) the input is clean. */
+
+static void GenerateInput()
+{
+    INPUT_BLOCK & Block = NewBlock();
+    const double Level = 1e6;
+    const int TurnsPerSwitch = Settings.TurnsPerSwitch;
+    for (int t = 0; t < GenerateTurns; t ++)
+    {
+        double X = 0.01 * sin(2 * M_PI * GenerateTune * t);
+        double Buttons[FA_COLUMNS] = {
+            Level * (1 + X), Level * (1 - X),
+            Level * (1 - X), Level * (1 + X) };
+        if (TurnsPerSwitch > 0)
+        {
+            int Position = (t / TurnsPerSwitch) % 8;
+            int Phase = t % TurnsPerSwitch;
+            for (int c = 0; c < FA_COLUMNS; c ++)
+            {
+                Buttons[c] *= 1 + 0.002 * (((Position + 3 * c) % 8) - 3.5);
+                if (Phase < 2)
+                    Buttons[c] *= 1.05;
+            }
+        }
+        int * Row = AddRow(Block);
+        for (int c = 0; c < FA_COLUMNS; c ++)
+            Row[c] = (int) Buttons[c];
+    }
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                                  Output                                   */
+/*                                                                           */
+/*****************************************************************************/
+
+
+static void WriteRow(const int64_t Row[FA_COLUMNS])
+{
+    int64_t A = Row[0], B = Row[1], C = Row[2], D = Row[3];
+    int64_t S = A + B + C + D;
+    double X = S == 0 ? 0 : 1e6 * K_mm * (A - B - C + D) / S;
+    double Y = S == 0 ? 0 : 1e6 * K_mm * (A + B - C - D) / S;
+    printf("%lld %lld %lld %lld %.0f %.0f %lld\n",
+        (long long) A, (long long) B, (long long) C, (long long) D,
+        X, Y, (long long) S);
+}
+
+
+/* Writes FA rows, or if SA decimation was requested, the mean of each
+ * complete group of SaDecimation rows. */
+
+static void WriteOutput(const int * Fa, size_t Length)
+{
+    if (SaDecimation <= 1)
+        for (size_t i = 0; i < Length; i ++)
+        {
+            int64_t Row[FA_COLUMNS];
+            for (int c = 0; c < FA_COLUMNS; c ++)
+                Row[c] = Fa[FA_COLUMNS * i + c];
+            WriteRow(Row);
+        }
+    else
+        for (size_t i = 0; i + SaDecimation <= Length; i += SaDecimation)
+        {
+            int64_t Row[FA_COLUMNS] = { 0, 0, 0, 0 };
+            for (int j = 0; j < SaDecimation; j ++)
+                for (int c = 0; c < FA_COLUMNS; c ++)
+                    Row[c] += Fa[FA_COLUMNS * (i + j) + c];
+            for (int c = 0; c < FA_COLUMNS; c ++)
+                Row[c] /= SaDecimation;
+            WriteRow(Row);
+        }
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                                Main Program                               */
+/*                                                                           */
+/*****************************************************************************/
+
+
+static void Usage(const char * Name)
+{
+    printf(
+"Usage: %s [options] [<input>]\n"
+"Runs turn by turn button data through a model of the FPGA FA filter chain\n"
+"and writes FA data as lines of A B C D X Y S, with X and Y in nm.\n"
+"<input> (or stdin) is read as lines of 4 (ABCD) or 8 (IQ) integers per\n"
+"turn, unless -r or -g is given.\n"
+"\n"
+"Options:\n"
+"    -f <dir>       Directory of filter files, default /opt/lib\n"
+"    -1 <file>      Notch filter 1, default <dir>/notch1\n"
+"    -2 <file>      Notch filter 2, default <dir>/notch2\n"
+"    -F <file>      Polyphase FIR filter, default <dir>/polyphase_fir\n"
+"    -N             Disable notch filters, as for CF:NOTCHEN\n"
+"    -n             Bypass notch filters completely\n"
+"    -c <cic>       CIC decimation, as given by VE:FACIC, default 1\n"
+"    -o <order>     CIC filter order, default 1\n"
+"    -s <turns>     Enable spike removal with <turns> turns per switch\n"
+"    -w <avewin>,<avestop>,<spikest>,<spikewin>\n"
+"                   Spike removal settings as for the CF:SR: PVs,\n"
+"                   default 3,-1,-3,8\n"
+"    -a <count>     Write SA data averaged over <count> FA samples\n"
+"    -k <mm>        Scaling for X and Y in mm, default 10\n"
+"    -r             <input> is a data stream capture (IOC -R option): each\n"
+"                   waveform captured is filtered separately\n"
+"    -g <turns>[:<tune>]  Filter <turns> turns of synthetic data with beam\n"
+"                   motion at <tune>, default 0.001.  Switching artefacts\n"
+"                   are added if -s is given\n"
+"    -q             Only report the filter processing rate\n",
+        Name);
+}
+
+
+static bool ProcessOptions(int & argc, char ** & argv)
+{
+    while (true)
+    {
+        switch (getopt(argc, argv, "hf:1:2:F:Nnc:o:s:w:a:k:rg:q"))
+        {
+            case 'h':   Usage(argv[0]);                         return false;
+            case 'f':   FilterDirectory = optarg;               break;
+            case '1':   Notch1File = optarg;                    break;
+            case '2':   Notch2File = optarg;                    break;
+            case 'F':   FirFile = optarg;                       break;
+            case 'N':   NotchDisabled = true;                   break;
+            case 'n':   NotchBypassed = true;                   break;
+            case 'c':   Settings.CicDecimation = atoi(optarg);  break;
+            case 'o':   Settings.CicOrder = atoi(optarg);       break;
+            case 's':
+                Settings.SpikeRemoval = true;
+                Settings.TurnsPerSwitch = atoi(optarg);
+                break;
+            case 'w':
+                if (sscanf(optarg, "%d,%d,%d,%d",
+                        &Settings.AverageWindow, &Settings.AverageStop,
+                        &Settings.SpikeStart, &Settings.SpikeWindow) != 4)
+                {
+                    fprintf(stderr, "Malformed spike removal settings\n");
+                    return false;
+                }
+                break;
+            case 'a':   SaDecimation = atoi(optarg);            break;
+            case 'k':   K_mm = atof(optarg);                    break;
+            case 'r':   ReadCapture = true;                     break;
+            case 'g':
+                GenerateTurns = atoi(optarg);
+                if (strchr(optarg, ':'))
+                    GenerateTune = atof(strchr(optarg, ':') + 1);
+                break;
+            case 'q':   Quiet = true;                           break;
+            case -1:
+                argc -= optind;
+                argv += optind;
+                return true;
+            default:
+                fprintf(stderr, "Try `%s -h` for usage\n", argv[0]);
+                return false;
+        }
+    }
+}
+
+
+static bool CheckSettings()
+{
+    if (Settings.SpikeRemoval  &&
+        (Settings.TurnsPerSwitch <= 0  ||  Settings.AverageWindow < 0  ||
+         (1 << Settings.AverageWindow) > Settings.TurnsPerSwitch))
+    {
+        fprintf(stderr,
+            "Spike averaging window must fit within turns per switch\n");
+        return false;
+    }
+
+    /* The CIC gain must fit in 64 bits together with the data. */
+    double Gain = pow(Settings.CicDecimation, Settings.CicOrder);
+    if (Settings.CicDecimation < 1  ||  Settings.CicOrder < 1  ||
+        Gain > 1e9)
+    {
+        fprintf(stderr, "Invalid CIC decimation or order\n");
+        return false;
+    }
+    return true;
+}
+
+
+static double Now()
+{
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return Time.tv_sec + 1e-9 * Time.tv_nsec;
+}
+
+
+int main(int argc, char ** argv)
+{
+    if (!ProcessOptions(argc, argv)  ||  !CheckSettings()  ||
+        !LoadFilters())
+        return 1;
+
+    bool Ok;
+    if (GenerateTurns > 0)
+    {
+        GenerateInput();
+        Ok = true;
+    }
+    else if (ReadCapture)
+        Ok = argc == 1  &&  ReadStreamCapture(argv[0]);
+    else if (argc == 0)
+        Ok = ReadText(stdin);
+    else
+    {
+        FILE * Input;
+        Ok = TEST_NULL(Input = fopen(argv[0], "r"))  &&  ReadText(Input);
+    }
+    if (!Ok)
+        return 1;
+
+    FA_FILTER Filter(Settings);
+    size_t TotalTurns = 0;
+    double Elapsed = 0;
+    for (size_t b = 0; b < BlockCount; b ++)
+    {
+        INPUT_BLOCK & Block = Blocks[b];
+        int * Fa = new int[(Block.Length / Filter.FaDecimation() + 1) *
+            FA_COLUMNS];
+
+        Filter.Reset();
+        double Start = Now();
+        size_t Length = Filter.Process(Block.Rows[0], Block.Length, Fa);
+        Elapsed += Now() - Start;
+        TotalTurns += Block.Length;
+
+        if (!Quiet)
+        {
+            if (BlockCount > 1)
+                printf("# Block %u: %u turns\n",
+                    (unsigned int) b, (unsigned int) Block.Length);
+            WriteOutput(Fa, Length);
+        }
+        delete [] Fa;
+    }
+
+    fprintf(stderr,
+        "Filtered %u turns to FA by %d in %.3f s: %.3g turns/s\n",
+        (unsigned int) TotalTurns, Filter.FaDecimation(), Elapsed,
+        Elapsed > 0 ? TotalTurns / Elapsed : 0);
+    return 0;
+}
@@ -163,14 +163,28 @@ static bool LinkEnable[4] = { true, true, true, true };
 static int LoopBack[4] = { 0, 0, 0, 0 };
 static int XPayload = 14, YPayload = 15;
 
-/*
- */
+/* Per FA ID diagnostics read from the communication controller receive count
+ * and time of arrival buffers.  These arrays are maintained by the
+ * diagnostics thread below and are only updated, under the FF interlock,
+ * when the underlying readings actually change. */
 #define FA_ID_COUNT     512
 static float MinTimeOfArrival[FA_ID_COUNT];
 static float MaxTimeOfArrival[FA_ID_COUNT];
 static int ReceiveCount[FA_ID_COUNT];
 static int MissedCount[FA_ID_COUNT];
 static char ReceivedFlag[FA_ID_COUNT];
+/* Change in receive count for each ID since the previous update. */
+static int ReceiveDelta[FA_ID_COUNT];
+/* List of IDs changed in the last update, padded with -1. */
+static int ChangedIds[FA_ID_COUNT];
+static int ChangedCount;
+/* Running history: number of updates in which each ID has changed together
+ * with the total number of updates posted. */
+static int ChangeHistory[FA_ID_COUNT];
+static int UpdateCount;
+
+/* Interval in milliseconds between polls of the diagnostics buffers. */
+#define FF_DIAGNOSTICS_INTERVAL     1000
 
 static bool MapFastFeedbackMemory()
 {
@@ -208,61 +222,161 @@ static bool MapFastFeedbackMemory()
 
 
 
-/* Read Receive Count and Time Of Arrival Buffers. The firmware supports 512
- * nodes, however we are currently reading the first 256 node IDs since the rest
- * is not allocated yet.  */
-static void ReadReceiveCount()
+/* Read Receive Count or Time Of Arrival Buffer.  The firmware supports 512
+ * nodes, all of which are read out through the given data register after
+ * read enable has been asserted. */
+static void ReadDiagnosticBuffer(
+    volatile int &ReadEnable, volatile int &ReadData, int Result[FA_ID_COUNT])
 {
-    /* Assert Read Enable for Receive Count Buffer, and wait 100usec for
+    /* Assert Read Enable for the buffer, and wait 100usec for
      * synchronisation */
-    ControlSpace->RCBReadEna = 1;
+    ReadEnable = 1;
     usleep(100);
+    for (int i = 0; i < FA_ID_COUNT; i ++)
+        Result[i] = ReadData;
+    /* De-assert read enable flag */
+    ReadEnable = 0;
+}
 
-    /* Currently read the first 256 Nodes. */
-    int max_count = 0;
-    for (int i=0; i<FA_ID_COUNT; i++)
-    {
-        int rx_count = ControlSpace->RCBReadDat;
-        ReceiveCount[i] = rx_count;
-        ReceivedFlag[i] = rx_count > 0;
-        if (rx_count > max_count)
-            max_count = rx_count;
-    }
 
-    /* Compute missed count from received counts. */
-    for (int i=0; i<FA_ID_COUNT; i++)
-        if (ReceiveCount[i] > 0)
-            MissedCount[i] = max_count - ReceiveCount[i];
-        else
-            MissedCount[i] = 0;
+/* Converts raw time of arrival to min and max arrival times.  The lower
+ * 16-bits hold the Min data, the upper 16-bits the Max data. */
+static void UpdateTimeOfArrival(int Id, int TimeOfArrival)
+{
+    /* If Node is not connected, MIN value is stuck at its default value, so
+     * resetting it to 0 for displaying purposes. */
+    if ((TimeOfArrival & 0x0000FFFF) == 65535)
+        MinTimeOfArrival[Id] = 0;
+    else
+        MinTimeOfArrival[Id] = (TimeOfArrival & 0x0000FFFF) / 106.25;
+    MaxTimeOfArrival[Id] = ((TimeOfArrival & 0xFFFF0000) >> 16) / 106.25;
+}
 
-    /* De-assert read enable flag */
-    ControlSpace->RCBReadEna = 0;
+
+static void UpdateMissedCount(int Id, int MaxCount)
+{
+    if (ReceiveCount[Id] > 0)
+        MissedCount[Id] = MaxCount - ReceiveCount[Id];
+    else
+        MissedCount[Id] = 0;
 }
 
-static void ReadTimeOfArrival()
+
+/* The diagnostics buffers are polled by this thread rather than as part of
+ * FF:PROCESS: each buffer takes 512 separate register reads plus a
+ * synchronisation delay, which is best kept off the EPICS scan thread.  The
+ * published waveforms are only processed when at least one ID has changed,
+ * and then only the changed entries are rewritten. */
+
+class FF_DIAGNOSTICS : public THREAD
 {
-    /* Assert Read Enable for Receive Count Buffer, and wait 100usec for
-     * synchronisation */
-    ControlSpace->TOAReadEna = 1;
-    usleep(100);
+public:
+    FF_DIAGNOSTICS() :
+        THREAD("FF_DIAGNOSTICS"),
+        Wakeup(false),
+        FirstPoll(true),
+        MaxCount(0)
+    {
+        memset(LastCount, 0, sizeof(LastCount));
+        memset(LastArrival, 0, sizeof(LastArrival));
+        Interlock.Publish("FF");
+    }
 
-    /* Currently read the first 256 Nodes.  Lower 16-bit Min data, Upper 16-bits
-     * Max data */
-    for (int i=0; i<FA_ID_COUNT; i++)
+private:
+    void Thread()
     {
-        int TimeOfArrival = ControlSpace->TOAReadDat;
-        /* If Node is not connected, MIN value is stuck at its default value, so
-         * resetting it to 0 for displaying purposes. */
-        if ((TimeOfArrival & 0x0000FFFF) == 65535)
-            MinTimeOfArrival[i] = 0;
+        StartupOk();
+        while (Running())
+        {
+            Poll();
+            Wakeup.WaitFor(FF_DIAGNOSTICS_INTERVAL);
+        }
+    }
+
+    void OnTerminate()
+    {
+        Wakeup.Signal();
+    }
+
+    void Poll()
+    {
+        int NewCount[FA_ID_COUNT];
+        int NewArrival[FA_ID_COUNT];
+        ReadDiagnosticBuffer(
+            ControlSpace->RCBReadEna, ControlSpace->RCBReadDat, NewCount);
+        ReadDiagnosticBuffer(
+            ControlSpace->TOAReadEna, ControlSpace->TOAReadDat, NewArrival);
+
+        /* Gather the list of changed IDs, together with the maximum count
+         * which is needed to compute missed counts. */
+        int Changed[FA_ID_COUNT];
+        int Count = 0;
+        int NewMaxCount = 0;
+        bool First = FirstPoll;
+        for (int i = 0; i < FA_ID_COUNT; i ++)
+        {
+            if (First  ||
+                NewCount[i] != LastCount[i]  ||
+                NewArrival[i] != LastArrival[i])
+                Changed[Count++] = i;
+            if (NewCount[i] > NewMaxCount)
+                NewMaxCount = NewCount[i];
+        }
+        FirstPoll = false;
+        if (Count == 0)
+            return;
+
+        Interlock.Wait();
+
+        /* Clear down the deltas and list from the previous update. */
+        for (int i = 0; i < ChangedCount; i ++)
+        {
+            ReceiveDelta[ChangedIds[i]] = 0;
+            ChangedIds[i] = -1;
+        }
+
+        for (int i = 0; i < Count; i ++)
+        {
+            int Id = Changed[i];
+            /* There is no previous count to compare with on the first poll,
+             * so the deltas only become meaningful from the second. */
+            ReceiveDelta[Id] = First ? 0 : NewCount[Id] - LastCount[Id];
+            ReceiveCount[Id] = NewCount[Id];
+            ReceivedFlag[Id] = NewCount[Id] > 0;
+            UpdateTimeOfArrival(Id, NewArrival[Id]);
+            ChangedIds[i] = Id;
+            ChangeHistory[Id] += 1;
+            LastCount[Id] = NewCount[Id];
+            LastArrival[Id] = NewArrival[Id];
+        }
+        ChangedCount = Count;
+        UpdateCount += 1;
+
+        /* Missed counts are relative to the largest count seen, so if this
+         * has moved then all of them need recomputing. */
+        if (NewMaxCount != MaxCount)
+        {
+            MaxCount = NewMaxCount;
+            for (int i = 0; i < FA_ID_COUNT; i ++)
+                UpdateMissedCount(i, MaxCount);
+        }
         else
-            MinTimeOfArrival[i] = (TimeOfArrival & 0x0000FFFF) / 106.25;
-        MaxTimeOfArrival[i] = ((TimeOfArrival & 0xFFFF0000) >> 16) / 106.25;
+            for (int i = 0; i < Count; i ++)
+                UpdateMissedCount(Changed[i], MaxCount);
+
+        Interlock.Ready();
     }
 
-    ControlSpace->TOAReadEna = 0;
-}
+    INTERLOCK Interlock;
+    SEMAPHORE Wakeup;
+    bool FirstPoll;
+    int MaxCount;
+    int LastCount[FA_ID_COUNT];
+    int LastArrival[FA_ID_COUNT];
+};
+
+
+static FF_DIAGNOSTICS * DiagnosticsThread = NULL;
 
 
 /* This is called each time the status and monitor fields are about to be
@@ -293,9 +407,6 @@ static void ProcessRead()
     }
     MaxRxFifoCount = rx_max;
     MaxTxFifoCount = tx_max;
-
-    ReadReceiveCount();
-    ReadTimeOfArrival();
 }
 
 
@@ -398,6 +509,11 @@ bool InitialiseFastFeedback()
     PublishSimpleWaveform(int, "FF:RCB", ReceiveCount);
     PublishSimpleWaveform(int, "FF:MISSED", MissedCount);
     PublishSimpleWaveform(UCHAR, "FF:PRESENT", ReceivedFlag);
+    PublishSimpleWaveform(int, "FF:RCB_DELTA", ReceiveDelta);
+    PublishSimpleWaveform(int, "FF:CHANGED_IDS", ChangedIds);
+    PublishSimpleWaveform(int, "FF:CHANGES", ChangeHistory);
+    Publish_longin("FF:CHANGED", ChangedCount);
+    Publish_longin("FF:UPDATES", UpdateCount);
 
     /* Channel specific read only parameters. */
     PUBLISH_BLOCK(longin, "PARTNER", StatusSpace->LinkPartner);
@@ -413,7 +529,8 @@ bool InitialiseFastFeedback()
 
     /* The ProcessRead function updates the LinkUp array.  All the other
      * fields can be read directly by EPICS, as no special synchronisation or
-     * other treatment is required. */
+     * other treatment is required, except for the per ID diagnostics which
+     * are updated by the diagnostics thread. */
     PUBLISH_ACTION("FF:PROCESS", ProcessRead);
 
     /* Sensible defaults for frame length. */
@@ -446,5 +563,15 @@ bool InitialiseFastFeedback()
     ProcessWrite();
     ProcessPayload();
 
-    return true;
+    for (int i = 0; i < FA_ID_COUNT; i ++)
+        ChangedIds[i] = -1;
+    DiagnosticsThread = new FF_DIAGNOSTICS();
+    return DiagnosticsThread->StartThread();
+}
+
+
+void TerminateFastFeedback()
+{
+    if (DiagnosticsThread != NULL)
+        DiagnosticsThread->Terminate();
 }
@@ -28,3 +28,4 @@
 
 
 bool InitialiseFastFeedback();
+void TerminateFastFeedback();
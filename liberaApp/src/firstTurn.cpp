@@ -71,52 +71,11 @@ static int S_0 = 2340000;
 /* Processing the raw ADC data is a suprisingly complicated process.  The
  * following routines capture the stages. */
 
-/* After processing we work with ADC data in a sign extended and transposed
- * form. */
-typedef int EXTRACTED_ADC[4][ADC_LENGTH];
-
-
 /* Array of offsets into ABCD_ROW structure. */
 static const size_t AbcdFields[] = { FIELD_A, FIELD_B, FIELD_C, FIELD_D };
 
-
-
-/* Returns the maximum ADC value. */
-
-static int Maximum(EXTRACTED_ADC &Data)
-{
-    int Maximum = 0;
-    for (int Index = 0; Index < 4; Index ++)
-    {
-        for (int i = 0; i < ADC_LENGTH; i ++)
-        {
-            int x = Data[Index][i];
-            if ( x > Maximum)  Maximum = x;
-            if (-x > Maximum)  Maximum = -x;
-        }
-    }
-    return Maximum;
-}
-
-
-/* Extracts the raw data from an ADC data block and publishes it to the given
- * waveform.  The data is sign extended and transposed for convenience in
- * subsequent processing. */
-
-static void ExtractRawData(
-    ADC_DATA &RawData, EXTRACTED_ADC &Extracted, ABCD_WAVEFORMS &RawAdc)
-{
-    /* Extract and transpose the ADC data.  For slightly cryptic reasons
-     * (presumably historical) the raw channels from the ADC are numbered in
-     * reverse order.  We reverse this ordering here for consistency with the
-     * signal conditioning component. */
-    for (int i = 0; i < ADC_LENGTH; i ++)
-        for (int j = 0; j < 4; j ++)
-            Extracted[j][i] = RawData[i][3-j];
-    /* Publish each column to RawAdc. */
-    for (int j = 0; j < 4; j ++)
-        RawAdc.Write(AbcdFields[j], Extracted[j], ADC_LENGTH);
-}
+/* Maximum number of separate bunch trains identified in a single waveform. */
+#define MAX_TRAINS          16
 
 
 
@@ -153,22 +112,88 @@ static void ExtractRawData(
  * we are pushing our luck with a scaling of 2 bits (need to fit into signed
  * 31-bits).  However in practice this value works just fine. */
 #define FILTER_SCALE 2
-#define FILTER_TERM(i, j, Raw) \
-    ((FilterADC[j] * Raw[4*i + j]) >> FILTER_SCALE)
 
-static void CondenseAdcData(
-    const int Raw[ADC_LENGTH], int Condensed[SHORT_ADC_LENGTH])
+/* Helper macro for CondenseAdcData: accumulates tap k of the filter into the
+ * Sum for all four channels of the extracted ADC data. */
+#define FILTER_TAP(Sum, op, k) \
+    do { \
+        const ABCD_ROW &Row = RawAdc[4*i + k]; \
+        Sum[0] op (FilterADC[k] * Row.A) >> FILTER_SCALE; \
+        Sum[1] op (FilterADC[k] * Row.B) >> FILTER_SCALE; \
+        Sum[2] op (FilterADC[k] * Row.C) >> FILTER_SCALE; \
+        Sum[3] op (FilterADC[k] * Row.D) >> FILTER_SCALE; \
+    } while (0)
+
+
+/* Copies one row of raw ADC data into the published RawAdc waveform,
+ * normalising each sample to 16 bits and reversing the channel order, and
+ * updates the running maximum.  The raw row is copied with memcpy before
+ * anything is written as the raw data may overlap the target row: see
+ * ProcessAdcWaveform() below. */
+static inline void ExtractRawRow(
+    const ADC_ROW &RawRow, ABCD_ROW &Row, int ExcessBits, int &Maximum)
+{
+    ADC_ROW Raw;
+    memcpy(Raw, RawRow, sizeof(ADC_ROW));
+    /* Shifting the raw data left and truncating to 16 bits also takes care of
+     * sign extending the ADC data. */
+    int Normalised[4];
+    for (int j = 0; j < 4; j ++)
+    {
+        int x = (short) (Raw[3 - j] << ExcessBits);
+        Normalised[j] = x;
+        if ( x > Maximum)  Maximum = x;
+        if (-x > Maximum)  Maximum = -x;
+    }
+    Row.A = Normalised[0];
+    Row.B = Normalised[1];
+    Row.C = Normalised[2];
+    Row.D = Normalised[3];
+}
+
+
+/* Processes the raw ADC data in a single pass.  Each row of raw data is
+ * normalised and copied into RawAdc (for publishing to EPICS) and checked
+ * for the maximum ADC value, which is returned.  At the same time every four
+ * rows of RawAdc are filtered together across all four channels to produce
+ * one condensed point per channel.
+ *
+ * Working row by row like this means that the raw data is only traversed
+ * once, and in memory order, which is kind to the very small data cache on
+ * our ARM processor.  Each row is extracted before it is used by the
+ * filter, which runs four rows ahead of the start of its window, and the
+ * extraction in row order is what allows RawData to share memory with the
+ * second half of RawAdc. */
+
+static int CondenseAdcData(
+    const ADC_ROW RawData[ADC_LENGTH], int ExcessBits,
+    ABCD_ROW RawAdc[ADC_LENGTH],
+    int Condensed[4][SHORT_ADC_LENGTH])
 {
+    int Maximum = 0;
+    for (int i = 0; i < 4; i ++)
+        ExtractRawRow(RawData[i], RawAdc[i], ExcessBits, Maximum);
     for (int i = 0; i < SHORT_ADC_LENGTH; i ++)
     {
-        int SumI =
-            FILTER_TERM(i, 0, Raw) - FILTER_TERM(i, 2, Raw) +
-            FILTER_TERM(i, 4, Raw) - FILTER_TERM(i, 6, Raw);
-        int SumQ =
-            FILTER_TERM(i, 1, Raw) - FILTER_TERM(i, 3, Raw) +
-            FILTER_TERM(i, 5, Raw) - FILTER_TERM(i, 7, Raw);
-        Condensed[i] = CordicMagnitude(SumI, SumQ);
+        /* Bring the second half of the filter window up to date. */
+        for (int j = 4; j < 8; j ++)
+            ExtractRawRow(
+                RawData[4*i + j], RawAdc[4*i + j], ExcessBits, Maximum);
+
+        int SumI[4] = { 0, 0, 0, 0 };
+        int SumQ[4] = { 0, 0, 0, 0 };
+        FILTER_TAP(SumI, +=, 0);
+        FILTER_TAP(SumQ, +=, 1);
+        FILTER_TAP(SumI, -=, 2);
+        FILTER_TAP(SumQ, -=, 3);
+        FILTER_TAP(SumI, +=, 4);
+        FILTER_TAP(SumQ, +=, 5);
+        FILTER_TAP(SumI, -=, 6);
+        FILTER_TAP(SumQ, -=, 7);
+        for (int j = 0; j < 4; j ++)
+            Condensed[j][i] = CordicMagnitude(SumI[j], SumQ[j]);
     }
+    return Maximum;
 }
 
 
@@ -180,9 +205,13 @@ class FIRST_TURN : I_EVENT
 {
 public:
     FIRST_TURN(int Harmonic, float RevolutionFrequency) :
-        RawAdc(ADC_LENGTH),
+        RawAdc(ADC_LENGTH, true),
         Adc(SHORT_ADC_LENGTH),
         WaveformXYQS(SHORT_ADC_LENGTH),
+        TrainAbcd(MAX_TRAINS),
+        TrainXyqs(MAX_TRAINS),
+        TrainOffset(MAX_TRAINS),
+        TrainLength(MAX_TRAINS),
         AxisScale(SHORT_ADC_LENGTH),
         ChargeScale(PMFP(10 << 3) / (PMFP(S_0) * 117))
     {
@@ -196,6 +225,12 @@ public:
          * 34ns. */
         Offset = 5;
         Length = 31;
+        /* Bunch trains are detected at the same threshold as is used for
+         * thresholding the displayed positions. */
+        TrainThreshold = 50;
+        TrainCount = 0;
+        memset(TrainOffset.Array(), 0, sizeof(int) * MAX_TRAINS);
+        memset(TrainLength.Array(), 0, sizeof(int) * MAX_TRAINS);
 
         InitialiseRotation(Harmonic, DecimationFactor);
 
@@ -209,6 +244,7 @@ public:
          * state accordingly. */
         Persistent("FT:OFF", Offset);
         Persistent("FT:LEN", Length);
+        Persistent("FT:TRAINTHR", TrainThreshold);
         SetLength(Length);
 
         /* Computed button totals and associated button values. */
@@ -225,6 +261,14 @@ public:
         /* Maximum S value. */
         Publish_longin("FT:MAXS", MaxS);
 
+        /* Automatically detected bunch trains, each with its own position. */
+        Publish_longin("FT:TRAINS", TrainCount);
+        Publish_waveform("FT:TRAINOFF", TrainOffset);
+        Publish_waveform("FT:TRAINLEN", TrainLength);
+        TrainXyqs.Publish("FT", "TRAIN");
+        PUBLISH_METHOD_OUT(longout, "FT:TRAINTHR",
+            SetTrainThreshold, TrainThreshold);
+
         /* Finally the trigger used to notify events.  The database wires this
          * up so that the all the variables above are processed when a trigger
          * has occured.  This code is then responsible for ensuring that all
@@ -267,6 +311,7 @@ public:
          * perform the display fixup. */
         WaveformXYQS.CaptureConvert(Adc);
         ThresholdXYQS();
+        FindTrains();
 
         /* Finally tell EPICS there's stuff to read. */
         LIBERA_TIMESTAMP Timestamp;
@@ -282,33 +327,41 @@ private:
      * waveform into published waveform and button values.  We perform the
      * following stages of processing:
      *
-     *  1. Read the raw waveforms directly from hardware.
-     *  2. Sign extend and extract into separate arrays.  These can then be
-     *     written to RawAdc to be published to EPICS as desired.
-     *  3. Condense each 1024 sample raw column into a 256 sample column.
-     *     This involves filtering tricks and takes advantage of the
-     *     structure of the raw data.
-     *  4. Gain correct each column.
-     *  5. Permute the columns according to the currently selected switch and
+     *  1. Read the raw waveforms directly from hardware into the RawAdc
+     *     buffer.
+     *  2. In a single pass over the raw data, normalise and transpose it in
+     *     place into RawAdc to be published to EPICS, compute the maximum
+     *     ADC value, and condense
+     *     each 1024 sample raw column into a 256 sample column.  This
+     *     involves filtering tricks and takes advantage of the structure of
+     *     the raw data.
+     *  3. Gain correct each column.
+     *  4. Permute the columns according to the currently selected switch and
      *     write into Adc to be published to EPICS.
-     *  6. Extract the integrated ABCD values from the permuted column.
-     *  7. Finally compute XYQS. */
+     *  5. Extract the integrated ABCD values from the permuted column.
+     *  6. Finally compute XYQS. */
     int ProcessAdcWaveform()
     {
         /* Pick up the permutation corresponding to the current switch
          * position and read the raw data from the ADC.  Of course, when the
          * switches are rotating this isn't very meaningful... */
         const PERMUTATION &Permutation = SwitchPermutation();
-        ADC_DATA RawData;
-        ReadAdcWaveform(RawData);
 
-        /* Extract into arrays, sign extend, transpose and publish. */
-        EXTRACTED_ADC Extracted;
-        ExtractRawData(RawData, Extracted, RawAdc);
-        MaxAdc = Maximum(Extracted);
-
-        /* Now work through each column and condense it, gain correct, and
-         * publish it. */
+        /* To avoid copying the raw data more than necessary we read it
+         * straight into the second half of the RawAdc buffer: each 16 byte
+         * ABCD_ROW holds two 8 byte ADC_ROWs.  Extracting the raw data in row
+         * order then never overwrites raw data which has not yet been read.
+         * This is safe as EPICS is locked out by the interlock. */
+        ABCD_ROW * Rows = RawAdc.Waveform();
+        ADC_ROW * RawData = (ADC_ROW *) (void *) &Rows[ADC_LENGTH / 2];
+        int ExcessBits;
+        ReadAdcWaveform(RawData, ExcessBits);
+
+        /* Normalise, transpose, publish and condense the raw data. */
+        int Condensed[4][SHORT_ADC_LENGTH];
+        MaxAdc = CondenseAdcData(RawData, ExcessBits, Rows, Condensed);
+
+        /* Now work through each column, gain correct, and publish it. */
         int RawCharge = 0;
         for (int i = 0; i < 4; i ++)
         {
@@ -319,10 +372,8 @@ private:
              * readings appear in the correct sequence. */
             int Channel = Permutation[i];
             size_t Field = AbcdFields[i];
-            int Condensed[SHORT_ADC_LENGTH];
-            CondenseAdcData(Extracted[Channel], Condensed);
-            GainCorrect(Channel, Condensed, SHORT_ADC_LENGTH);
-            Adc.Write(Field, Condensed, SHORT_ADC_LENGTH);
+            GainCorrect(Channel, Condensed[Channel], SHORT_ADC_LENGTH);
+            Adc.Write(Field, Condensed[Channel], SHORT_ADC_LENGTH);
 
             /* Also update the appropriate field of the ABCD structure.  Note
              * that we use different algorithms for computing button
@@ -330,9 +381,10 @@ private:
              * IntegrateIntensity() is better at position calulations, but
              * much worse at computing charge (train length and profile has
              * too much effect). */
-            *use_offset(int, &ABCD, Field) = IntegrateIntensity(Condensed);
+            *use_offset(int, &ABCD, Field) =
+                IntegrateIntensity(Condensed[Channel]);
             /* Finally accumulate an integrated charge. */
-            RawCharge += IntegrateCharge(Extracted[Channel]);
+            RawCharge += IntegrateCharge(AbcdFields[Channel]);
         }
         return RawCharge;
     }
@@ -348,7 +400,7 @@ private:
      *     To be accurate we need to shift by the true frequency offset rather
      * than by 0.25: although the difference is small, it can make a large
      * difference to the calculated charge. */
-    int IntegrateCharge(const int Data[])
+    int IntegrateCharge(size_t Field)
     {
         int TotalI = 0;
         int TotalQ = 0;
@@ -361,7 +413,7 @@ private:
              * need to worry too much about that): that's 57 bits plus sign.
              * MulSS will discard 32 bits, and as we want the result to fit
              * into 31 bits plus sign we want an extra 6 bits. */
-            int point = Data[i] << 6;
+            int point = GET_FIELD(RawAdc, i, Field, int) << 6;
             TotalI += MulSS(point, RotateI[i]);
             TotalQ += MulSS(point, RotateQ[i]);
         }
@@ -447,6 +499,73 @@ private:
     }
 
 
+    /* Identifies separate bunch trains in the condensed waveform.  A train
+     * is a contiguous run of points with S at or above TrainThreshold
+     * percent of MaxS, and for each train we integrate button values over
+     * the run and compute a position.  This means that multi-bunch injection
+     * can be diagnosed without adjusting the OFF and LEN window. */
+    void FindTrains()
+    {
+        const XYQS_ROW * Xyqs = WaveformXYQS.Waveform();
+        const ABCD_ROW * Buttons = Adc.Waveform();
+        ABCD_ROW * Trains = TrainAbcd.Waveform();
+        int * Offsets = TrainOffset.Array();
+        int * Lengths = TrainLength.Array();
+        int Threshold = (int) ((int64_t) MaxS * TrainThreshold / 100);
+
+        int Count = 0;
+        int i = 0;
+        while (MaxS > 0  &&  i < SHORT_ADC_LENGTH  &&  Count < MAX_TRAINS)
+        {
+            if (Xyqs[i].S < Threshold)
+                i += 1;
+            else
+            {
+                /* Integrate this train, scaled as in IntegrateIntensity(). */
+                ABCD_ROW &Train = Trains[Count];
+                memset(&Train, 0, sizeof(Train));
+                Offsets[Count] = i;
+                for (; i < SHORT_ADC_LENGTH  &&  Xyqs[i].S >= Threshold;
+                     i ++)
+                {
+                    Train.A += Buttons[i].A >> 7;
+                    Train.B += Buttons[i].B >> 7;
+                    Train.C += Buttons[i].C >> 7;
+                    Train.D += Buttons[i].D >> 7;
+                }
+                Lengths[Count] = i - Offsets[Count];
+                Count += 1;
+            }
+        }
+
+        /* Clear out the unused entries so that stale trains are not
+         * displayed. */
+        for (int j = Count; j < MAX_TRAINS; j ++)
+        {
+            Offsets[j] = 0;
+            Lengths[j] = 0;
+        }
+        TrainCount = Count;
+        TrainAbcd.SetLength(Count, true);
+        TrainXyqs.CaptureConvert(TrainAbcd);
+    }
+
+
+    bool SetTrainThreshold(int Threshold)
+    {
+        if (0 < Threshold  &&  Threshold <= 100)
+        {
+            TrainThreshold = Threshold;
+            return true;
+        }
+        else
+        {
+            printf("Train threshold %d out of range\n", Threshold);
+            return false;
+        }
+    }
+
+
     /* Access methods for offset and length. */
     bool SetOffset(int newOffset)
     {
@@ -491,6 +610,17 @@ private:
     ABCD_ROW ABCD;
     XYQS_ROW XYQS;
 
+    /* Automatically detected bunch trains: button values and positions
+     * for each train, together with the position and length of each train
+     * in the condensed waveform. */
+    ABCD_WAVEFORMS TrainAbcd;
+    XYQS_WAVEFORMS TrainXyqs;
+    INT_WAVEFORM TrainOffset;
+    INT_WAVEFORM TrainLength;
+    int TrainCount;
+    /* Percentage of MaxS used as threshold for train detection. */
+    int TrainThreshold;
+
     /* Waveform for labelling axis. */
     FLOAT_WAVEFORM AxisScale;
 
@@ -49,6 +49,7 @@
 #include "numeric.h"
 #include "cordic.h"
 #include "statistics.h"
+#include "decimate.h"
 
 #include "freeRun.h"
 
@@ -59,6 +60,7 @@ class FREE_RUN : I_EVENT, LOCKED
 public:
     FREE_RUN(int WaveformLength) :
         WaveformLength(WaveformLength),
+        CaptureIq(WaveformLength),
         WaveformIq(WaveformLength),
         InputAbcd(WaveformLength),
         WaveformAbcd(WaveformLength, true),
@@ -68,6 +70,7 @@ public:
     {
         CaptureOffset = 0;
         AverageBits = 0;
+        Decimation = 1;
         CapturedSamples = 0;
         StopWhenDone = false;
         UpdateAll = false;
@@ -78,6 +81,7 @@ public:
         WaveformAbcd.Publish("FR");
         WaveformXyqs.Publish("FR");
         Publish_longout("FR:DELAY", CaptureOffset);
+        PUBLISH_METHOD_OUT(longout, "FR:DECIMATE", SetDecimation, Decimation);
 
         /* Averaging control. */
         Publish_longin("FR:SAMPLES", PublishCapturedSamples);
@@ -122,13 +126,23 @@ private:
         if (!GotEpicsLock)
             Interlock.Wait();
 
-        WaveformIq.Capture(1, CaptureOffset);
-        if (AccumulateWaveform())
+        /* Hold our lock over the whole capture, accumulate and convert
+         * sequence so that a change to decimation or averaging can't land
+         * part way through and mix incompatible samples. */
+        bool PublishUpdate;
+        THREAD_LOCK(this);
+        CaptureWaveform();
+        PublishUpdate = AccumulateWaveform();
+        if (PublishUpdate)
         {
             WaveformXyqs.CaptureConvert(WaveformAbcd);
             /* Update our statistics on the X and Y waveforms. */
             StatsXY.Update();
+        }
+        THREAD_UNLOCK();
 
+        if (PublishUpdate)
+        {
             /* Let EPICS know there's stuff to read, releases interlock. */
             Interlock.Ready(WaveformIq.GetTimestamp());
             GotEpicsLock = false;
@@ -140,9 +154,43 @@ private:
     }
 
 
+    /* Captures the IQ waveform, decimating it if requested.  The decimated
+     * waveform is shorter than the capture by the decimation factor.  Called
+     * with the lock held. */
+    void CaptureWaveform()
+    {
+        if (Decimation > 1)
+        {
+            CaptureIq.Capture(1, CaptureOffset);
+            WaveformIq.CaptureDecimated(CaptureIq, 0, Decimation);
+        }
+        else
+            WaveformIq.Capture(1, CaptureOffset);
+    }
+
+
     /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
     /* Waveform averaging.                                                   */
 
+    bool SetDecimation(int Factor)
+    {
+        if (Factor < 1  ||  Factor > MAX_SOFT_DECIMATION  ||
+            Factor > WaveformLength)
+        {
+            printf("FR:DECIMATE %d is out of range\n", Factor);
+            return false;
+        }
+
+        THREAD_LOCK(this);
+        Decimation = Factor;
+        /* The accumulated and converted waveforms now hold fewer points. */
+        WaveformAbcd.SetLength(WaveformLength / Decimation, true);
+        WaveformXyqs.SetLength(WaveformLength / Decimation);
+        ResetAccumulator();
+        THREAD_UNLOCK();
+        return true;
+    }
+
     bool SetAverageBits(int _AverageBits)
     {
         THREAD_LOCK(this);
@@ -171,7 +219,8 @@ private:
         CapturedSamples += 1;
         ABCD_ROW * Input = InputAbcd.Waveform();
         ABCD_ROW * Accum = WaveformAbcd.Waveform();
-        for (int i = 0; i < WaveformLength; i ++)
+        int Length = InputAbcd.WorkingLength();
+        for (int i = 0; i < Length; i ++)
         {
             Accum[i].A += Input[i].A >> AverageBits;
             Accum[i].B += Input[i].B >> AverageBits;
@@ -191,11 +240,11 @@ private:
     }
 
     /* Performs central work of accumulating a single ABCD waveform, returns
-     * true iff an update to EPICS should be triggered. */
+     * true iff an update to EPICS should be triggered.  Called with the lock
+     * held. */
     bool AccumulateWaveform()
     {
         bool PublishUpdate;
-        THREAD_LOCK(this);
 
         if (AverageBits > 0)
         {
@@ -216,14 +265,14 @@ private:
             CapturedSamples = 1;
             PublishUpdate = true;
         }
-
-        THREAD_UNLOCK();
         return PublishUpdate;
     }
 
 
     const int WaveformLength;
 
+    /* Raw waveform as captured when software decimation is enabled. */
+    IQ_WAVEFORMS CaptureIq;
     /* Captured and processed waveforms: these three blocks of waveforms are
      * all published to EPICS. */
     IQ_WAVEFORMS WaveformIq;
@@ -232,6 +281,8 @@ private:
 
     /* Offset from trigger of capture. */
     int CaptureOffset;
+    /* Software decimation factor applied to captured waveform. */
+    int Decimation;
 
     /* Averaging control. */
     int AverageBits;            // Log2 number of samples to average
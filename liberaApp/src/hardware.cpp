@@ -35,17 +35,20 @@
 #include <signal.h>
 #include <string.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <linux/unistd.h>
 #include <sys/mman.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "versions.h"
 
 /* If RAW_REGISTER is defined then raw register access through /dev/mem will
  * be enabled. */
 #include "hardware.h"
+#include "replay.h"
 
 
 /* Feature registers used to identify special functionality. */
@@ -151,32 +154,115 @@ void print_error(const char * Message, const char * FileName, int LineNumber)
 /*****************************************************************************/
 
 
-/* This mutex is used to ensure serial access to hardware.  See also similar
- * code in interlock.cpp.
+/* Access to the hardware is serialised by a separate mutex for each device or
+ * register area, so that a long transfer on one device (such as a turn by
+ * turn read) does not hold up unrelated accesses to another.  No more than
+ * one of these locks is ever held at a time.  See also similar code in
+ * interlock.cpp.
  *    Note that pthread_cleanup_{push,pop} need to be used here because we're
  * also using pthread_cancel, and if we're not meticulous about cleaning up
- * then orderly shutdown gets disrupted. */
-static pthread_mutex_t hardware_mutex = PTHREAD_MUTEX_INITIALIZER;
-static void Lock()         { TEST_0(pthread_mutex_lock(&hardware_mutex)); }
-static void Unlock(void *) { TEST_0(pthread_mutex_unlock(&hardware_mutex)); }
-#define LOCK()      Lock(); pthread_cleanup_push(Unlock, NULL)
+ * then orderly shutdown gets disrupted.
+ *    For each lock we record the longest time it was held and the longest
+ * time spent waiting for it, both in microseconds, since the statistics were
+ * last read. */
+struct HARDWARE_LOCK
+{
+    pthread_mutex_t Mutex;
+    struct timespec Acquired;
+    int MaxHold;
+    int MaxWait;
+};
+
+#define HARDWARE_LOCK_INIT  { PTHREAD_MUTEX_INITIALIZER, { 0, 0 }, 0, 0 }
+static HARDWARE_LOCK HardwareLocks[HARDWARE_LOCK_COUNT] = {
+    HARDWARE_LOCK_INIT, HARDWARE_LOCK_INIT, HARDWARE_LOCK_INIT,
+    HARDWARE_LOCK_INIT, HARDWARE_LOCK_INIT, HARDWARE_LOCK_INIT,
+};
+static const char * HardwareLockNames[HARDWARE_LOCK_COUNT] = {
+    "CFG", "DSC", "ADC", "DD", "PM", "REG",
+};
+
+/* Guards the statistics fields of all the locks above. */
+static pthread_mutex_t lock_statistics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int ElapsedMicroseconds(
+    const struct timespec &Start, const struct timespec &End)
+{
+    return
+        1000000 * (End.tv_sec - Start.tv_sec) +
+        (End.tv_nsec - Start.tv_nsec) / 1000;
+}
+
+static void UpdateMaximum(int &Maximum, int Value)
+{
+    TEST_0(pthread_mutex_lock(&lock_statistics_mutex));
+    if (Value > Maximum)
+        Maximum = Value;
+    TEST_0(pthread_mutex_unlock(&lock_statistics_mutex));
+}
+
+static void Lock(HARDWARE_LOCK_ID Id)
+{
+    HARDWARE_LOCK &Entry = HardwareLocks[Id];
+    struct timespec Start;
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+    TEST_0(pthread_mutex_lock(&Entry.Mutex));
+    clock_gettime(CLOCK_MONOTONIC, &Entry.Acquired);
+    UpdateMaximum(Entry.MaxWait, ElapsedMicroseconds(Start, Entry.Acquired));
+}
+
+static void Unlock(void *Context)
+{
+    HARDWARE_LOCK &Entry = *(HARDWARE_LOCK *) Context;
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    int Hold = ElapsedMicroseconds(Entry.Acquired, Now);
+    TEST_0(pthread_mutex_unlock(&Entry.Mutex));
+    UpdateMaximum(Entry.MaxHold, Hold);
+}
+
+#define LOCK(id) \
+    Lock(id); pthread_cleanup_push(Unlock, &HardwareLocks[id])
 #define UNLOCK()    pthread_cleanup_pop(true)
 /*
-#define LOCK()      \
-    Lock(); pthread_cleanup_push(Unlock, NULL); printf("Locked %d\n",__LINE__)
+#define LOCK(id)    \
+    Lock(id); pthread_cleanup_push(Unlock, &HardwareLocks[id]); \
+    printf("Locked %s %d\n", HardwareLockNames[id], __LINE__)
 #define UNLOCK()    \
     pthread_cleanup_pop(true); printf("Unlocked %d\n",__LINE__)
  */
-#define LOCKED(result) \
+#define LOCKED(id, result) \
     ( { \
         __typeof__(result) __result__; \
-        LOCK(); \
+        LOCK(id); \
         __result__ = (result); \
         UNLOCK(); \
         __result__; \
     } )
 
 
+const char * HardwareLockName(HARDWARE_LOCK_ID Id)
+{
+    return HardwareLockNames[Id];
+}
+
+
+void ReadHardwareLockStatistics(
+    int MaxHold[HARDWARE_LOCK_COUNT], int MaxWait[HARDWARE_LOCK_COUNT])
+{
+    TEST_0(pthread_mutex_lock(&lock_statistics_mutex));
+    for (int i = 0; i < HARDWARE_LOCK_COUNT; i ++)
+    {
+        HARDWARE_LOCK &Entry = HardwareLocks[i];
+        MaxHold[i] = Entry.MaxHold;
+        MaxWait[i] = Entry.MaxWait;
+        Entry.MaxHold = 0;
+        Entry.MaxWait = 0;
+    }
+    TEST_0(pthread_mutex_unlock(&lock_statistics_mutex));
+}
+
+
 
 /* Device handles. */
 static int DevCfg = -1;     /* /dev/libera.cfg  General configuration. */
@@ -185,6 +271,8 @@ static int DevDsc = -1;     /* /dev/libera.dsc  Signal conditioning i/f. */
 static int DevEvent = -1;   /* /dev/libera.event    Event signalling. */
 static int DevPm = -1;      /* /dev/libera.pm   Postmortem data. */
 static int DevSa = -1;      /* /dev/libera.sa   Slow acquisition. */
+/* Pipe used to interrupt WaitSlowAcquisition(). */
+static int SaWakePipe[2] = { -1, -1 };
 static int DevDd = -1;      /* /dev/libera.dd   Turn by turn data. */
 #ifdef RAW_REGISTER
 static int DevMem = -1;     /* /dev/mem         Direct register access. */
@@ -197,8 +285,7 @@ static int DevMem = -1;     /* /dev/mem         Direct register access. */
  * be corrected. */
 static int AdcExcessBits = 4;
 
-/* Max ADC register read at SA rate.  We preallocate this to avoid
- * continually mapping the register! */
+/* Max ADC register read at SA rate. */
 static unsigned int * RegisterMaxAdcRaw = NULL;
 
 /* Number of turns per switch. */
@@ -216,49 +303,69 @@ static int TurnsPerSwitch;
 
 #ifdef RAW_REGISTER
 
-/* Paging information. */
-static uint32_t OsPageSize;         // 0x1000
-static uint32_t OsPageMask;         // 0x0FFF
-
-
-static uint32_t * MapRawRegister(uint32_t Address)
+/* All the FPGA registers we access directly live in a handful of 4K blocks.
+ * Each block is mapped once during initialisation and then stays mapped, so
+ * that individual register accesses (and in particular filter coefficient
+ * uploads) no longer need a pair of system calls each. */
+#define REGISTER_BLOCK_SIZE     0x1000
+static const uint32_t RegisterBlocks[] = {
+    0x14000000,     // Build number and feature identification
+    0x14004000,     // Trigger delay and PM source
+    0x14008000,     // i-Tech max ADC
+    0x1400C000,     // DLS max ADC, ADC overflow and PM ADC limits
+    FA_OFFSET,      // FA filters, triggered sum and spike removal
+    0x14024000,     // Interlock status and window, PM position limits
+};
+static char * RegisterWindows[ARRAY_SIZE(RegisterBlocks)];
+
+
+static bool MapRegisterWindows()
 {
-    char * MemMap = (char *) mmap(
-        0, OsPageSize, PROT_READ | PROT_WRITE, MAP_SHARED,
-        DevMem, Address & ~OsPageMask);
-    if (MemMap == MAP_FAILED)
+    for (unsigned int i = 0; i < ARRAY_SIZE(RegisterBlocks); i ++)
     {
-        perror("Unable to map register into memory");
-        return NULL;
+        void * Window = mmap(
+            0, REGISTER_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+            DevMem, RegisterBlocks[i]);
+        if (Window == MAP_FAILED)
+        {
+            perror("Unable to map register block into memory");
+            return false;
+        }
+        RegisterWindows[i] = (char *) Window;
     }
-    else
-        return (uint32_t *)(void*)(MemMap + (Address & OsPageMask));
+    return true;
 }
 
-static void UnmapRawRegister(uint32_t *MappedAddress)
+
+/* Returns a pointer to the given register, which must lie in one of the
+ * blocks mapped above. */
+static uint32_t * RawRegister(uint32_t Address)
 {
-    void * BaseAddress = (void *) (
-        ((uint32_t) MappedAddress) & ~OsPageMask);
-    munmap(BaseAddress, OsPageSize);
+    for (unsigned int i = 0; i < ARRAY_SIZE(RegisterBlocks); i ++)
+    {
+        uint32_t Offset = Address - RegisterBlocks[i];
+        if (Offset < REGISTER_BLOCK_SIZE  &&  RegisterWindows[i] != NULL)
+            return (uint32_t *) (void *) (RegisterWindows[i] + Offset);
+    }
+    printf("Register %08x not in any mapped block\n", Address);
+    return NULL;
 }
 
 #else
-static uint32_t * MapRawRegister(uint32_t Address)
+static uint32_t * RawRegister(uint32_t Address)
 {
     errno = 0;
     print_error("Cannot map registers into memory", __FILE__, __LINE__);
     return NULL;
 }
 
-static void UnmapRawRegister(uint32_t *MappedAddress) { }
-
 #endif
 
 
 static bool WriteRawRegister(
     uint32_t Address, uint32_t Value, uint32_t Mask = 0xFFFFFFFF)
 {
-    uint32_t * Register = MapRawRegister(Address);
+    uint32_t * Register = RawRegister(Address);
     if (Register == NULL)
         return false;
     else
@@ -266,7 +373,6 @@ static bool WriteRawRegister(
         if (Mask != 0xFFFFFFFF)
             Value = (Value & Mask) | (*Register & ~Mask);
         *Register = Value;
-        UnmapRawRegister(Register);
         return true;
     }
 }
@@ -274,13 +380,12 @@ static bool WriteRawRegister(
 
 static bool ReadRawRegister(uint32_t Address, uint32_t &Value)
 {
-    uint32_t * Register = MapRawRegister(Address);
+    uint32_t * Register = RawRegister(Address);
     if (Register == NULL)
         return false;
     else
     {
         Value = *Register;
-        UnmapRawRegister(Register);
         return true;
     }
 }
@@ -316,6 +421,59 @@ static bool WriteCfgValue(int Index, int Value)
 }
 
 
+/* The interlock and calibration settings are rewritten far more often than
+ * they change: the interlock state is refreshed on every SA update.  We keep
+ * a shadow of every value written to the driver or to a shadowed register
+ * and only pass on values which have actually changed.  A shadow is only
+ * marked valid after a successful write, so a failed write will be retried
+ * next time.  These must be called under the appropriate lock. */
+
+#define CFG_SHADOW_SIZE     256     // All LIBERA_CFG_... indices fit
+static int CfgShadow[CFG_SHADOW_SIZE];
+static bool CfgShadowValid[CFG_SHADOW_SIZE];
+
+/* Writes the given value if it differs from the last value written or if
+ * Force is set, in which case Changed is set. */
+static bool WriteCfgShadow(
+    int Index, int Value, bool &Changed, bool Force = false)
+{
+    if (!Force  &&  CfgShadowValid[Index]  &&  CfgShadow[Index] == Value)
+        return true;
+    else
+    {
+        Changed = true;
+        CfgShadow[Index] = Value;
+        CfgShadowValid[Index] = WriteCfgValue(Index, Value);
+        return CfgShadowValid[Index];
+    }
+}
+
+
+#ifdef RAW_REGISTER
+struct REGISTER_SHADOW
+{
+    bool Valid;
+    uint32_t Value;
+};
+
+static bool WriteRegisterShadow(
+    REGISTER_SHADOW &Shadow, uint32_t Address, uint32_t Value)
+{
+    if (Shadow.Valid  &&  Shadow.Value == Value)
+        return true;
+    else
+    {
+        Shadow.Value = Value;
+        Shadow.Valid = WriteRawRegister(Address, Value);
+        return Shadow.Valid;
+    }
+}
+
+static REGISTER_SHADOW AdcOverflowShadow;
+static REGISTER_SHADOW SecondaryInterlockShadow[4];
+#endif
+
+
 bool WriteInterlockParameters(
     LIBERA_ILKMODE mode,
     int Xlow, int Xhigh, int Ylow, int Yhigh,
@@ -326,26 +484,32 @@ bool WriteInterlockParameters(
      * by the DSC.  Doing this here allows the rest of the system to believe
      * everything is 16 bits. */
     overflow_limit >>= AdcExcessBits;
-    return LOCKED(
-        WriteCfgValue(LIBERA_CFG_ILK_MODE,           mode)  &&
-        WriteCfgValue(LIBERA_CFG_ILK_XLOW,           Xlow)  &&
-        WriteCfgValue(LIBERA_CFG_ILK_XHIGH,          Xhigh)  &&
-        WriteCfgValue(LIBERA_CFG_ILK_YLOW,           Ylow)  &&
-        WriteCfgValue(LIBERA_CFG_ILK_YHIGH,          Yhigh)  &&
-        WriteCfgValue(LIBERA_CFG_ILK_OVERFLOW_LIMIT, overflow_limit)  &&
-        WriteCfgValue(LIBERA_CFG_ILK_OVERFLOW_DUR,   overflow_dur)  &&
+    bool Changed = false;
+    bool Ok = LOCKED(LOCK_CFG,
+        WriteCfgShadow(LIBERA_CFG_ILK_MODE,           mode, Changed)  &&
+        WriteCfgShadow(LIBERA_CFG_ILK_XLOW,           Xlow, Changed)  &&
+        WriteCfgShadow(LIBERA_CFG_ILK_XHIGH,          Xhigh, Changed)  &&
+        WriteCfgShadow(LIBERA_CFG_ILK_YLOW,           Ylow, Changed)  &&
+        WriteCfgShadow(LIBERA_CFG_ILK_YHIGH,          Yhigh, Changed)  &&
+        WriteCfgShadow(
+            LIBERA_CFG_ILK_OVERFLOW_LIMIT, overflow_limit, Changed)  &&
+        WriteCfgShadow(LIBERA_CFG_ILK_OVERFLOW_DUR,   overflow_dur, Changed)  &&
         /* It is important that this configuration value is written last, as
          * it turns out that nothing is written to hardware until this value
          * is written.  Eww: it would be better to have an explicit call if
-         * that the way things should be. */
-        WriteCfgValue(LIBERA_CFG_ILK_GAIN_LIMIT,     gain_limit)  &&
+         * that the way things should be.  So if anything else has changed
+         * this is written even if its own value hasn't. */
+        WriteCfgShadow(
+            LIBERA_CFG_ILK_GAIN_LIMIT, gain_limit, Changed, Changed));
 #ifdef RAW_REGISTER
-        /* Finally, if the DLS ADC overflow register is in use, write to that
-         * as well: in this case the overflow_limit above is ignored. */
-        IF_(DlsFpgaFeatures,
-            WriteRawRegister(REGISTER_ADC_OVERFLOW, overflow_limit))  &&
+    /* Finally, if the DLS ADC overflow register is in use, write to that as
+     * well: in this case the overflow_limit above is ignored. */
+    Ok = Ok  &&  IF_(DlsFpgaFeatures,
+        LOCKED(LOCK_REG,
+            WriteRegisterShadow(AdcOverflowShadow,
+                REGISTER_ADC_OVERFLOW, overflow_limit)));
 #endif
-        true);
+    return Ok;
 }
 
 
@@ -354,11 +518,15 @@ bool WriteSecondaryInterlockParameters(
 {
 #ifdef RAW_REGISTER
     if (SecondaryInterlock)
-        return LOCKED(
-            WriteRawRegister(REGISTER_ILK_XLOW2,  Xlow2)  &&
-            WriteRawRegister(REGISTER_ILK_XHIGH2, Xhigh2)  &&
-            WriteRawRegister(REGISTER_ILK_YLOW2,  Ylow2)  &&
-            WriteRawRegister(REGISTER_ILK_YHIGH2, Yhigh2));
+        return LOCKED(LOCK_REG,
+            WriteRegisterShadow(SecondaryInterlockShadow[0],
+                REGISTER_ILK_XLOW2,  Xlow2)  &&
+            WriteRegisterShadow(SecondaryInterlockShadow[1],
+                REGISTER_ILK_XHIGH2, Xhigh2)  &&
+            WriteRegisterShadow(SecondaryInterlockShadow[2],
+                REGISTER_ILK_YLOW2,  Ylow2)  &&
+            WriteRegisterShadow(SecondaryInterlockShadow[3],
+                REGISTER_ILK_YHIGH2, Yhigh2));
     else
 #endif
         return false;
@@ -384,11 +552,12 @@ bool ReadInterlockStatus(uint32_t &status)
 
 bool WriteCalibrationSettings(int Kx, int Ky, int Xoffset, int Yoffset)
 {
-    return LOCKED(
-        WriteCfgValue(LIBERA_CFG_KX, Kx)  &&
-        WriteCfgValue(LIBERA_CFG_KY, Ky)  &&
-        WriteCfgValue(LIBERA_CFG_XOFFSET, Xoffset)  &&
-        WriteCfgValue(LIBERA_CFG_YOFFSET, Yoffset));
+    bool Changed = false;
+    return LOCKED(LOCK_CFG,
+        WriteCfgShadow(LIBERA_CFG_KX, Kx, Changed)  &&
+        WriteCfgShadow(LIBERA_CFG_KY, Ky, Changed)  &&
+        WriteCfgShadow(LIBERA_CFG_XOFFSET, Xoffset, Changed)  &&
+        WriteCfgShadow(LIBERA_CFG_YOFFSET, Yoffset, Changed));
 }
 
 
@@ -427,7 +596,7 @@ bool GetClockState(bool &LmtdLocked, bool &LstdLocked)
 bool WriteExternalTriggerDelay(int Delay)
 {
     if (0 <= Delay  &&  Delay < 1<<12)
-        return LOCKED(WriteRawRegister(
+        return LOCKED(LOCK_REG, WriteRawRegister(
             REGISTER_TRIG_DELAY, Delay << 16, 0x0FFF0000));
     else
         return false;
@@ -438,7 +607,7 @@ bool WriteExternalTriggerDelay(int Delay)
 bool WriteInterlockXYIIR_K(int K)
 {
 #ifdef RAW_REGISTER
-    return WriteRawRegister(REGISTER_ILK_K_FILT_XY, K);
+    return LOCKED(LOCK_REG, WriteRawRegister(REGISTER_ILK_K_FILT_XY, K));
 #else
     return false;
 #endif
@@ -459,17 +628,70 @@ bool WriteInterlockXYIIR_K(int K)
 #define LIBERA_SEEK_TR  SEEK_END    // Trigger point (offset is ignored)
 
 
+/* Waveforms are captured together with the request that read them, and are
+ * only replayed to an identical request: otherwise one mode could silently
+ * be handed data captured for another. */
+
+static void CaptureWaveform(
+    STREAM_BLOCK Block, int Decimation, int Offset, size_t WaveformLength,
+    const LIBERA_ROW * Data, int Read, const LIBERA_TIMESTAMP & Timestamp)
+{
+    STREAM_WAVEFORM_PREFIX Prefix;
+    memset(&Prefix, 0, sizeof(Prefix));
+    Prefix.Request.Decimation = Decimation;
+    Prefix.Request.Offset = Offset;
+    Prefix.Request.Length = WaveformLength;
+    Prefix.Timestamp = Timestamp;
+    CaptureBlock(Block, &Prefix, sizeof(Prefix), Data, Read);
+}
+
+static size_t ReplayWaveform(
+    STREAM_BLOCK Block, int Decimation, int Offset, size_t WaveformLength,
+    LIBERA_ROW * Data, LIBERA_TIMESTAMP & Timestamp)
+{
+    STREAM_WAVEFORM_PREFIX Prefix;
+    int Read = ReplayBlock(Block, &Prefix, sizeof(Prefix),
+        Data, sizeof(LIBERA_ROW) * WaveformLength);
+    if (Read <= 0)
+        return 0;
+    else if (Prefix.Request.Decimation != Decimation  ||
+        Prefix.Request.Offset != Offset  ||
+        Prefix.Request.Length != WaveformLength)
+    {
+        printf("Replay request (decimation %d, offset %d, length %u) "
+            "doesn't match capture (%d, %d, %u): rejected\n",
+            Decimation, Offset, (unsigned int) WaveformLength,
+            Prefix.Request.Decimation, Prefix.Request.Offset,
+            Prefix.Request.Length);
+        return 0;
+    }
+    else
+    {
+        Timestamp = Prefix.Timestamp;
+        return Read / sizeof(LIBERA_ROW);
+    }
+}
+
+
 size_t ReadWaveform(
     int Decimation, size_t WaveformLength, LIBERA_ROW * Data,
     LIBERA_TIMESTAMP & Timestamp, int Offset)
 {
+    if (ReplayingStream)
+        return ReplayWaveform(STREAM_WAVEFORM,
+            Decimation, Offset, WaveformLength, Data, Timestamp);
+
     const int ReadSize = sizeof(LIBERA_ROW) * WaveformLength;
     int Read = 0;
-    bool Ok = LOCKED(
+
+    bool Ok = LOCKED(LOCK_DD,
         TEST_IO(ioctl(DevDd, LIBERA_IOC_SET_DEC, &Decimation))  &&
         TEST_IO(lseek(DevDd, Offset, LIBERA_SEEK_TR))  &&
         TEST_IO(Read = read(DevDd, Data, ReadSize)) &&
         TEST_IO(ioctl(DevDd, LIBERA_IOC_GET_DD_TSTAMP, &Timestamp)));
+    if (Ok  &&  CapturingStream)
+        CaptureWaveform(STREAM_WAVEFORM,
+            Decimation, Offset, WaveformLength, Data, Read, Timestamp);
 
     return Ok ? Read / sizeof(LIBERA_ROW) : 0;
 }
@@ -478,45 +700,59 @@ size_t ReadWaveform(
 size_t ReadPostmortem(
     size_t WaveformLength, LIBERA_ROW * Data, LIBERA_TIMESTAMP & Timestamp)
 {
+    if (ReplayingStream)
+        return ReplayWaveform(STREAM_POSTMORTEM,
+            1, 0, WaveformLength, Data, Timestamp);
+
     const int ReadSize = sizeof(LIBERA_ROW) * WaveformLength;
     int Read = 0;
-    bool Ok = LOCKED(
+
+    bool Ok = LOCKED(LOCK_PM,
         /* Very odd design in the driver: the postmortem waveform isn't
          * actually read until we do this ioctl!  This really isn't terribly
          * sensible, but never mind, that's how it works at the moment... */
         TEST_IO(ioctl(DevEvent, LIBERA_EVENT_ACQ_PM))  &&
         TEST_IO(Read = read(DevPm, Data, ReadSize))  &&
         TEST_IO(ioctl(DevPm, LIBERA_IOC_GET_PM_TSTAMP, &Timestamp)));
+    if (Ok  &&  CapturingStream)
+        CaptureWaveform(STREAM_POSTMORTEM,
+            1, 0, WaveformLength, Data, Read, Timestamp);
 
     return Ok  &&  Read != -1  ?  Read / sizeof(LIBERA_ROW)  :  0;
 }
 
 
-bool ReadAdcWaveform(ADC_DATA &Data)
+bool ReadAdcWaveform(ADC_ROW Data[ADC_LENGTH], int &ExcessBits)
 {
     size_t Read = 0;
-    bool Ok = LOCKED(
+    ExcessBits = AdcExcessBits;
+    if (ReplayingStream)
+        return ReplayBlock(STREAM_ADC, NULL, 0, Data, sizeof(ADC_DATA)) ==
+            sizeof(ADC_DATA);
+
+    bool Ok = LOCKED(LOCK_ADC,
         TEST_IO(Read = read(DevAdc, Data, sizeof(ADC_DATA)))  &&
         TEST_OK(Read == sizeof(ADC_DATA)));
-    if (Ok  &&  AdcExcessBits > 0)
-    {
-        /* Normalise all of the ADC data to 16 bits. */
-        for (int i = 0; i < ADC_LENGTH; i ++)
-        {
-            for (int j = 0; j < 4; j ++)
-                Data[i][j] <<= AdcExcessBits;
-        }
-    }
+    if (Ok  &&  CapturingStream)
+        CaptureBlock(STREAM_ADC, NULL, 0, Data, sizeof(ADC_DATA));
     return Ok;
 }
 
 
 bool ReadSlowAcquisition(ABCD_ROW &ButtonData, XYQS_ROW &PositionData)
 {
+    if (ReplayingStream)
+        return ReplayBlock(STREAM_SA,
+            &ButtonData, sizeof(ABCD_ROW),
+            &PositionData, sizeof(XYQS_ROW)) == sizeof(XYQS_ROW);
+
     libera_atom_sa_t Result;
-    int Read = 0;
+    int Read = read(DevSa, &Result, sizeof(libera_atom_sa_t));
+    if (Read == -1  &&  errno == EAGAIN)
+        /* Nothing to read yet: not an error, as DevSa is non blocking. */
+        return false;
     bool Ok =
-        TEST_IO(Read = read(DevSa, &Result, sizeof(libera_atom_sa_t)))  &&
+        TEST_IO(Read)  &&
         TEST_OK(Read == sizeof(libera_atom_sa_t));
     if (Ok)
     {
@@ -528,11 +764,53 @@ bool ReadSlowAcquisition(ABCD_ROW &ButtonData, XYQS_ROW &PositionData)
         PositionData.Y = Result.Y;
         PositionData.Q = Result.Q;
         PositionData.S = Result.Sum;
+        if (CapturingStream)
+            CaptureBlock(STREAM_SA,
+                &ButtonData, sizeof(ABCD_ROW),
+                &PositionData, sizeof(XYQS_ROW));
     }
     return Ok;
 }
 
 
+bool WaitSlowAcquisition(int Timeout)
+{
+    /* When replaying the replayed stream is paced by ReplayBlock() itself. */
+    if (ReplayingStream)
+        return true;
+
+    struct pollfd Poll[2];
+    Poll[0].fd = DevSa;
+    Poll[0].events = POLLIN;
+    Poll[1].fd = SaWakePipe[0];
+    Poll[1].events = POLLIN;
+    int Ready = poll(Poll, 2, Timeout);
+    if (Ready == -1  &&  errno == EINTR)
+        return false;
+    else if (!TEST_IO(Ready))
+    {
+        /* Don't spin if poll() itself is failing. */
+        usleep(Timeout * 1000);
+        return false;
+    }
+    else
+        return (Poll[0].revents & POLLIN) != 0;
+}
+
+
+void InterruptSlowAcquisition()
+{
+    if (ReplayingStream)
+        /* A replayed SA stream may be waiting at the end of its replay. */
+        StopReplay();
+    else
+    {
+        char Wake = 0;
+        TEST_IO(write(SaWakePipe[1], &Wake, 1));
+    }
+}
+
+
 int ReadMaxAdc()
 {
     if (RegisterMaxAdcRaw == NULL)
@@ -553,7 +831,16 @@ bool SetEventMask(int EventMask)
 
 int ReadEvents(libera_event_t Events[], int MaxEventCount)
 {
-    int Read = read(DevEvent, Events, sizeof(libera_event_t) * MaxEventCount);
+    const size_t ReadSize = sizeof(libera_event_t) * MaxEventCount;
+    if (ReplayingStream)
+    {
+        int Read = ReplayBlock(STREAM_EVENTS, NULL, 0, Events, ReadSize);
+        return Read > 0 ? Read / sizeof(libera_event_t) : 0;
+    }
+
+    int Read = read(DevEvent, Events, ReadSize);
+    if (Read > 0  &&  CapturingStream)
+        CaptureBlock(STREAM_EVENTS, NULL, 0, Events, Read);
     return TEST_IO(Read) ? Read / sizeof(libera_event_t) : 0;
 }
 
@@ -794,7 +1081,7 @@ bool WriteAttenuation(int NewAttenuation)
 {
     if (0 <= NewAttenuation  &&  NewAttenuation <= MaximumAttenuation())
     {
-        LOCK();
+        LOCK(LOCK_DSC);
         Attenuation = NewAttenuation;
         MARK_DIRTY(Attenuation);
         UNLOCK();
@@ -820,7 +1107,7 @@ bool WriteSwitchSequence(
         printf("Switch pattern length %u must be power of 2\n", NewLength);
     else
     {
-        LOCK();
+        LOCK(LOCK_DSC);
         /* Copy over the new switch pattern, repeating as necessary to fill
          * up to the standard length.  Only the bottom four bits of each
          * switch are used. */
@@ -850,7 +1137,7 @@ bool WriteSwitchSequence(
 
 void WritePhaseArray(int Switch, const PHASE_ARRAY Array)
 {
-    LOCK();
+    LOCK(LOCK_DSC);
     for (int i = 0; i < BUTTON_COUNT; i ++)
     {
         int Base = ((Switch & 0xF) << 1) | (i << 5);
@@ -877,7 +1164,7 @@ void WritePhaseArray(int Switch, const PHASE_ARRAY Array)
 
 void WriteDemuxArray(int Switch, const DEMUX_ARRAY Array)
 {
-    LOCK();
+    LOCK(LOCK_DSC);
     for (int j = 0; j < BUTTON_COUNT; j ++)
     {
         int Base = ((Switch & 0xF) << 1) | (j << 6);
@@ -895,7 +1182,7 @@ void WriteDemuxArray(int Switch, const DEMUX_ARRAY Array)
 bool CommitDscState()
 {
     int Buffer;
-    return LOCKED(
+    return LOCKED(LOCK_DSC,
         /* Pick up which double buffer is currently active. */
         ReadDscWord(DSC_DOUBLE_BUFFER, Buffer)  &&
 
@@ -916,7 +1203,7 @@ bool CommitDscState()
 bool WriteSwitchTriggerSelect(bool ExternalTrigger)
 {
     int DividerValue;
-    return LOCKED(
+    return LOCKED(LOCK_DSC,
         ReadDscWord(DSC_SWITCH_DIVIDER, DividerValue)  &&
         WriteDscWord(DSC_SWITCH_DIVIDER,
             (DividerValue & 0x7FFFFFFF) | (ExternalTrigger << 31)));
@@ -929,7 +1216,7 @@ bool WriteSwitchTriggerSelect(bool ExternalTrigger)
 bool WriteSwitchTriggerDelay(int Delay)
 {
     int DelayControl;
-    return LOCKED(
+    return LOCKED(LOCK_DSC,
         ReadDscWord(DSC_SWITCH_DELAY, DelayControl)  &&
         WriteDscWord(DSC_SWITCH_DELAY,
             (DelayControl & 0xFFFF0000) | (Delay & 0x3FF)));
@@ -942,7 +1229,7 @@ bool WriteSwitchTriggerDelay(int Delay)
 
 bool WriteInterlockIIR_K(int K)
 {
-    return LOCKED(WriteDscWord(DSC_INTERLOCK_IIR_K, K));
+    return LOCKED(LOCK_DSC, WriteDscWord(DSC_INTERLOCK_IIR_K, K));
 }
 
 
@@ -961,7 +1248,7 @@ static bool InitialiseAverageSum()
 {
     if (Version2FpgaPresent)
         return TEST_NULL(
-            AverageSumRegisters = MapRawRegister(REGISTER_FA_NSUMS));
+            AverageSumRegisters = RawRegister(REGISTER_FA_NSUMS));
     else
         return true;
 }
@@ -982,7 +1269,7 @@ void GetTriggeredAverageSum(int &Sum, int &Samples)
     }
     else
     {
-        LOCK();
+        LOCK(LOCK_REG);
         uint32_t u_samples = AverageSumRegisters[0];
         if (u_samples == 0)
         {
@@ -1035,23 +1322,21 @@ bool WriteSpikeRemovalSettings(
 #if defined(RAW_REGISTER)
     /* Write directly to the hardware in preference to using the driver. */
     uint32_t * FA_area;
-    if (!TEST_NULL(FA_area = MapRawRegister(FA_OFFSET)))
+    if (!TEST_NULL(FA_area = RawRegister(FA_OFFSET)))
         return false;
 
-    LOCK();
+    LOCK(LOCK_REG);
     *FA_REG(FA_area, REGISTER_SR_ENABLE)      = Enable;
     *FA_REG(FA_area, REGISTER_SR_AVE_STOP)    = AverageStop;
     *FA_REG(FA_area, REGISTER_SR_AVE_WIN)     = AverageWindow;
     *FA_REG(FA_area, REGISTER_SR_SPIKE_START) = SpikeStart;
     *FA_REG(FA_area, REGISTER_SR_SPIKE_WIN)   = SpikeWindow;
     UNLOCK();
-
-    UnmapRawRegister(FA_area);
     return true;
 
 #elif defined(__EBPP_H_2)
     int EnableInt = Enable;
-    return LOCKED(
+    return LOCKED(LOCK_CFG,
         WriteCfgValue(LIBERA_CFG_SR_ENABLE,         EnableInt)  &&
         WriteCfgValue(LIBERA_CFG_SR_AVERAGE_WINDOW, AverageWindow)  &&
         WriteCfgValue(LIBERA_CFG_SR_AVERAGING_STOP, AverageStop)  &&
@@ -1067,22 +1352,21 @@ bool WriteSpikeRemovalSettings(
 bool ReadSpikeRemovalBuffer(int Buffer[SPIKE_DEBUG_BUFLEN])
 {
     uint32_t * FA_area;
-    if (!TEST_NULL(FA_area = MapRawRegister(FA_OFFSET)))
+    if (!TEST_NULL(FA_area = RawRegister(FA_OFFSET)))
         return false;
 
     /* Enable spike capture and wait for some waveforms to be captured.
      * If switching is enabled the buffer will be filled within a few
      * microseconds, even on the largest of machines.  So we sleep a
-     * little and disable capture before reading out. */
-    LOCK();
-    *FA_REG(FA_area, REGISTER_SR_DEBUG) = 1;
+     * little and disable capture before reading out.  The register lock is
+     * not held while we sleep so that other register access can proceed. */
+    LOCKED(LOCK_REG, *FA_REG(FA_area, REGISTER_SR_DEBUG) = 1);
     usleep(1000);
+    LOCK(LOCK_REG);
     *FA_REG(FA_area, REGISTER_SR_DEBUG) = 0;
     memcpy(Buffer, FA_REG(FA_area, REGISTER_SR_BUFFER),
         SPIKE_DEBUG_BUFLEN * sizeof(int));
     UNLOCK();
-
-    UnmapRawRegister(FA_area);
     return true;
 }
 
@@ -1108,7 +1392,7 @@ bool WritePmTriggerParameters(
             ((overflow_limit >> AdcExcessBits) << 16) |
             ((overflow_limit * overflow_limit) >> 16);
 
-    return LOCKED(
+    return LOCKED(LOCK_REG,
         WriteRawRegister(REGISTER_TRIG_DELAY, source << 14, 0x0000C000)  &&
         WriteRawRegister(REGISTER_PM_MINX, Xlow)  &&
         WriteRawRegister(REGISTER_PM_MAXX, Xhigh)  &&
@@ -1127,15 +1411,14 @@ bool WritePmTriggerParameters(
 
 static void WriteNotchFilter(int offset, const int *filter)
 {
-    uint32_t *fa_base = MapRawRegister(FA_OFFSET);
+    uint32_t *fa_base = RawRegister(FA_OFFSET);
     if (fa_base)
     {
-        LOCK();
+        LOCK(LOCK_REG);
         fa_base[FA_FIFO_RESET_OFFSET] = 1;     // Reset FIFO
         for (int i = 0; i < 5; i ++)
             fa_base[offset] = filter[i];
         UNLOCK();
-        UnmapRawRegister(fa_base);
     }
 }
 
@@ -1154,11 +1437,11 @@ void WriteFA_FIR(const int *filter)
     /* The filter coefficients for the FA FIR are written in a rather strange
      * order: last N coefficients, middle N, then first N, where N is the
      * decimation order. */
-    uint32_t *fa_base = MapRawRegister(FA_OFFSET);
+    uint32_t *fa_base = RawRegister(FA_OFFSET);
     if (fa_base)
     {
         int N = FA_FIR_Decimation;
-        LOCK();
+        LOCK(LOCK_REG);
         fa_base[FA_FIFO_RESET_OFFSET] = 1;     // Reset FIFO
         for (int i = 0; i < N; i ++)
             fa_base[FA_FIR_FIFO_OFFSET] = filter[2*N + i];
@@ -1167,7 +1450,6 @@ void WriteFA_FIR(const int *filter)
         for (int i = 0; i < N; i ++)
             fa_base[FA_FIR_FIFO_OFFSET] = filter[i];
         UNLOCK();
-        UnmapRawRegister(fa_base);
     }
 }
 
@@ -1175,7 +1457,7 @@ void WriteFA_FIR(const int *filter)
 #ifdef __EBPP_H_2
 bool SetPmOffset(int offset)
 {
-    return LOCKED(WriteCfgValue(LIBERA_CFG_PMOFFSET, offset));
+    return LOCKED(LOCK_CFG, WriteCfgValue(LIBERA_CFG_PMOFFSET, offset));
 }
 #endif
 
@@ -1196,10 +1478,10 @@ static bool EnableMaxAdc()
 {
     if (ItechMaxAdcPresent)
         return TEST_NULL(
-            RegisterMaxAdcRaw = MapRawRegister(REGISTER_MAX_ADC_ITECH));
+            RegisterMaxAdcRaw = RawRegister(REGISTER_MAX_ADC_ITECH));
     else if (DlsFpgaFeatures)
         return TEST_NULL(
-            RegisterMaxAdcRaw = MapRawRegister(REGISTER_MAX_ADC_DLS));
+            RegisterMaxAdcRaw = RawRegister(REGISTER_MAX_ADC_DLS));
     else
         /* Not enabled, not a problem. */
         return true;
@@ -1213,11 +1495,6 @@ bool InitialiseHardware(int _TurnsPerSwitch)
 {
     TurnsPerSwitch = _TurnsPerSwitch;
 
-#ifdef RAW_REGISTER
-    OsPageSize = getpagesize();
-    OsPageMask = OsPageSize - 1;
-#endif
-
     /* If the LiberaBrilliance flag is set then the ADC is 16 bits, otherwise
      * we're operating an older Libera with 12 bits.  We actually record and
      * use the excess bits which need to be handled specially. */
@@ -1230,12 +1507,14 @@ bool InitialiseHardware(int _TurnsPerSwitch)
         TEST_IO(DevDsc   = open("/dev/libera.dsc",   O_RDWR | O_SYNC))  &&
         TEST_IO(DevEvent = open("/dev/libera.event", O_RDWR))  &&
         TEST_IO(DevPm    = open("/dev/libera.pm",    O_RDONLY))  &&
-        TEST_IO(DevSa    = open("/dev/libera.sa",    O_RDONLY))  &&
+        TEST_IO(DevSa    = open("/dev/libera.sa",    O_RDONLY | O_NONBLOCK))  &&
+        TEST_IO(pipe(SaWakePipe))  &&
         TEST_IO(DevDd    = open("/dev/libera.dd",    O_RDONLY))  &&
 #ifdef RAW_REGISTER
         TEST_IO(DevMem   = open("/dev/mem", O_RDWR | O_SYNC))  &&
+        MapRegisterWindows()  &&
         EnableMaxAdc()  &&
         InitialiseAverageSum()  &&
 #endif
-        true;
+        InitialiseStream();
 }
@@ -126,12 +126,24 @@ size_t ReadWaveform(
 size_t ReadPostmortem(
     size_t WaveformLength, LIBERA_ROW * Data, LIBERA_TIMESTAMP & Timestamp);
 
-/* Reads a full 1024 point ADC waveform. */
-bool ReadAdcWaveform(ADC_DATA &Data);
-
-/* Reads a slow acquisition update. */
+/* Reads a full 1024 point ADC waveform.  The data is returned exactly as read
+ * from the driver: each sample needs to be shifted left by the returned
+ * ExcessBits to normalise it to signed 16 bits.  This is left to the caller so
+ * that it can be folded into subsequent processing of the data. */
+bool ReadAdcWaveform(ADC_ROW Data[ADC_LENGTH], int &ExcessBits);
+
+/* Reads a slow acquisition update.  The device is opened non-blocking, so
+ * this returns false if no update is ready: call WaitSlowAcquisition() first.
+ */
 bool ReadSlowAcquisition(ABCD_ROW &ButtonData, XYQS_ROW &PositionData);
 
+/* Waits for up to Timeout milliseconds for a slow acquisition update to become
+ * ready, returning true if ReadSlowAcquisition() can now be called.  Once
+ * InterruptSlowAcquisition() has been called (on shutdown) all waits return
+ * false immediately. */
+bool WaitSlowAcquisition(int Timeout);
+void InterruptSlowAcquisition();
+
 /* Reads (and resets) the maximum ADC reading.  (If the register cannot be
  * read then zero is returned.) */
 int ReadMaxAdc();
@@ -335,5 +347,32 @@ bool SetPmOffset(int offset);
 #endif
 
 
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*                          Hardware Lock Monitoring                         */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Hardware access is serialised separately for each of the following
+ * devices or register areas. */
+enum HARDWARE_LOCK_ID
+{
+    LOCK_CFG,       // Driver configuration (interlock, calibration, ...)
+    LOCK_DSC,       // DSC state: attenuators, switches, compensation
+    LOCK_ADC,       // ADC rate waveform
+    LOCK_DD,        // Turn by turn and decimated waveforms
+    LOCK_PM,        // Postmortem waveform
+    LOCK_REG,       // Direct FPGA register access
+    HARDWARE_LOCK_COUNT
+};
+
+/* Returns a short name for the given lock, suitable for use in a PV name. */
+const char * HardwareLockName(HARDWARE_LOCK_ID Id);
+
+/* Returns the longest time each lock has been held and the longest time any
+ * caller has waited for it, in microseconds, since the last call. */
+void ReadHardwareLockStatistics(
+    int MaxHold[HARDWARE_LOCK_COUNT], int MaxWait[HARDWARE_LOCK_COUNT]);
+
+
 /* Pick up the generic helper test macros. */
 #include "test_error.h"
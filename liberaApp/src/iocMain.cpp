@@ -56,6 +56,7 @@
 #include "turnByTurn.h"
 #include "freeRun.h"
 #include "slowAcquisition.h"
+#include "saHistory.h"
 #include "postmortem.h"
 #include "device.h"
 #include "persistent.h"
@@ -75,6 +76,10 @@
 #include "configure.h"
 #include "attenuation.h"
 #include "timestamps.h"
+#include "startup.h"
+#include "arena.h"
+#include "schedule.h"
+#include "replay.h"
 
 
 /* External declaration of caRepeater thread.  This should really be
@@ -137,11 +142,15 @@ static bool RemountRootfs = false;
 
 /* NTP monitoring can be turned off at startup. */
 static bool MonitorNtp = true;
+/* NTP server monitored for NTP status, normally the local NTP daemon. */
+static const char * NtpServer = "127.0.0.1";
 
 /* If set all CA puts are logged. */
 static bool EnablePvLogging = false;
 /* Blacklist file for PV logging, read at startup. */
 static const char * BlacklistFile = NULL;
+/* Whether independent components are started concurrently. */
+static bool ParallelStartup = true;
 
 
 
@@ -232,73 +241,157 @@ static bool StartCaRepeater()
 }
 
 
-/* The Libera driver is started by starting all of its constituent components
- * in turn.  Here is the natural place for these to be defined. */
+/* The Libera driver is started by starting all of its constituent components.
+ * Here is the natural place for these to be defined.  Each component is
+ * started by one step in the table below, and a step is only started once
+ * every step listed in its dependencies has completed: independent steps are
+ * run concurrently unless serial startup was requested.
+ *
+ * The dependencies below are those needed during initialisation; components
+ * which only call each other once the IOC is running need not be ordered. */
+
+static bool StartHardware()
+{
+    return InitialiseHardware(TurnsPerSwitch);
+}
+
+static bool StartPersistentState()
+{
+    return InitialisePersistentState(StateFileName, RemountRootfs);
+}
+
+static bool StartSignalConditioning()
+{
+    return InitialiseSignalConditioning(
+        Harmonic, TurnsPerSwitch, ConditioningSwitchCycles);
+}
+
+static bool StartFirstTurn()
+{
+    return InitialiseFirstTurn(Harmonic, RevolutionFrequency, S0_FT);
+}
+
+static bool StartTurnByTurn()
+{
+    return InitialiseTurnByTurn(LongTurnByTurnLength, TurnByTurnWindowLength);
+}
+
+static bool StartFreeRun()
+{
+    return InitialiseFreeRun(FreeRunLength);
+}
+
+static bool StartBooster()
+{
+    return InitialiseBooster(DecimatedShortLength, RevolutionFrequency);
+}
+
+static bool StartSlowAcquisition()
+{
+    return InitialiseSlowAcquisition(S0_SA);
+}
+
+static bool StartMeanSums()
+{
+    return IF_(Version2FpgaPresent, InitialiseMeanSums());
+}
+
+static bool StartSensors()
+{
+    return InitialiseSensors(MonitorNtp, NtpServer);
+}
+
+
+/* Dependencies common to all the components below the core: the hardware
+ * interface, event receiver and persistent state are used everywhere. */
+#define CORE    "Triggers Hardware EventReceiver PersistentState "
+
+static const STARTUP_STEP StartupSteps[] =
+{
+    /* Waveform memory is allocated by all components as they start. */
+    { "Arena",              InitialiseArena,            NULL },
+    /* Thread scheduling policy and jitter reporting. */
+    { "ThreadPolicy",       InitialiseThreadPolicy,     NULL },
+    /* First EPICS related activity. */
+    { "CaRepeater",         StartCaRepeater,            NULL },
+    /* Ensure the trigger interlock mechanism is working.  This needs to
+     * happen before any EPICS communication is attempted. */
+    { "Triggers",           InitialiseTriggers,         NULL },
+    /* Version PVs.  This needs to be done before hardware startup, as it can
+     * affect the behaviour of hardware. */
+    { "Versions",           InitialiseVersions,         NULL },
+    /* Initialise the connections to the Libera device.  This is used by
+     * almost all other initialisation code. */
+    { "Hardware",           StartHardware,              "Versions" },
+    /* Get the event receiver up and running.  This spawns background
+     * threads for dispatching trigger events. */
+    { "EventReceiver",      InitialiseEventReceiver,    "Hardware" },
+    /* The persistent state system is used by all other components, but only
+     * needs the file system: it can load while the hardware comes up. */
+    { "PersistentState",    StartPersistentState,       NULL },
+
+    /* Initialise the signal conditioning hardware interface. */
+    { "SignalConditioning", StartSignalConditioning,    CORE },
+    /* Initialise conversion code.  This is used globally. */
+    { "Convert",            InitialiseConvert,          CORE },
+    /* Initialise attenuation management. */
+    { "Attenuation",        InitialiseAttenuation,
+        CORE "SignalConditioning" },
+    /* Initialise Libera configuration: switches, etc. */
+    { "Configure",          InitialiseConfigure,
+        CORE "SignalConditioning" },
+    /* Timestamp and clock management. */
+    { "Timestamps",         InitialiseTimestamps,       CORE },
+
+    /* Now we can initialise the mode specific components. */
+
+    /* Initialise interlock settings. */
+    { "Interlock",          InitialiseInterlock,        CORE "Convert" },
+    /* First turn processing is designed for transfer path operation. */
+    { "FirstTurn",          StartFirstTurn,
+        CORE "Convert Attenuation SignalConditioning Timestamps" },
+    /* Turn by turn is designed for long waveform capture at revolution
+     * clock frequencies. */
+    { "TurnByTurn",         StartTurnByTurn,
+        CORE "Convert Timestamps" },
+    /* Free run also captures turn by turn waveforms, but of a shorter
+     * length that can be captured continously. */
+    { "FreeRun",            StartFreeRun,
+        CORE "Convert Timestamps" },
+    /* Booster operation is designed for viewing the entire booster ramp at
+     * reduced resolution. */
+    { "Booster",            StartBooster,
+        CORE "Convert Timestamps" },
+    /* Postmortem operation is only triggered on a postmortem event and
+     * captures the last 16K events before the event. */
+    { "Postmortem",         InitialisePostmortem,
+        CORE "Convert Timestamps" },
+    /* Slow acquisition returns highly filtered positions at 10Hz. */
+    { "SlowAcquisition",    StartSlowAcquisition,
+        CORE "Convert Attenuation Interlock" },
+    /* Mean sums, only enabled if FPGA 2 features present. */
+    { "MeanSums",           StartMeanSums,
+        CORE "Convert Timestamps SlowAcquisition" },
+    /* Initialise the fast feedback interface. */
+    { "FastFeedback",       InitialiseFastFeedback,     CORE "Convert" },
+    /* Background monitoring stuff: fan, temperature, memory, etcetera. */
+    { "Sensors",            StartSensors,               CORE },
+};
+
+#undef CORE
+
 
 static bool InitialiseLibera()
 {
     return
-        /* Initialise signal handling.  This should happen as early as
-         * possible, to ensure that all subsequent processing uses this
-         * signal state. */
+        /* Initialise signal handling.  This must happen before any other
+         * threads are created, to ensure that all subsequent processing uses
+         * this signal state. */
         InitialiseSignals()  &&
-        /* First EPICS related activity. */
-        StartCaRepeater()  &&
-        /* Ensure the trigger interlock mechanism is working.  This needs to
-         * happen before any EPICS communication is attempted. */
-        InitialiseTriggers()  &&
-        /* Version PVs.  This needs to be done before hardware startup, as it
-         * can affect the behaviour of hardware. */
-        InitialiseVersions()  &&
-        /* Initialise the connections to the Libera device.  This also needs
-         * to be done early, as this is used by other initialisation code. */
-        InitialiseHardware(TurnsPerSwitch)  &&
-        /* Get the event receiver up and running.  This spawns background
-         * threads for dispatching trigger events. */
-        InitialiseEventReceiver()  &&
-
-        /* Initialise the persistent state system early on so that other
-         * components can make use of it. */
-        InitialisePersistentState(StateFileName, RemountRootfs)  &&
-        /* Initialise the signal conditioning hardware interface. */
-        InitialiseSignalConditioning(
-            Harmonic, TurnsPerSwitch, ConditioningSwitchCycles)  &&
-        /* Initialise conversion code.  This needs to be done fairly early as
-         * it is used globally. */
-        InitialiseConvert()  &&
-        /* Initialise attenuation management. */
-        InitialiseAttenuation()  &&
-        /* Initialise Libera configuration: switches, etc. */
-        InitialiseConfigure()  &&
-        /* Timestamp and clock management. */
-        InitialiseTimestamps()  &&
-
-        /* Now we can initialise the mode specific components. */
-
-        /* Initialise interlock settings. */
-        InitialiseInterlock()  &&
-        /* First turn processing is designed for transfer path operation. */
-        InitialiseFirstTurn(Harmonic, RevolutionFrequency, S0_FT)  &&
-        /* Turn by turn is designed for long waveform capture at revolution
-         * clock frequencies. */
-        InitialiseTurnByTurn(LongTurnByTurnLength, TurnByTurnWindowLength)  &&
-        /* Free run also captures turn by turn waveforms, but of a shorter
-         * length that can be captured continously. */
-        InitialiseFreeRun(FreeRunLength)  &&
-        /* Booster operation is designed for viewing the entire booster ramp
-         * at reduced resolution. */
-        InitialiseBooster(DecimatedShortLength, RevolutionFrequency)  &&
-        /* Postmortem operation is only triggered on a postmortem event and
-         * captures the last 16K events before the event. */
-        InitialisePostmortem()  &&
-        /* Slow acquisition returns highly filtered positions at 10Hz. */
-        InitialiseSlowAcquisition(S0_SA)  &&
-        /* Mean sums, only enabled if FPGA 2 features present. */
-        IF_(Version2FpgaPresent, InitialiseMeanSums())  &&
-        /* Initialise the fast feedback interface. */
-        InitialiseFastFeedback()  &&
-        /* Background monitoring stuff: fan, temperature, memory, etcetera. */
-        InitialiseSensors(MonitorNtp);
+        RunStartup(StartupSteps, ARRAY_SIZE(StartupSteps), ParallelStartup)  &&
+        /* Now all the waveforms have been allocated we can report how much
+         * memory they occupy. */
+        DO_(ReportArena());
 }
 
 
@@ -309,6 +402,8 @@ static bool InitialiseLibera()
  * in until _exit() is called.  This means that we don't want to close most
  * resources, so all we really do below is terminate threads. */
 
+static void TerminateLogging(void);
+
 static void TerminateLibera()
 {
     TerminateEventReceiver();
@@ -317,6 +412,9 @@ static void TerminateLibera()
     TerminateSignalConditioning();
     TerminatePersistentState();
     TerminateSensors();
+    TerminateFastFeedback();
+    TerminateStream();
+    TerminateLogging();
 
     /* On orderly shutdown remove the pid file if we created it.  Do this
      * last of all. */
@@ -447,8 +545,21 @@ static void Usage(const char *IocName)
 "    -M             Remount rootfs rw while writing persistent state\n"
 "    -d <device>    Name of device for database\n"
 "    -N             Disable NTP status monitoring\n"
+"    -t <ip>[:port] NTP server to monitor, default 127.0.0.1\n"
 "    -l             Log all CA puts (except for those blacklisted)\n"
 "    -b <file>      PV logging blacklist\n"
+"    -S             Start components serially rather than in parallel\n"
+"    -P <thread>:<policy>  Set scheduling policy for <thread>, one of\n"
+"                   EVENTS, DISPATCH, SC, SA, SENSORS or PERSIST.  <policy>\n"
+"                   is a comma separated list of settings:\n"
+"       fifo=<prio> Run with SCHED_FIFO real time priority <prio>\n"
+"       other       Run with normal time sharing scheduling\n"
+"       cpus=<mask> Restrict thread to CPUs in <mask>\n"
+"       lock        Lock thread stack into memory\n"
+"    -R <file>      Capture driver data stream to <file>\n"
+"    -r <file>[:<speed>]  Replay data stream captured in <file> instead of\n"
+"                   reading from the driver, <speed> times faster than\n"
+"                   captured, or as fast as possible if <speed> is 0\n"
 "\n"
 "Note: This IOC application should normally be run from within runioc.\n",
         IocName);
@@ -465,7 +576,7 @@ static bool ProcessOptions(int &argc, char ** &argv)
     bool Ok = true;
     while (Ok)
     {
-        switch (getopt(argc, argv, "+hvp:nc:f:s:Md:Nlb:"))
+        switch (getopt(argc, argv, "+hvp:nc:f:s:Md:Nt:lb:SP:R:r:"))
         {
             case 'h':   Usage(argv[0]);                 return false;
             case 'v':   StartupMessage();               return false;
@@ -477,8 +588,13 @@ static bool ProcessOptions(int &argc, char ** &argv)
             case 'M':   RemountRootfs = true;           break;
             case 'd':   DeviceName = optarg;            break;
             case 'N':   MonitorNtp = false;             break;
+            case 't':   NtpServer = optarg;             break;
             case 'l':   EnablePvLogging = true;         break;
             case 'b':   BlacklistFile = optarg;         break;
+            case 'S':   ParallelStartup = false;        break;
+            case 'P':   Ok = ParseThreadPolicy(optarg); break;
+            case 'R':   Ok = SetStreamCapture(optarg);  break;
+            case 'r':   Ok = SetStreamReplay(optarg);   break;
             case '?':
             default:
                 fprintf(stderr, "Try `%s -h` for usage\n", argv[0]);
@@ -518,102 +634,267 @@ static bool ProcessOptions(int &argc, char ** &argv)
 /*                            IOC PV put logging                             */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+/* CA puts are logged by a background thread so that a burst of puts isn't
+ * held up waiting for the log.  The put hook, which runs in the CA server
+ * thread, just copies the old and new values into a preallocated slot, and
+ * if all the slots are in use the put is counted as dropped instead.
+ *
+ * Numeric values are captured raw, as far as will fit in the slot, and only
+ * formatted when written to the log; anything else (strings, menus, links)
+ * is converted to strings by EPICS at capture time. */
+
+#define PUT_LOG_SLOTS       64
+#define PUT_LOG_VALUE_SIZE  512     // Bytes of each value captured
+#define PUT_LOG_INTERVAL    1000    // ms, poll interval for logger thread
+
 static struct gphPvt *PvLogBlacklist;
 
-/* Alas dbGetField is rather rubbish at formatting floating point numbers, so we
- * do that ourselves, but the rest formats ok. */
-static void FormatField(dbAddr *dbaddr, dbr_string_t *value)
+struct PUT_LOG_VALUE
 {
-#define FORMAT(type, format) \
-    do { \
-        type *raw = (type *) dbaddr->pfield; \
-        for (int i = 0; i < length; i ++) \
-            snprintf(value[i], sizeof(dbr_string_t), format, raw[i]); \
-    } while (0)
+    short Type;         // DBF_ type of captured data
+    long Length;        // Number of elements in field
+    long Count;         // Number of elements captured
+    union
+    {
+        double Align;
+        char Data[PUT_LOG_VALUE_SIZE];
+    };
+};
+
+struct PUT_LOG_ENTRY
+{
+    bool Ready;         // Set once the new value has been captured
+    char User[32];
+    char Host[32];
+    char Record[64];
+    char Field[16];
+    PUT_LOG_VALUE Old;
+    PUT_LOG_VALUE New;
+};
+
 
-    long length = dbaddr->no_elements;
+static void CaptureValue(dbAddr *dbaddr, PUT_LOG_VALUE &Value)
+{
+    Value.Length = dbaddr->no_elements;
     switch (dbaddr->field_type)
     {
-        case DBF_FLOAT:
-            FORMAT(dbr_float_t, "%.7g");
+        case DBF_CHAR:  case DBF_UCHAR:
+        case DBF_SHORT: case DBF_USHORT:
+        case DBF_LONG:  case DBF_ULONG:
+        case DBF_FLOAT: case DBF_DOUBLE:
+        {
+            long Size = dbaddr->field_size;
+            Value.Type = dbaddr->field_type;
+            Value.Count = Value.Length;
+            if (Value.Count * Size > PUT_LOG_VALUE_SIZE)
+                Value.Count = PUT_LOG_VALUE_SIZE / Size;
+            memcpy(Value.Data, dbaddr->pfield, Value.Count * Size);
             break;
-        case DBF_DOUBLE:
-            FORMAT(dbr_double_t, "%.15lg");
+        }
+        default:
+            Value.Type = DBF_STRING;
+            Value.Count = Value.Length;
+            if (Value.Count > (long) (PUT_LOG_VALUE_SIZE / sizeof(dbr_string_t)))
+                Value.Count = PUT_LOG_VALUE_SIZE / sizeof(dbr_string_t);
+            dbGetField(dbaddr, DBR_STRING, Value.Data, NULL, &Value.Count, NULL);
             break;
+    }
+}
+
+
+/* Alas dbGetField is rather rubbish at formatting floating point numbers, so we
+ * do that ourselves, but the rest formats ok. */
+static void PrintElement(const PUT_LOG_VALUE &Value, int i)
+{
+#define PRINT(type, format) \
+    printf(format, ((const type *) Value.Data)[i]); \
+    break
+
+    switch (Value.Type)
+    {
+        case DBF_CHAR:      PRINT(epicsInt8,    "%d");
+        case DBF_UCHAR:     PRINT(epicsUInt8,   "%u");
+        case DBF_SHORT:     PRINT(epicsInt16,   "%d");
+        case DBF_USHORT:    PRINT(epicsUInt16,  "%u");
+        case DBF_LONG:      PRINT(epicsInt32,   "%d");
+        case DBF_ULONG:     PRINT(epicsUInt32,  "%u");
+        case DBF_FLOAT:     PRINT(dbr_float_t,  "%.7g");
+        case DBF_DOUBLE:    PRINT(dbr_double_t, "%.15lg");
         default:
-            dbGetField(dbaddr, DBR_STRING, value, NULL, &length, NULL);
+            printf("%s", ((const dbr_string_t *) Value.Data)[i]);
             break;
     }
-#undef FORMAT
+#undef PRINT
 }
 
-static void PrintValue(dbr_string_t *value, int length)
+static void PrintValue(const PUT_LOG_VALUE &Value)
 {
-    if (length == 1)
-        printf("%s", value[0]);
+    if (Value.Length == 1)
+        PrintElement(Value, 0);
     else
     {
         printf("[");
-        for (int i = 0; i < length; i ++)
+        for (int i = 0; i < Value.Count; i ++)
         {
             if (i > 0)  printf(", ");
-            printf("%s", value[i]);
+            PrintElement(Value, i);
         }
+        if (Value.Count < Value.Length)
+            printf(", ... (%ld elements)", Value.Length);
         printf("]");
     }
 }
 
-static bool CheckBlacklist(asTrapWriteMessage *pmessage, int after)
+
+class PUT_LOGGER : public LOCKED_THREAD
 {
-    if (PvLogBlacklist)
+public:
+    PUT_LOGGER() :
+        LOCKED_THREAD("PUT_LOGGER"),
+        Wakeup(false)
+    {
+        Head = 0;
+        Tail = 0;
+        Dropped = 0;
+        ReportedDropped = 0;
+    }
+
+    /* Called before the put: captures the old value into a fresh slot, or
+     * returns NULL if no slot is available. */
+    PUT_LOG_ENTRY * BeginPut(asTrapWriteMessage *pmessage)
     {
-        if (after)
-            /* On second pass can just check for presence of userPvt field. */
-            return pmessage->userPvt == NULL;
+        PUT_LOG_ENTRY * Entry = NULL;
+        THREAD_LOCK(this);
+        if (Head - Tail < PUT_LOG_SLOTS)
+        {
+            Entry = &Slots[Head % PUT_LOG_SLOTS];
+            Entry->Ready = false;
+            Head += 1;
+        }
         else
+            Dropped += 1;
+        THREAD_UNLOCK();
+
+        /* Until marked ready the slot belongs to this put alone, so can be
+         * filled in without holding the lock. */
+        if (Entry != NULL)
         {
-            /* On first pass check for device name prefix and suffix in
-             * blacklist file. */
             dbAddr *dbaddr = (dbAddr *) pmessage->serverSpecific;
-            const char *record_name = dbaddr->precord->name;
-            int length = strlen(DeviceName);
-            return
-                strncmp(record_name, DeviceName, length) == 0  &&
-                gphFind(PvLogBlacklist, record_name + length, NULL) != NULL;
+            snprintf(Entry->User, sizeof(Entry->User), "%s", pmessage->userid);
+            snprintf(Entry->Host, sizeof(Entry->Host), "%s", pmessage->hostid);
+            snprintf(Entry->Record, sizeof(Entry->Record), "%s",
+                dbaddr->precord->name);
+            snprintf(Entry->Field, sizeof(Entry->Field), "%s",
+                dbaddr->pfldDes->name);
+            CaptureValue(dbaddr, Entry->Old);
+        }
+        return Entry;
+    }
+
+    /* Called after the put: completes the slot and hands it to the logger. */
+    void EndPut(asTrapWriteMessage *pmessage, PUT_LOG_ENTRY *Entry)
+    {
+        CaptureValue((dbAddr *) pmessage->serverSpecific, Entry->New);
+        THREAD_LOCK(this);
+        Entry->Ready = true;
+        THREAD_UNLOCK();
+        Wakeup.Signal();
+    }
+
+private:
+    void Thread()
+    {
+        StartupOk();
+        while (Running())
+        {
+            Wakeup.WaitFor(PUT_LOG_INTERVAL);
+            while (PUT_LOG_ENTRY * Entry = NextEntry())
+            {
+                printf("%s@%s %s.%s ",
+                    Entry->User, Entry->Host, Entry->Record, Entry->Field);
+                PrintValue(Entry->Old);
+                printf(" -> ");
+                PrintValue(Entry->New);
+                printf("\n");
+                ReleaseEntry();
+            }
+
+            int NewDropped = Dropped;
+            if (NewDropped != ReportedDropped)
+            {
+                printf("%d put log messages dropped\n",
+                    NewDropped - ReportedDropped);
+                ReportedDropped = NewDropped;
+            }
         }
     }
+
+    void OnTerminate()
+    {
+        Wakeup.Signal();
+    }
+
+    /* Returns the oldest slot if it is complete, otherwise NULL.  Slots are
+     * logged strictly in order. */
+    PUT_LOG_ENTRY * NextEntry()
+    {
+        PUT_LOG_ENTRY * Entry = NULL;
+        THREAD_LOCK(this);
+        if (Tail != Head  &&  Slots[Tail % PUT_LOG_SLOTS].Ready)
+            Entry = &Slots[Tail % PUT_LOG_SLOTS];
+        THREAD_UNLOCK();
+        return Entry;
+    }
+
+    void ReleaseEntry()
+    {
+        THREAD_LOCK(this);
+        Tail += 1;
+        THREAD_UNLOCK();
+    }
+
+    SEMAPHORE Wakeup;
+    unsigned int Head;          // Slots reserved by puts
+    unsigned int Tail;          // Slots written to the log
+    int Dropped;                // Puts not logged for lack of a slot
+    int ReportedDropped;
+    PUT_LOG_ENTRY Slots[PUT_LOG_SLOTS];
+};
+
+static PUT_LOGGER * PutLogger = NULL;
+
+
+/* Checks for device name prefix and suffix in blacklist file. */
+static bool CheckBlacklist(asTrapWriteMessage *pmessage)
+{
+    if (PvLogBlacklist)
+    {
+        dbAddr *dbaddr = (dbAddr *) pmessage->serverSpecific;
+        const char *record_name = dbaddr->precord->name;
+        int length = strlen(DeviceName);
+        return
+            strncmp(record_name, DeviceName, length) == 0  &&
+            gphFind(PvLogBlacklist, record_name + length, NULL) != NULL;
+    }
     else
         return false;
 }
 
 static void EpicsPvPutHook(asTrapWriteMessage *pmessage, int after)
 {
-    if (CheckBlacklist(pmessage, after))
-        return;
-
-    dbAddr *dbaddr = (dbAddr *) pmessage->serverSpecific;
-    long length = dbaddr->no_elements;
-    dbr_string_t *value = (dbr_string_t *) calloc(length, sizeof(dbr_string_t));
-    FormatField(dbaddr, value);
-
     if (after)
     {
-        /* Log the message after the event. */
-        dbr_string_t *old_value = (dbr_string_t *) pmessage->userPvt;
-        printf("%s@%s %s.%s ",
-            pmessage->userid, pmessage->hostid,
-            dbaddr->precord->name, dbaddr->pfldDes->name);
-        PrintValue(old_value, length);
-        printf(" -> ");
-        PrintValue(value, length);
-        printf("\n");
-
-        free(old_value);
-        free(value);
+        /* userPvt is NULL if the first pass skipped this put, either because
+         * it is blacklisted or because no log slot was free. */
+        PUT_LOG_ENTRY *Entry = (PUT_LOG_ENTRY *) pmessage->userPvt;
+        if (Entry != NULL)
+            PutLogger->EndPut(pmessage, Entry);
     }
+    else if (CheckBlacklist(pmessage))
+        pmessage->userPvt = NULL;
     else
         /* Just save the old value for logging after. */
-        pmessage->userPvt = value;
+        pmessage->userPvt = PutLogger->BeginPut(pmessage);
 }
 
 static bool ReadBlacklistFile(void)
@@ -649,11 +930,19 @@ static bool ReadBlacklistFile(void)
 
 static bool HookLogging(void)
 {
+    PutLogger = new PUT_LOGGER;
     return
+        PutLogger->StartThread()  &&
         IF_(BlacklistFile, ReadBlacklistFile())  &&
         DO_(asTrapWriteRegisterListener(EpicsPvPutHook));
 }
 
+static void TerminateLogging(void)
+{
+    if (PutLogger != NULL)
+        PutLogger->Terminate();
+}
+
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
@@ -705,6 +994,7 @@ static bool LoadDatabases()
         DB_("%d", "SC_IQ_LENGTH",   ConditioningIQlength())  &&
         DB_("%d", "ATTEN_COUNT",    MaximumAttenuation() + 1)  &&
         DB_("%d", "FIR_LENGTH",     FA_DecimationFirLength)  &&
+        DB_("%d", "SA_HISTORY",     SA_HISTORY_READOUT)  &&
 
         LOAD_RECORDS_("db/libera.db")  &&
         IF_(Version2FpgaPresent, LOAD_RECORDS_("db/libera-2.0.db"))  &&
@@ -751,7 +1041,8 @@ static bool StartIOC()
         LoadDatabases()  &&
         TEST_EPICS(asSetFilename("db/access.acf"))  &&
         IF_(EnablePvLogging, HookLogging())  &&
-        TEST_EPICS(iocInit());
+        TEST_EPICS(iocInit())  &&
+        DO_(ReportUnboundRecords());
 }
 
 
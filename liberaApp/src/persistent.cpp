@@ -32,7 +32,6 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <signal.h>
 #include <stdint.h>
 
 #include "hardware.h"
@@ -47,6 +46,9 @@
 
 static const char * StateFileName = NULL;
 static PERSISTENT_BASE * PersistentList = NULL;
+/* Components may be initialised concurrently, so additions to the list are
+ * serialised.  The list is only ever prepended to, so readers need no lock. */
+static pthread_mutex_t PersistentListMutex = PTHREAD_MUTEX_INITIALIZER;
 static bool PersistentDirty = false;
 
 static bool RemountRootfs;
@@ -172,8 +174,10 @@ bool PERSISTENT_BASE::Initialise(const char *SetName)
     BackupValue();
 
     /* Add this entry onto the list of persistent entities. */
+    TEST_0(pthread_mutex_lock(&PersistentListMutex));
     Next = PersistentList;
     PersistentList = this;
+    TEST_0(pthread_mutex_unlock(&PersistentListMutex));
 
     return Initialised;
 }
@@ -335,7 +339,7 @@ template class PERSISTENT_WAVEFORM<int>;
 class TIMER_THREAD: public THREAD
 {
 public:
-    TIMER_THREAD() : THREAD("TIMER_THREAD") {}
+    TIMER_THREAD() : THREAD("TIMER_THREAD"), Wakeup(false) {}
 
 private:
     void Thread()
@@ -343,7 +347,7 @@ private:
         StartupOk();
         while (Running())
         {
-            sleep(PERSISTENCE_POLL_INTERVAL);
+            Wakeup.WaitFor(1000 * PERSISTENCE_POLL_INTERVAL);
             if (CheckStateChanged())
                 /* Only actually write anything if anything has actually
                  * changed.  Ensuring that we only write if variables has
@@ -355,11 +359,12 @@ private:
 
     void OnTerminate()
     {
-        /* Poke the terminate thread to kick it out of its sleep so that we
-         * get one last write of the state file.   We reserve SIGUSR2 for
-         * side effect free signals! */
-        Kill(SIGUSR2);
+        /* Poke the terminate thread to kick it out of its wait so that we
+         * get one last write of the state file. */
+        Wakeup.Signal();
     }
+
+    SEMAPHORE Wakeup;
 };
 
 
@@ -52,7 +52,8 @@
 
 
 /* Simple helper routine for building published names.  As we never have to
- * worry about end of lifetime, this is pretty easy. */
+ * worry about end of lifetime, this is pretty easy.  Names are deliberately
+ * not taken from the arena, which holds only waveform memory. */
 const char * Concat(
     const char * Prefix, const char * Body, const char * Suffix)
 {
@@ -199,6 +200,14 @@ template<class T>
 
 template<class T>
     void UPDATER<T>::Write(T NewValue)
+{
+    if (NewValue != Value)
+        Notify(NewValue);
+}
+
+
+template<class T>
+    void UPDATER<T>::Notify(T NewValue)
 {
     Value = NewValue;
     if (iIntr != NULL)
@@ -228,11 +237,11 @@ template class UPDATER<int>;
 template<class T>
     READBACK<T>::READBACK(T InitialValue, bool (*OnUpdate)(T)) :
 
+    Value(InitialValue),
     OnUpdate(OnUpdate),
-    Writer(Value),
+    Writer(InitialValue),
     Reader(*this, &READBACK<T>::UserUpdate, &READBACK<T>::Value)
 {
-    Value = InitialValue;
 }
 
 
@@ -245,7 +254,10 @@ template<class T>
     if (NewValue != Value)
     {
         Value = NewValue;
-        Writer.Write(NewValue);
+        /* Writer's own copy of the value is not updated by operator changes,
+         * so we must not let it filter this update: the scan is needed to
+         * bring the controlling PV back into step. */
+        Writer.Notify(NewValue);
     }
 }
 
@@ -321,7 +321,10 @@ template<class T>
 {
 public:
     UPDATER(T InitialValue);
+    /* Updates the value, notifying EPICS only if the value has changed. */
     void Write(T NewValue);
+    /* Updates the value and unconditionally notifies EPICS. */
+    void Notify(T NewValue);
     T Read() { return Value; }
 private:
     bool read(T &Value);
@@ -0,0 +1,79 @@
+# This file is part of the Libera EPICS Driver,
+# Copyright (C) 2008-2011  Michael Abbott, Diamond Light Source Ltd.
+#
+# The Libera EPICS Driver is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# The Libera EPICS Driver is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc., 51
+# Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+#
+# Contact:
+#      Dr. Michael Abbott,
+#      Diamond Light Source Ltd,
+#      Diamond House,
+#      Chilton,
+#      Didcot,
+#      Oxfordshire,
+#      OX11 0DE
+#      michael.abbott@diamond.ac.uk
+
+
+# Generates the table of record names published by the driver.
+#
+# Usage: pvTable.py database...
+#
+# Reads the databases built from libera.py and its companions and writes to
+# standard output, for each supported record type, a sorted table of the names
+# bound by each Libera record (the "@name" in its INP or OUT link).  device.cpp
+# uses these tables to check every name the driver publishes against the
+# database, and to report database records the driver never publishes.
+
+import sys
+import re
+
+
+RecordTypes = [
+    'longin', 'longout', 'ai', 'ao', 'bi', 'bo',
+    'stringin', 'stringout', 'mbbi', 'mbbo', 'waveform']
+
+record_pattern = re.compile(
+    r'record\(\s*(\w+)\s*,\s*"[^"]*"\s*\)\s*\{((?:[^"}]|"[^"]*")*)\}')
+field_pattern = re.compile(r'field\(\s*(\w+)\s*,\s*"([^"]*)"\s*\)')
+
+
+Names = {}
+for RecordType in RecordTypes:
+    Names[RecordType] = set()
+
+for database in sys.argv[1:]:
+    for RecordType, body in record_pattern.findall(open(database).read()):
+        fields = dict(field_pattern.findall(body))
+        if fields.get('DTYP') != 'Libera':
+            continue
+        assert RecordType in Names, \
+            'Unsupported Libera record type %s' % RecordType
+        link = fields.get('INP', fields.get('OUT', ''))
+        assert link[:1] == '@', 'Malformed Libera link "%s"' % link
+        Names[RecordType].add(link[1:])
+
+
+print '/* Names of all records bound to the Libera driver.'
+print ' * Automatically generated by pvTable.py from:'
+for database in sys.argv[1:]:
+    print ' *      %s' % database.split('/')[-1]
+print ' * Each table is sorted and terminated by a NULL entry. */'
+for RecordType in RecordTypes:
+    print
+    print 'static const char * const PvTable_%s[] = {' % RecordType
+    for name in sorted(Names[RecordType]):
+        print '    "%s",' % name
+    print '    NULL'
+    print '};'
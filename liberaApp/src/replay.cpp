@@ -0,0 +1,382 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Capture and replay of the driver data stream. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "hardware.h"
+#include "replay.h"
+
+
+/* Position of a single block in the replay file. */
+struct STREAM_INDEX
+{
+    off_t Offset;               // Start of block data after header
+    uint32_t Length;
+    uint64_t Time;
+};
+
+/* All the blocks of a single type together with the replay position. */
+struct STREAM_BLOCKS
+{
+    STREAM_INDEX * Index;
+    size_t Count;
+    size_t Allocated;
+    size_t Next;                // Next block to be replayed
+    bool Exhausted;             // Set once end of replay reported
+};
+
+/* Events and SA updates drive the IOC and are replayed with their captured
+ * timing, all other blocks are read on demand. */
+static const bool PacedBlock[STREAM_BLOCK_COUNT] =
+    { true, false, false, false, true };
+static const char * const BlockName[STREAM_BLOCK_COUNT] =
+    { "events", "waveform", "postmortem", "ADC", "SA" };
+
+
+bool CapturingStream = false;
+bool ReplayingStream = false;
+
+static const char * CaptureFileName = NULL;
+static const char * ReplayFileName = NULL;
+static double ReplaySpeed = 1.0;
+
+static pthread_mutex_t StreamMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Capture state. */
+static FILE * CaptureFile = NULL;
+static struct timespec CaptureStart;
+
+/* Replay state.  The replay clock is started on the first paced read. */
+static int ReplayFile = -1;
+static STREAM_BLOCKS Blocks[STREAM_BLOCK_COUNT];
+static bool ReplayStarted = false;
+static struct timespec ReplayStart;
+static uint64_t ReplayOrigin;
+/* Paced reads wait on this once their replay is complete.  It is posted by
+ * StopReplay() and each waiter passes it on. */
+static sem_t ReplayStopped;
+
+
+
+bool SetStreamCapture(const char * FileName)
+{
+    if (ReplayFileName != NULL)
+    {
+        printf("Cannot both capture and replay data stream\n");
+        return false;
+    }
+    CaptureFileName = FileName;
+    return true;
+}
+
+
+bool SetStreamReplay(const char * Option)
+{
+    if (CaptureFileName != NULL)
+    {
+        printf("Cannot both capture and replay data stream\n");
+        return false;
+    }
+
+    const char * Colon = strrchr(Option, ':');
+    if (Colon == NULL)
+        ReplayFileName = Option;
+    else
+    {
+        char * End;
+        ReplaySpeed = strtod(Colon + 1, &End);
+        if (Colon[1] == '\0'  ||  *End != '\0'  ||  ReplaySpeed < 0)
+        {
+            printf("Invalid replay speed in \"%s\"\n", Option);
+            return false;
+        }
+        ReplayFileName = strndup(Option, Colon - Option);
+    }
+    return true;
+}
+
+
+static uint64_t Microseconds(const struct timespec & Start)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return
+        (uint64_t) (Now.tv_sec - Start.tv_sec) * 1000000 +
+        (Now.tv_nsec - Start.tv_nsec) / 1000;
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                               Stream Capture                              */
+/*                                                                           */
+/*****************************************************************************/
+
+
+static bool OpenCapture()
+{
+    uint32_t Magic = STREAM_MAGIC;
+    bool Ok =
+        TEST_NULL(CaptureFile = fopen(CaptureFileName, "w"))  &&
+        TEST_OK(fwrite(&Magic, sizeof(Magic), 1, CaptureFile) == 1);
+    if (Ok)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &CaptureStart);
+        printf("Capturing data stream to %s\n", CaptureFileName);
+    }
+    return Ok;
+}
+
+
+void CaptureBlock(
+    STREAM_BLOCK Block, const void * Prefix, size_t PrefixLength,
+    const void * Data, size_t DataLength)
+{
+    TEST_0(pthread_mutex_lock(&StreamMutex));
+    if (CaptureFile != NULL)
+    {
+        STREAM_HEADER Header;
+        Header.Block = Block;
+        Header.Length = PrefixLength + DataLength;
+        Header.Time = Microseconds(CaptureStart);
+        bool Ok =
+            TEST_OK(fwrite(&Header, sizeof(Header), 1, CaptureFile) == 1)  &&
+            TEST_OK(fwrite(Prefix, 1, PrefixLength, CaptureFile) ==
+                PrefixLength)  &&
+            TEST_OK(fwrite(Data, 1, DataLength, CaptureFile) == DataLength);
+        if (!Ok)
+        {
+            /* Don't keep on trying once capture has failed. */
+            printf("Data stream capture abandoned\n");
+            fclose(CaptureFile);
+            CaptureFile = NULL;
+        }
+    }
+    TEST_0(pthread_mutex_unlock(&StreamMutex));
+}
+
+
+
+/*****************************************************************************/
+/*                                                                           */
+/*                               Stream Replay                               */
+/*                                                                           */
+/*****************************************************************************/
+
+
+static bool AddIndex(const STREAM_HEADER & Header, off_t Offset)
+{
+    if (Header.Block >= STREAM_BLOCK_COUNT)
+    {
+        printf("Invalid block %u at offset %ld in %s\n",
+            Header.Block, (long) Offset, ReplayFileName);
+        return false;
+    }
+
+    STREAM_BLOCKS & Stream = Blocks[Header.Block];
+    if (Stream.Count >= Stream.Allocated)
+    {
+        Stream.Allocated = Stream.Allocated == 0 ? 256 : 2 * Stream.Allocated;
+        if (!TEST_NULL(Stream.Index = (STREAM_INDEX *) realloc(
+                Stream.Index, Stream.Allocated * sizeof(STREAM_INDEX))))
+            return false;
+    }
+    STREAM_INDEX & Index = Stream.Index[Stream.Count ++];
+    Index.Offset = Offset + sizeof(STREAM_HEADER);
+    Index.Length = Header.Length;
+    Index.Time = Header.Time;
+    return true;
+}
+
+
+/* Builds an index of every block in the replay file, so that each stream can
+ * be replayed independently. */
+
+static bool OpenReplay()
+{
+    uint32_t Magic = 0;
+    bool Ok =
+        TEST_IO(ReplayFile = open(ReplayFileName, O_RDONLY))  &&
+        TEST_OK(read(ReplayFile, &Magic, sizeof(Magic)) == sizeof(Magic));
+    if (Ok  &&  Magic != STREAM_MAGIC)
+    {
+        printf("%s is not a data stream capture\n", ReplayFileName);
+        Ok = false;
+    }
+
+    off_t Offset = sizeof(Magic);
+    while (Ok)
+    {
+        STREAM_HEADER Header;
+        ssize_t Read = pread(ReplayFile, &Header, sizeof(Header), Offset);
+        if (Read == 0)
+            break;
+        Ok = TEST_OK(Read == sizeof(Header))  &&  AddIndex(Header, Offset);
+        Offset += sizeof(Header) + Header.Length;
+    }
+
+    if (Ok)
+    {
+        sem_init(&ReplayStopped, 0, 0);
+        printf("Replaying data stream from %s at speed %g:",
+            ReplayFileName, ReplaySpeed);
+        for (int i = 0; i < STREAM_BLOCK_COUNT; i ++)
+            printf(" %u %s", (unsigned int) Blocks[i].Count, BlockName[i]);
+        printf("\n");
+    }
+    return Ok;
+}
+
+
+/* Waits until the given capture time is due on the replay clock.  The replay
+ * clock starts when the first paced block is read, so that the capture is
+ * replayed from its first event irrespective of how long startup takes. */
+
+static void WaitUntilDue(uint64_t Time)
+{
+    TEST_0(pthread_mutex_lock(&StreamMutex));
+    if (!ReplayStarted)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ReplayStart);
+        ReplayOrigin = Time;
+        ReplayStarted = true;
+    }
+    TEST_0(pthread_mutex_unlock(&StreamMutex));
+
+    if (ReplaySpeed > 0  &&  Time > ReplayOrigin)
+    {
+        uint64_t Delay = (uint64_t) ((Time - ReplayOrigin) / ReplaySpeed);
+        struct timespec Due = ReplayStart;
+        Due.tv_sec += Delay / 1000000;
+        Due.tv_nsec += (Delay % 1000000) * 1000;
+        if (Due.tv_nsec >= 1000000000)
+        {
+            Due.tv_sec += 1;
+            Due.tv_nsec -= 1000000000;
+        }
+        while (clock_nanosleep(
+            CLOCK_MONOTONIC, TIMER_ABSTIME, &Due, NULL) == EINTR)
+            ;
+    }
+}
+
+
+int ReplayBlock(
+    STREAM_BLOCK Block, void * Prefix, size_t PrefixLength,
+    void * Data, size_t DataLength)
+{
+    STREAM_BLOCKS & Stream = Blocks[Block];
+    TEST_0(pthread_mutex_lock(&StreamMutex));
+    STREAM_INDEX * Index = NULL;
+    if (Stream.Next < Stream.Count)
+        Index = &Stream.Index[Stream.Next ++];
+    bool Report = Index == NULL  &&  !Stream.Exhausted;
+    if (Report)
+        Stream.Exhausted = true;
+    TEST_0(pthread_mutex_unlock(&StreamMutex));
+
+    if (Index == NULL)
+    {
+        if (Report)
+            printf("Replay of %s complete\n", BlockName[Block]);
+        if (PacedBlock[Block])
+        {
+            /* Behave like a driver with nothing more to deliver until we're
+             * told to stop. */
+            while (sem_wait(&ReplayStopped) == -1  &&  errno == EINTR)
+                ;
+            sem_post(&ReplayStopped);
+        }
+        return -1;
+    }
+
+    if (PacedBlock[Block])
+        WaitUntilDue(Index->Time);
+
+    size_t Length = Index->Length;
+    if (Length < PrefixLength)
+    {
+        printf("Replayed %s block too short\n", BlockName[Block]);
+        return -1;
+    }
+    Length -= PrefixLength;
+    if (Length > DataLength)
+        Length = DataLength;
+    bool Ok =
+        TEST_OK(pread(ReplayFile, Prefix, PrefixLength, Index->Offset) ==
+            (ssize_t) PrefixLength)  &&
+        TEST_OK(pread(ReplayFile, Data, Length,
+            Index->Offset + PrefixLength) == (ssize_t) Length);
+    return Ok ? (int) Length : -1;
+}
+
+
+
+bool InitialiseStream()
+{
+    if (CaptureFileName != NULL)
+        CapturingStream = OpenCapture();
+    else if (ReplayFileName != NULL)
+        ReplayingStream = OpenReplay();
+    else
+        return true;
+    return CapturingStream  ||  ReplayingStream;
+}
+
+
+void StopReplay()
+{
+    if (ReplayingStream)
+        sem_post(&ReplayStopped);
+}
+
+
+void TerminateStream()
+{
+    StopReplay();
+    TEST_0(pthread_mutex_lock(&StreamMutex));
+    if (CaptureFile != NULL)
+    {
+        fclose(CaptureFile);
+        CaptureFile = NULL;
+    }
+    TEST_0(pthread_mutex_unlock(&StreamMutex));
+}
@@ -0,0 +1,120 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Capture and replay of the data stream read from the Libera driver.
+ *
+ * When capture is enabled every successful read of events, turn by turn,
+ * postmortem, ADC and slow acquisition data is appended to a file together
+ * with the time it was read.  A captured file can later be replayed in place
+ * of the driver: these reads are then satisfied from the file, with events
+ * and SA updates paced to their original timing, or faster.  All other
+ * hardware access (configuration, DSC, registers) still goes to the device,
+ * so a replay is run on a Libera, but the data and trigger timing seen by
+ * the IOC are exactly those captured. */
+
+enum STREAM_BLOCK
+{
+    STREAM_EVENTS,          // Events read from the event device
+    STREAM_WAVEFORM,        // Turn by turn and decimated waveforms
+    STREAM_POSTMORTEM,      // Postmortem waveform
+    STREAM_ADC,             // ADC rate waveform
+    STREAM_SA,              // Slow acquisition update
+    STREAM_BLOCK_COUNT
+};
+
+/* A stream file starts with STREAM_MAGIC, which also identifies the format
+ * version, and each captured block follows a STREAM_HEADER.  The format is
+ * exposed here for offline tools. */
+#define STREAM_MAGIC    0x4C425332      // "LBS2"
+
+struct STREAM_HEADER
+{
+    uint32_t Block;             // STREAM_BLOCK identifier
+    uint32_t Length;            // Prefix and data length in bytes
+    uint64_t Time;              // Capture time in microseconds from start
+};
+
+/* Waveform and postmortem blocks are prefixed with the request made of the
+ * driver as well as the returned timestamp.  Turn by turn, free run and
+ * booster waveforms are all read from the same stream, so on replay each
+ * read is checked against the request that was captured. */
+struct STREAM_REQUEST
+{
+    int32_t Decimation;
+    int32_t Offset;
+    uint32_t Length;            // Waveform length requested, in rows
+};
+
+struct STREAM_WAVEFORM_PREFIX
+{
+    STREAM_REQUEST Request;
+    LIBERA_TIMESTAMP Timestamp;
+};
+
+
+/* Set by InitialiseStream() when capture or replay respectively is active. */
+extern bool CapturingStream;
+extern bool ReplayingStream;
+
+/* Selects capture of the driver data stream to the given file. */
+bool SetStreamCapture(const char * FileName);
+
+/* Selects replay instead of the driver, the option is of the form
+ *      <file>[:<speed>]
+ * where <speed> is the acceleration factor for replay, default 1.  A speed
+ * of 0 replays as fast as the IOC will consume the data. */
+bool SetStreamReplay(const char * Option);
+
+/* Opens the capture or replay file if either has been selected.  Must be
+ * called before any of the streams are read. */
+bool InitialiseStream();
+
+/* Closes any capture file so that it is complete. */
+void TerminateStream();
+
+/* Appends a block read from the driver to the capture file.  Each block is
+ * recorded as a fixed size Prefix (such as a timestamp) followed by the data
+ * itself. */
+void CaptureBlock(
+    STREAM_BLOCK Block, const void * Prefix, size_t PrefixLength,
+    const void * Data, size_t DataLength);
+
+/* Reads the next block of the given type from the replay file, returning
+ * the number of bytes of data read (which is truncated to DataLength if
+ * necessary) or -1 if the replay has nothing more of this type.  Events and
+ * SA updates are not returned until they are due; once their replay is
+ * complete these calls block, as the driver would, until StopReplay(). */
+int ReplayBlock(
+    STREAM_BLOCK Block, void * Prefix, size_t PrefixLength,
+    void * Data, size_t DataLength);
+
+/* Releases any reads blocked at the end of their replay, which will then
+ * return -1, as will all subsequent reads of completed streams.  Called on
+ * shutdown. */
+void StopReplay();
@@ -0,0 +1,343 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Multi-resolution ring archive of slow acquisition data. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <dbFldTypes.h>
+
+#include "device.h"
+#include "persistent.h"
+#include "publish.h"
+#include "hardware.h"
+#include "thread.h"
+#include "trigger.h"
+#include "arena.h"
+
+#include "saHistory.h"
+
+
+/* Each SA update is recorded as these fields in their published fixed point
+ * units: nm for X and Y, dBm * 1e6 for power and 10 nA for current. */
+enum SA_FIELD
+{
+    FIELD_A, FIELD_B, FIELD_C, FIELD_D,
+    FIELD_X, FIELD_Y, FIELD_Q, FIELD_S,
+    FIELD_POWER, FIELD_CURRENT,
+    SA_FIELD_COUNT
+};
+
+/* A single entry in a history level.  At full rate only Mean is recorded,
+ * as Min and Max would be the same. */
+struct SA_SAMPLE
+{
+    int Value[SA_FIELD_COUNT];
+};
+
+struct SA_SUMMARY
+{
+    int Min[SA_FIELD_COUNT];
+    int Mean[SA_FIELD_COUNT];
+    int Max[SA_FIELD_COUNT];
+};
+
+
+/* Each level holds a ring of entries, each of which summarises Factor
+ * entries of the previous level: the first level holds SA updates. */
+struct HISTORY_LEVEL
+{
+    int Factor;                 // Entries of previous level per entry
+    size_t Length;              // Entries in ring
+    double Period;              // Seconds per entry
+
+    SA_SAMPLE * Samples;        // Ring for full rate level
+    SA_SUMMARY * Summaries;     // Ring for decimated levels
+    size_t Next;                // Next entry to be written
+    size_t Count;               // Number of valid entries
+
+    /* Accumulator for the next summary. */
+    int Accumulated;
+    int64_t Sum[SA_FIELD_COUNT];
+    int Min[SA_FIELD_COUNT];
+    int Max[SA_FIELD_COUNT];
+};
+
+#define LEVEL(factor, length, period) \
+    { factor, length, period, NULL, NULL, 0, 0, 0, { 0 }, { 0 }, { 0 } }
+static HISTORY_LEVEL Levels[] =
+{
+    LEVEL(1,   36000, 0.1),     // 10Hz for one hour
+    LEVEL(100,  8640, 10),      // 10 seconds for one day
+    LEVEL(30,   2880, 300),     // 5 minutes for ten days
+};
+#undef LEVEL
+#define LEVEL_COUNT     ARRAY_SIZE(Levels)
+
+/* Serialises recording from the SA thread against readout. */
+static pthread_mutex_t HistoryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void ResetAccumulator(HISTORY_LEVEL & Level)
+{
+    Level.Accumulated = 0;
+    for (int i = 0; i < SA_FIELD_COUNT; i ++)
+    {
+        Level.Sum[i] = 0;
+        Level.Min[i] = INT_MAX;
+        Level.Max[i] = INT_MIN;
+    }
+}
+
+
+/* Folds one summary into the accumulator for the given decimated level,
+ * writing a new entry (and feeding the next level) when complete. */
+
+static void Accumulate(size_t Index, const SA_SUMMARY & Summary)
+{
+    HISTORY_LEVEL & Level = Levels[Index];
+    for (int i = 0; i < SA_FIELD_COUNT; i ++)
+    {
+        Level.Sum[i] += Summary.Mean[i];
+        if (Summary.Min[i] < Level.Min[i])  Level.Min[i] = Summary.Min[i];
+        if (Summary.Max[i] > Level.Max[i])  Level.Max[i] = Summary.Max[i];
+    }
+
+    Level.Accumulated += 1;
+    if (Level.Accumulated == Level.Factor)
+    {
+        SA_SUMMARY & Entry = Level.Summaries[Level.Next];
+        for (int i = 0; i < SA_FIELD_COUNT; i ++)
+        {
+            Entry.Min[i] = Level.Min[i];
+            Entry.Mean[i] = (int) (Level.Sum[i] / Level.Factor);
+            Entry.Max[i] = Level.Max[i];
+        }
+        Level.Next = (Level.Next + 1) % Level.Length;
+        if (Level.Count < Level.Length)
+            Level.Count += 1;
+        ResetAccumulator(Level);
+
+        if (Index + 1 < LEVEL_COUNT)
+            Accumulate(Index + 1, Entry);
+    }
+}
+
+
+void RecordSaHistory(
+    const ABCD_ROW &ABCD, const XYQS_ROW &XYQS, int Power, int Current)
+{
+    SA_SUMMARY Summary;
+    int * Value = Summary.Mean;
+    Value[FIELD_A] = ABCD.A;
+    Value[FIELD_B] = ABCD.B;
+    Value[FIELD_C] = ABCD.C;
+    Value[FIELD_D] = ABCD.D;
+    Value[FIELD_X] = XYQS.X;
+    Value[FIELD_Y] = XYQS.Y;
+    Value[FIELD_Q] = XYQS.Q;
+    Value[FIELD_S] = XYQS.S;
+    Value[FIELD_POWER] = Power;
+    Value[FIELD_CURRENT] = Current;
+    memcpy(Summary.Min, Value, sizeof(Summary.Min));
+    memcpy(Summary.Max, Value, sizeof(Summary.Max));
+
+    TEST_0(pthread_mutex_lock(&HistoryMutex));
+    HISTORY_LEVEL & Level = Levels[0];
+    memcpy(Level.Samples[Level.Next].Value, Value, sizeof(SA_SAMPLE));
+    Level.Next = (Level.Next + 1) % Level.Length;
+    if (Level.Count < Level.Length)
+        Level.Count += 1;
+    Accumulate(1, Summary);
+    TEST_0(pthread_mutex_unlock(&HistoryMutex));
+}
+
+
+
+/* Waveform of SA_HISTORY_READOUT points of which only the points filled by
+ * the last readout are returned. */
+
+template<class T>
+class HISTORY_WAVEFORM : public I_WAVEFORM
+{
+public:
+    HISTORY_WAVEFORM(epicsEnum16 Type, const size_t & Points) :
+        I_WAVEFORM(Type),
+        Data(ArenaNew<T>(SA_HISTORY_READOUT)),
+        Points(Points)
+    {
+    }
+
+    T * const Data;
+
+private:
+    bool process(void *array, size_t max_length, size_t &new_length)
+    {
+        new_length = Points < max_length ? Points : max_length;
+        memcpy(array, Data, sizeof(T) * new_length);
+        return true;
+    }
+
+    const size_t & Points;
+};
+
+
+class SA_HISTORY
+{
+public:
+    SA_HISTORY() :
+        Min(DBF_LONG, Points),
+        Mean(DBF_LONG, Points),
+        Max(DBF_LONG, Points),
+        Time(DBF_FLOAT, Points)
+    {
+        Level = 0;
+        Field = FIELD_X;
+        Window = 600;
+        Points = 0;
+
+        PUBLISH_METHOD_OUT(mbbo, "SA:HIST:LEVEL", SetLevel, Level);
+        PUBLISH_METHOD_OUT(mbbo, "SA:HIST:FIELD", SetField, Field);
+        PUBLISH_METHOD_OUT(longout, "SA:HIST:WINDOW", SetWindow, Window);
+        PUBLISH_METHOD_ACTION("SA:HIST:READ", Readout);
+
+        Publish_waveform("SA:HIST:MIN", Min);
+        Publish_waveform("SA:HIST:MEAN", Mean);
+        Publish_waveform("SA:HIST:MAX", Max);
+        Publish_waveform("SA:HIST:T", Time);
+        Interlock.Publish("SA:HIST");
+    }
+
+private:
+    SA_HISTORY(const SA_HISTORY &);
+
+    bool SetLevel(int NewLevel)
+    {
+        if (0 <= NewLevel  &&  NewLevel < (int) LEVEL_COUNT)
+        {
+            Level = NewLevel;
+            return Readout();
+        }
+        else
+            return false;
+    }
+
+    bool SetField(int NewField)
+    {
+        if (0 <= NewField  &&  NewField < SA_FIELD_COUNT)
+        {
+            Field = NewField;
+            return Readout();
+        }
+        else
+            return false;
+    }
+
+    bool SetWindow(int NewWindow)
+    {
+        if (NewWindow > 0)
+        {
+            Window = NewWindow;
+            return Readout();
+        }
+        else
+            return false;
+    }
+
+
+    /* Copies the most recent Window seconds of the selected field at the
+     * selected resolution into the readout waveforms.  The time axis is in
+     * seconds relative to the most recent entry. */
+    bool Readout()
+    {
+        Interlock.Wait();
+
+        TEST_0(pthread_mutex_lock(&HistoryMutex));
+        const HISTORY_LEVEL & History = Levels[Level];
+        size_t Wanted = (size_t) (Window / History.Period);
+        Points = History.Count;
+        if (Points > Wanted)  Points = Wanted;
+        if (Points > SA_HISTORY_READOUT)  Points = SA_HISTORY_READOUT;
+
+        size_t Index = (History.Next + History.Length - Points) %
+            History.Length;
+        for (size_t i = 0; i < Points; i ++)
+        {
+            if (History.Samples != NULL)
+            {
+                int Value = History.Samples[Index].Value[Field];
+                Min.Data[i] = Mean.Data[i] = Max.Data[i] = Value;
+            }
+            else
+            {
+                const SA_SUMMARY & Summary = History.Summaries[Index];
+                Min.Data[i] = Summary.Min[Field];
+                Mean.Data[i] = Summary.Mean[Field];
+                Max.Data[i] = Summary.Max[Field];
+            }
+            Time.Data[i] = - (float) ((Points - 1 - i) * History.Period);
+            Index = (Index + 1) % History.Length;
+        }
+        TEST_0(pthread_mutex_unlock(&HistoryMutex));
+
+        Interlock.Ready();
+        return true;
+    }
+
+
+    HISTORY_WAVEFORM<int> Min, Mean, Max;
+    HISTORY_WAVEFORM<float> Time;
+    INTERLOCK Interlock;
+
+    int Level;              // Selected history level
+    int Field;              // Selected SA_FIELD
+    int Window;             // Readout window in seconds
+    size_t Points;          // Points in last readout
+};
+
+
+bool InitialiseSaHistory()
+{
+    for (size_t i = 0; i < LEVEL_COUNT; i ++)
+    {
+        HISTORY_LEVEL & Level = Levels[i];
+        if (i == 0)
+            Level.Samples = ArenaNew<SA_SAMPLE>(Level.Length);
+        else
+            Level.Summaries = ArenaNew<SA_SUMMARY>(Level.Length);
+        ResetAccumulator(Level);
+    }
+    new SA_HISTORY;
+    return true;
+}
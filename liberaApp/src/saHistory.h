@@ -0,0 +1,44 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* In-IOC archive of slow acquisition history.
+ *
+ * Every SA update is recorded at full rate for the last hour, and reduced
+ * to min/mean/max summaries over 10 seconds for the last day and over 5
+ * minutes for the last ten days.  Any window of any one field can be read
+ * out through the SA:HIST: waveforms without an external archiver. */
+
+/* Maximum number of points read out from the history in one go. */
+#define SA_HISTORY_READOUT  36000
+
+bool InitialiseSaHistory();
+
+/* Records a single SA update.  Called from the SA thread at 10Hz. */
+void RecordSaHistory(
+    const ABCD_ROW &ABCD, const XYQS_ROW &XYQS, int Power, int Current);
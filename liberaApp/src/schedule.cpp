@@ -0,0 +1,312 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Real time scheduling policy for IOC threads. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "hardware.h"
+#include "device.h"
+#include "publish.h"
+
+#include "schedule.h"
+
+
+/* When stack locking is requested this much of the stack below the thread's
+ * starting point is faulted in and locked.  Thread stacks are nominally very
+ * large, so we don't try to lock the whole thing. */
+#define STACK_LOCK_SIZE     (64 * 1024)
+
+
+struct THREAD_POLICY
+{
+    const char * Id;            // Name used for PVs and on the command line
+    const char * Name;          // Name of the THREAD instance
+
+    /* Requested policy. */
+    int Priority;               // SCHED_FIFO priority, 0 for normal policy
+    unsigned int Cpus;          // CPU affinity mask, 0 to leave unchanged
+    bool LockStack;
+
+    /* Policy as actually applied, and latency statistics. */
+    EPICS_STRING Policy;
+    int MaxLatency;             // Worst latency since last update in us
+    int Jitter;                 // Published worst latency in us
+};
+
+/* The threads with a configurable policy.  The event receiver and dispatcher
+ * are the threads where latency is most likely to cost us events. */
+#define POLICY(id, name)    { id, name, 0, 0, false, "Not running", 0, 0 }
+static THREAD_POLICY Policies[] =
+{
+    POLICY("EVENTS",    "EVENT_RECEIVER"),
+    POLICY("DISPATCH",  "EVENT_DISPATCHER"),
+    POLICY("SC",        "Conditioning"),
+    POLICY("SA",        "SLOW_ACQUISITION"),
+    POLICY("SENSORS",   "Sensors"),
+    POLICY("PERSIST",   "TIMER_THREAD"),
+};
+#undef POLICY
+
+
+/* Latency statistics are updated by each thread and read by the sensors
+ * thread, so are guarded by this mutex. */
+static pthread_mutex_t LatencyMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Each scheduled thread records its policy entry here so that latencies can
+ * be recorded against it. */
+static pthread_key_t PolicyKey;
+static pthread_once_t PolicyKeyOnce = PTHREAD_ONCE_INIT;
+
+static void CreatePolicyKey()
+{
+    TEST_0(pthread_key_create(&PolicyKey, NULL));
+}
+
+
+static THREAD_POLICY * FindPolicy(const char * Name, size_t Length)
+{
+    for (unsigned int i = 0; i < ARRAY_SIZE(Policies); i ++)
+    {
+        THREAD_POLICY &Policy = Policies[i];
+        if ((strncmp(Policy.Id, Name, Length) == 0  &&
+             Policy.Id[Length] == '\0')  ||
+            (strncmp(Policy.Name, Name, Length) == 0  &&
+             Policy.Name[Length] == '\0'))
+            return &Policy;
+    }
+    return NULL;
+}
+
+
+static bool ParseSetting(THREAD_POLICY &Policy, const char * Setting)
+{
+    char * End;
+    if (strncmp(Setting, "fifo=", 5) == 0)
+    {
+        int Priority = strtol(Setting + 5, &End, 0);
+        int Min = sched_get_priority_min(SCHED_FIFO);
+        int Max = sched_get_priority_max(SCHED_FIFO);
+        if (End == Setting + 5  ||  (*End != '\0'  &&  *End != ',')  ||
+            Priority < Min  ||  Max < Priority)
+        {
+            printf("FIFO priority must be in range %d to %d\n", Min, Max);
+            return false;
+        }
+        Policy.Priority = Priority;
+    }
+    else if (strncmp(Setting, "other", 5) == 0  &&
+             (Setting[5] == '\0'  ||  Setting[5] == ','))
+        Policy.Priority = 0;
+    else if (strncmp(Setting, "cpus=", 5) == 0)
+    {
+        Policy.Cpus = strtoul(Setting + 5, &End, 0);
+        if (End == Setting + 5  ||  (*End != '\0'  &&  *End != ','))
+        {
+            printf("Malformed CPU mask in \"%s\"\n", Setting);
+            return false;
+        }
+    }
+    else if (strncmp(Setting, "lock", 4) == 0  &&
+             (Setting[4] == '\0'  ||  Setting[4] == ','))
+        Policy.LockStack = true;
+    else
+    {
+        printf("Unknown thread policy setting \"%s\"\n", Setting);
+        return false;
+    }
+    return true;
+}
+
+
+bool ParseThreadPolicy(const char * Option)
+{
+    const char * Colon = strchr(Option, ':');
+    THREAD_POLICY * Policy =
+        Colon == NULL ? NULL : FindPolicy(Option, Colon - Option);
+    if (Policy == NULL)
+    {
+        printf("Thread policy \"%s\" should start with one of:", Option);
+        for (unsigned int i = 0; i < ARRAY_SIZE(Policies); i ++)
+            printf(" %s:", Policies[i].Id);
+        printf("\n");
+        return false;
+    }
+
+    bool Ok = true;
+    for (const char * Setting = Colon + 1; Ok  &&  Setting != NULL;
+         Setting = strchr(Setting, ','))
+    {
+        if (*Setting == ',')
+            Setting += 1;
+        Ok = ParseSetting(*Policy, Setting);
+    }
+    return Ok;
+}
+
+
+
+/* Faults in and locks the stack immediately below the caller. */
+
+static bool LockStack()
+{
+    char Here;
+    uintptr_t PageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t Top = ((uintptr_t) &Here + PageSize - 1) & ~(PageSize - 1);
+    return TEST_IO(mlock((void *) (Top - STACK_LOCK_SIZE), STACK_LOCK_SIZE));
+}
+
+
+/* Reads back the policy actually in force for the calling thread and formats
+ * it for display. */
+
+static void FormatPolicy(THREAD_POLICY &Policy, bool Locked)
+{
+    int SchedPolicy;
+    struct sched_param Param;
+    int Length;
+    if (TEST_0(pthread_getschedparam(pthread_self(), &SchedPolicy, &Param)))
+        Length = snprintf(Policy.Policy, sizeof(EPICS_STRING), "%s %d",
+            SchedPolicy == SCHED_FIFO ? "FIFO" :
+            SchedPolicy == SCHED_RR ? "RR" : "OTHER",
+            Param.sched_priority);
+    else
+        Length = snprintf(Policy.Policy, sizeof(EPICS_STRING), "Unknown");
+
+#ifdef CPU_SET
+    cpu_set_t CpuSet;
+    if (Policy.Cpus != 0  &&  Length < (int) sizeof(EPICS_STRING)  &&
+        TEST_0(pthread_getaffinity_np(
+            pthread_self(), sizeof(CpuSet), &CpuSet)))
+    {
+        unsigned int Cpus = 0;
+        for (int i = 0; i < 32; i ++)
+            if (CPU_ISSET(i, &CpuSet))
+                Cpus |= 1U << i;
+        Length += snprintf(Policy.Policy + Length,
+            sizeof(EPICS_STRING) - Length, " cpus=0x%x", Cpus);
+    }
+#endif
+
+    if (Locked  &&  Length < (int) sizeof(EPICS_STRING))
+        snprintf(Policy.Policy + Length,
+            sizeof(EPICS_STRING) - Length, " locked");
+}
+
+
+void ApplyThreadPolicy(const char * Name)
+{
+    THREAD_POLICY * Policy = FindPolicy(Name, strlen(Name));
+    if (Policy == NULL)
+        return;
+
+    if (Policy->Priority > 0)
+    {
+        struct sched_param Param;
+        Param.sched_priority = Policy->Priority;
+        TEST_0(pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param));
+    }
+
+    if (Policy->Cpus != 0)
+    {
+#ifdef CPU_SET
+        cpu_set_t CpuSet;
+        CPU_ZERO(&CpuSet);
+        for (int i = 0; i < 32; i ++)
+            if (Policy->Cpus & (1U << i))
+                CPU_SET(i, &CpuSet);
+        TEST_0(pthread_setaffinity_np(
+            pthread_self(), sizeof(CpuSet), &CpuSet));
+#else
+        printf("CPU affinity not supported for thread %s\n", Name);
+#endif
+    }
+
+    bool Locked = Policy->LockStack  &&  LockStack();
+    FormatPolicy(*Policy, Locked);
+
+    TEST_0(pthread_once(&PolicyKeyOnce, CreatePolicyKey));
+    TEST_0(pthread_setspecific(PolicyKey, Policy));
+}
+
+
+void RecordWakeupLatency(const struct timespec &Due)
+{
+    TEST_0(pthread_once(&PolicyKeyOnce, CreatePolicyKey));
+    THREAD_POLICY * Policy = (THREAD_POLICY *) pthread_getspecific(PolicyKey);
+    if (Policy == NULL)
+        return;
+
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    int64_t Latency =
+        (int64_t) (Now.tv_sec - Due.tv_sec) * 1000000 +
+        (Now.tv_nsec - Due.tv_nsec) / 1000;
+    /* Early wakeups are ignored, as MaxLatency is never below zero, and
+     * absurdly long ones are clamped to what we can publish. */
+    if (Latency > INT_MAX)
+        Latency = INT_MAX;
+
+    TEST_0(pthread_mutex_lock(&LatencyMutex));
+    if (Latency > Policy->MaxLatency)
+        Policy->MaxLatency = (int) Latency;
+    TEST_0(pthread_mutex_unlock(&LatencyMutex));
+}
+
+
+void UpdateThreadJitter()
+{
+    TEST_0(pthread_mutex_lock(&LatencyMutex));
+    for (unsigned int i = 0; i < ARRAY_SIZE(Policies); i ++)
+    {
+        Policies[i].Jitter = Policies[i].MaxLatency;
+        Policies[i].MaxLatency = 0;
+    }
+    TEST_0(pthread_mutex_unlock(&LatencyMutex));
+}
+
+
+bool InitialiseThreadPolicy()
+{
+    for (unsigned int i = 0; i < ARRAY_SIZE(Policies); i ++)
+    {
+        THREAD_POLICY &Policy = Policies[i];
+        Publish_stringin(Concat("SE:SCHED_", Policy.Id), Policy.Policy);
+        Publish_ai(Concat("SE:JITTER_", Policy.Id), Policy.Jitter);
+    }
+    return true;
+}
@@ -0,0 +1,63 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Real time scheduling policy for IOC threads.
+ *
+ * A small set of time critical threads can be given a scheduling policy from
+ * the command line: a SCHED_FIFO priority, a CPU affinity mask, and whether
+ * the thread's stack is locked into memory.  The wakeup latency of each of
+ * these threads is measured at every blocking SEMAPHORE wait, and both the
+ * policy and the worst latency are published as PVs. */
+
+/* Parses a policy option of the form
+ *      <thread>:<setting>[,<setting>]*
+ * where <thread> names one of the scheduled threads and <setting> is one of
+ *      fifo=<priority>     Run under SCHED_FIFO at the given priority
+ *      other               Run under the normal time sharing policy
+ *      cpus=<mask>         Restrict thread to the given set of CPUs
+ *      lock                Lock the thread's stack into memory
+ * Must be called before the thread is started. */
+bool ParseThreadPolicy(const char * Option);
+
+/* Publishes the policy and jitter PVs. */
+bool InitialiseThreadPolicy();
+
+/* Called on each new thread before its body is run: applies any configured
+ * scheduling policy and enables latency measurement if this thread is one of
+ * the scheduled threads. */
+void ApplyThreadPolicy(const char * Name);
+
+/* Called after a wait has blocked the calling thread with the time at which
+ * it was due to wake (either when it was signalled or when its timeout
+ * expired), measured against CLOCK_MONOTONIC. */
+void RecordWakeupLatency(const struct timespec &Due);
+
+/* Updates the published jitter from the latencies recorded since the last
+ * update.  Called at each sensors poll. */
+void UpdateThreadJitter();
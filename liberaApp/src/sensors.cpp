@@ -31,6 +31,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <math.h>
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -40,6 +42,16 @@
 #include <unistd.h>
 #include <fts.h>
 #include <stdint.h>
+#include <features.h>
+
+/* inotify is used to avoid rescanning the ram file systems when nothing has
+ * changed, but is only available from glibc 2.4 onwards. */
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 4)
+#include <sys/inotify.h>
+#define RAMFS_INOTIFY
+#endif
+#endif
 
 extern "C" {
 #include <rsrv.h>
@@ -53,6 +65,7 @@ extern "C" {
 #include "trigger.h"
 #include "versions.h"
 #include "healthd.h"
+#include "schedule.h"
 
 #include "sensors.h"
 
@@ -107,36 +120,173 @@ static bool UseSys;
 static char ** RamFileSystems;      // List of file systems to scan for files
 
 
-/* Helper routine for using scanf to parse a file. */
 
-static bool ParseFile(
-    const char * Filename, int Count, const char * Format, ...)
-    __attribute__((format(scanf, 3, 4)));
-static bool ParseFile(
-    const char * Filename, int Count, const char * Format, ...)
+/*****************************************************************************/
+/*                                                                           */
+/*                           Sampled File Parsing                            */
+/*                                                                           */
+/*****************************************************************************/
+
+/* All of the /proc and /sys files we sample are opened once at startup and
+ * then reread on each poll with pread() into a fixed buffer on the stack.
+ * Reading these files from offset zero regenerates their contents, so this
+ * avoids repeating the open, stdio buffer allocation and scanf parsing that
+ * would otherwise be done on every poll. */
+
+static int ProcUptime = -1;
+static int ProcMeminfo = -1;
+static int ProcNetDev = -1;
+static int TempRf1 = -1, TempRf2 = -1, TempMb = -1;
+static int Fan0 = -1, Fan1 = -1, Fan0Set = -1, Fan1Set = -1;
+
+
+static void OpenSampledFile(int &Sample, const char * Name)
 {
-    FILE * input;
-    bool Ok = TEST_NULL(input = fopen(Filename, "r"));
+    TEST_IO(Sample = open(Name, O_RDONLY));
+}
+
+
+/* Reads the entire sampled file into the given buffer, which is always null
+ * terminated.  Files longer than the buffer are truncated. */
+
+static bool ReadSampledFile(int Sample, char * Buffer, size_t Length)
+{
+    ssize_t Count = 0;
+    bool Ok =
+        Sample != -1  &&
+        TEST_IO(Count = pread(Sample, Buffer, Length - 1, 0));
+    Buffer[Ok ? Count : 0] = '\0';
+    return Ok;
+}
+
+
+/* The following parsers work through a null terminated buffer by advancing
+ * the given cursor, returning false if the expected field is not found. */
+
+static void SkipBlanks(const char * &Cursor)
+{
+    while (*Cursor == ' '  ||  *Cursor == '\t')
+        Cursor ++;
+}
+
+static bool IsDigit(char Char)
+{
+    return '0' <= Char  &&  Char <= '9';
+}
+
+static bool ParseUnsigned(const char * &Cursor, uint64_t &Result)
+{
+    SkipBlanks(Cursor);
+    if (!IsDigit(*Cursor))
+        return false;
+    Result = 0;
+    while (IsDigit(*Cursor))
+        Result = 10 * Result + (*Cursor++ - '0');
+    return true;
+}
+
+static bool ParseInt(const char * &Cursor, int &Result)
+{
+    SkipBlanks(Cursor);
+    bool Negative = *Cursor == '-';
+    if (Negative)
+        Cursor ++;
+    uint64_t Value;
+    bool Ok = ParseUnsigned(Cursor, Value);
+    if (Ok)
+        Result = Negative ? - (int) Value : (int) Value;
+    return Ok;
+}
+
+/* Parses numbers of the form <integer>.<fraction> as found in /proc/uptime. */
+static bool ParseDecimal(const char * &Cursor, double &Result)
+{
+    uint64_t Whole;
+    bool Ok = ParseUnsigned(Cursor, Whole);
     if (Ok)
     {
-        va_list args;
-        va_start(args, Format);
-        Ok = TEST_OK(vfscanf(input, Format, args) == Count);
-        fclose(input);
+        Result = (double) Whole;
+        if (*Cursor == '.')
+        {
+            Cursor ++;
+            for (double Scale = 0.1; IsDigit(*Cursor); Scale *= 0.1)
+                Result += Scale * (*Cursor++ - '0');
+        }
+    }
+    return Ok;
+}
+
+/* Skips the given number of blank separated fields. */
+static bool SkipFields(const char * &Cursor, int Count)
+{
+    for (int i = 0; i < Count; i ++)
+    {
+        SkipBlanks(Cursor);
+        if (*Cursor == '\0'  ||  *Cursor == '\n')
+            return false;
+        while (*Cursor != '\0'  &&  *Cursor != '\n'  &&
+               *Cursor != ' '  &&  *Cursor != '\t')
+            Cursor ++;
     }
+    return true;
+}
+
+static bool ParseChar(const char * &Cursor, char Char)
+{
+    bool Ok = *Cursor == Char;
+    if (Ok)
+        Cursor ++;
     return Ok;
 }
 
+/* Searches the buffer for a line starting with the given prefix, returning
+ * a cursor just past the prefix if found, otherwise NULL. */
+static const char * FindLine(const char * Buffer, const char * Prefix)
+{
+    const size_t PrefixLength = strlen(Prefix);
+    for (const char * Line = Buffer; Line != NULL; )
+    {
+        if (strncmp(Line, Prefix, PrefixLength) == 0)
+            return Line + PrefixLength;
+        Line = strchr(Line, '\n');
+        if (Line != NULL)
+            Line ++;
+    }
+    return NULL;
+}
+
+
+/* Reads a file containing a single integer, as used for most of the sensor
+ * readings under /sys. */
+static bool ReadSampledInt(int Sample, int &Result)
+{
+    char Buffer[64];
+    const char * Cursor = Buffer;
+    return
+        ReadSampledFile(Sample, Buffer, sizeof(Buffer))  &&
+        TEST_OK(ParseInt(Cursor, Result));
+}
+
 
 
 /* Total uptime and idle time can be read directly from /proc/uptime, and by
  * keeping track of the cumulative idle time we can report percentage CPU
  * usage over the scan period. */
 
+static bool ReadUptime(double &Uptime, double &Idle)
+{
+    char Buffer[64];
+    const char * Cursor = Buffer;
+    return
+        ReadSampledFile(ProcUptime, Buffer, sizeof(Buffer))  &&
+        TEST_OK(ParseDecimal(Cursor, Uptime)  &&  ParseDecimal(Cursor, Idle));
+}
+
+
 static void ProcessUptimeAndIdle()
 {
     double NewUptime, NewIdle;
-    if (ParseFile("/proc/uptime", 2, "%lf %lf", &NewUptime, &NewIdle))
+    if (ReadUptime(NewUptime, NewIdle))
     {
         Uptime = int(NewUptime);
 
@@ -153,7 +303,79 @@ static void ProcessUptimeAndIdle()
 
 static void InitialiseUptime()
 {
-    ParseFile("/proc/uptime", 1, "%lf", &EpicsStarted);
+    double Idle;
+    ReadUptime(EpicsStarted, Idle);
+}
+
+
+/* This discovers how many bytes of space are being consumed by the ramfs:
+ * this needs to be subtracted from the "cached" space.
+ *
+ * We do this by walking all of the file systems mounted as ramfs -- the
+ * actual set of mount points must be set in TEMP_FS_LIST.  The ramfs does
+ * not maintain any statfs block counts, so walking the tree is the only
+ * option; however, where inotify is available we place a watch on every
+ * directory walked and only repeat the walk when something has changed. */
+
+static int RamfsNotify = -1;        // inotify handle, -1 if not available
+
+
+static int WalkRamfs()
+{
+    FTS * fts;
+    if (TEST_NULL(fts = fts_open(
+            RamFileSystems, FTS_PHYSICAL | FTS_XDEV, NULL)))
+    {
+        int total = 0;
+        FTSENT *ftsent;
+        while (ftsent = fts_read(fts),  ftsent != NULL)
+        {
+            if (ftsent->fts_info != FTS_D)
+                total += ftsent->fts_statp->st_size;
+#ifdef RAMFS_INOTIFY
+            else if (RamfsNotify != -1  &&
+                inotify_add_watch(RamfsNotify, ftsent->fts_accpath,
+                    IN_MODIFY | IN_CREATE | IN_DELETE |
+                    IN_MOVED_FROM | IN_MOVED_TO) == -1)
+            {
+                /* Most likely we've run out of watches: give up on watching
+                 * and fall back to walking every time. */
+                printf("Unable to watch ramfs, reverting to polling\n");
+                close(RamfsNotify);
+                RamfsNotify = -1;
+            }
+#endif
+        }
+        fts_close(fts);
+        return total;
+    }
+    else
+        return 0;
+}
+
+
+/* Drains any pending notifications, returning true if there were any.
+ * Overflow and removed watches also generate notifications, so we err on the
+ * side of walking again. */
+
+static bool RamfsChanged()
+{
+    bool Changed = false;
+#ifdef RAMFS_INOTIFY
+    char Events[1024];
+    while (read(RamfsNotify, Events, sizeof(Events)) > 0)
+        Changed = true;
+#endif
+    return Changed;
+}
+
+
+static int FindRamfsUsage()
+{
+    static int Total = -1;
+    if (Total < 0  ||  RamfsNotify == -1  ||  RamfsChanged())
+        Total = WalkRamfs();
+    return Total;
 }
 
 
@@ -183,62 +405,42 @@ static bool InitialiseRamfsUsage()
             ramfs_list += strlen(ramfs_list) + 1;
         }
         RamFileSystems[ramfs_count] = NULL;
-    }
-    return Ok;
-}
 
-/* This discovers how many bytes of space are being consumed by the ramfs:
- * this needs to be subtracted from the "cached" space.
- *
- * We do this by walking all of the file systems mounted as ramfs -- the
- * actual set of mount points must be set in TEMP_FS_LIST. */
-
-static int FindRamfsUsage()
-{
-    FTS * fts;
-    if (TEST_NULL(fts = fts_open(
-            RamFileSystems, FTS_PHYSICAL | FTS_XDEV, NULL)))
-    {
-        int total = 0;
-        FTSENT *ftsent;
-        while (ftsent = fts_read(fts),  ftsent != NULL)
-            if (ftsent->fts_info != FTS_D)
-                total += ftsent->fts_statp->st_size;
-        fts_close(fts);
-        return total;
+#ifdef RAMFS_INOTIFY
+        /* Failure here is not an error: on older kernels we just walk the
+         * ram file systems on every poll. */
+        RamfsNotify = inotify_init();
+        if (RamfsNotify != -1)
+            TEST_IO(fcntl(RamfsNotify, F_SETFL, O_NONBLOCK));
+#endif
     }
-    else
-        return 0;
+    return Ok;
 }
 
 
 
 /* This helper routine is used to read a specific line from the /proc/meminfo
- * file: it scans for a line of the form
+ * buffer: it scans for a line of the form
  *      <Prefix>   <Result> kB
  * and returns the integer result. */
 
-static bool ReadMeminfoLine(FILE *MemInfo, const char *Prefix, int &Result)
+static bool ReadMeminfoLine(
+    const char *MemInfo, const char *Prefix, int &Result)
 {
-    const int PrefixLength = strlen(Prefix);
-    char Line[1024];
-    while (fgets(Line, sizeof(Line), MemInfo))
+    const char * Cursor = FindLine(MemInfo, Prefix);
+    if (Cursor == NULL)
     {
-        if (strncmp(Line, Prefix, PrefixLength) == 0)
-        {
-            /* Good: this is our line. */
-            if (sscanf(Line + PrefixLength, " %d ", &Result) == 1)
-                return true;
-            else
-            {
-                printf("Malformed /proc/meminfo line:\n\t\"%s\"\n", Line);
-                return false;
-            }
-        }
+        /* Oops.  Couldn't find anything. */
+        printf("Unable to find \"%s\" line in /proc/meminfo\n", Prefix);
+        return false;
+    }
+    else if (ParseInt(Cursor, Result))
+        return true;
+    else
+    {
+        printf("Malformed /proc/meminfo line for \"%s\"\n", Prefix);
+        return false;
     }
-    /* Oops.  Couldn't find anything. */
-    printf("Unable to find \"%s\" line in /proc/meminfo\n", Prefix);
-    return false;
 }
 
 
@@ -252,42 +454,49 @@ static bool ReadMeminfoLine(FILE *MemInfo, const char *Prefix, int &Result)
 
 static void ProcessFreeMemory()
 {
-    FILE * MemInfo;
-    if (TEST_NULL(MemInfo = fopen("/proc/meminfo", "r")))
+    char MemInfo[2048];
+    int Free, Cached;
+    if (ReadSampledFile(ProcMeminfo, MemInfo, sizeof(MemInfo))  &&
+        ReadMeminfoLine(MemInfo, "MemFree:", Free)  &&
+        ReadMeminfoLine(MemInfo, "Cached:",  Cached))
     {
-        int Free, Cached;
-        if (ReadMeminfoLine(MemInfo, "MemFree:", Free)  &&
-            ReadMeminfoLine(MemInfo, "Cached:",  Cached))
-        {
-            RamfsUsage = FindRamfsUsage();
-            MemoryFree = 1024 * (Free + Cached) - RamfsUsage;
-        }
-        fclose(MemInfo);
+        RamfsUsage = FindRamfsUsage();
+        MemoryFree = 1024 * (Free + Cached) - RamfsUsage;
     }
 }
 
 
-static void ReadTemperature(const char * sensor, int *result)
+static void ReadTemperature(int sensor, int *result)
 {
     /* Annoyingly the format of the temperature readout depends on which
      * system version we're using! */
-    ParseFile(sensor, 1, UseSys ? "%d" : "%*d %*d %d", result);
-    if (UseSys)
+    char Buffer[64];
+    const char * Cursor = Buffer;
+    if (ReadSampledFile(sensor, Buffer, sizeof(Buffer))  &&
+        TEST_OK((UseSys  ||  SkipFields(Cursor, 2))  &&
+            ParseInt(Cursor, *result))  &&
+        UseSys)
         *result /= 1000;
 }
 
 /* The second RF board sensor is read differently.  We return the result in
  * millidegrees, and the layout of the data in the /proc node is completely
  * different! */
-static void ReadTemperatureRF2(const char * sensor, int *result)
+static void ReadTemperatureRF2(int sensor, int *result)
 {
     if (UseSys)
-        ParseFile(sensor, 1, "%d", result);
+        ReadSampledInt(sensor, *result);
     else
     {
+        char Buffer[64];
+        const char * Cursor = Buffer;
         int degrees, millidegrees;
-        ParseFile(sensor, 2, "%*s %*s %*s %d.%d", &degrees, &millidegrees);
-        *result = 1000 * degrees + millidegrees;
+        if (ReadSampledFile(sensor, Buffer, sizeof(Buffer))  &&
+            TEST_OK(
+                SkipFields(Cursor, 3)  &&
+                ParseInt(Cursor, degrees)  &&  ParseChar(Cursor, '.')  &&
+                ParseInt(Cursor, millidegrees)))
+            *result = 1000 * degrees + millidegrees;
     }
 }
 
@@ -311,15 +520,15 @@ static void ReadHealth()
     {
         /* Only read the RF sensors if we're running Brilliance, as otherwise
          * it's disabled as it disturbs the position measurement too much. */
-        ReadTemperature(proc_temp_rf1, &RfTemperature1);
-        ReadTemperatureRF2(proc_temp_rf2, &RfTemperature2);
+        ReadTemperature(TempRf1, &RfTemperature1);
+        ReadTemperatureRF2(TempRf2, &RfTemperature2);
     }
-    ReadTemperature(proc_temp_mb, &MbTemperature);
+    ReadTemperature(TempMb, &MbTemperature);
 
-    ParseFile(proc_fan0,     1, "%d", &FanSpeeds[0]);
-    ParseFile(proc_fan1,     1, "%d", &FanSpeeds[1]);
-    ParseFile(proc_fan0_set, 1, "%d", &FanSetSpeeds[0]);
-    ParseFile(proc_fan1_set, 1, "%d", &FanSetSpeeds[1]);
+    ReadSampledInt(Fan0,    FanSpeeds[0]);
+    ReadSampledInt(Fan1,    FanSpeeds[1]);
+    ReadSampledInt(Fan0Set, FanSetSpeeds[0]);
+    ReadSampledInt(Fan1Set, FanSetSpeeds[1]);
 
     /* The system voltages are read directly from the msp device in binary
      * format.  This particular step takes a surprisingly long time (about
@@ -351,30 +560,38 @@ static uint64_t NetBytesRxLast, NetPacketsRxLast, NetMultiRxLast;
 static uint64_t NetBytesTxLast, NetPacketsTxLast, NetMultiTxLast;
 
 
+/* Finds the statistics for eth0.  A missing interface isn't going to appear
+ * later, so we only report its absence the first time. */
+static const char * FindEth0(const char * Buffer)
+{
+    static bool Reported = false;
+    const char * Cursor = FindLine(Buffer, "  eth0:");
+    if (Cursor == NULL  &&  !Reported)
+    {
+        printf("eth0 not found in /proc/net/dev\n");
+        Reported = true;
+    }
+    return Cursor;
+}
+
 static bool ReadNetworkStats(
     uint64_t &NetBytesRx, uint64_t &NetPacketsRx, uint64_t &NetMultiRx,
     uint64_t &NetBytesTx, uint64_t &NetPacketsTx, uint64_t &NetMultiTx)
 {
-    FILE * input;
-    bool Ok = false;
-    if (TEST_NULL(input = fopen("/proc/net/dev", "r")))
-    {
-        char line[1024];
-        while (fgets(line, sizeof(line), input))
-        {
-            if (strncmp(line, "  eth0", 6) == 0)
-            {
-                Ok = TEST_OK(sscanf(line,
-                    "  eth0:%llu %llu %*d %*d %*d %*d %*d %llu "
-                           "%llu %llu %*d %*d %*d %*d %*d %llu",
-                    &NetBytesRx, &NetPacketsRx, &NetMultiRx,
-                    &NetBytesTx, &NetPacketsTx, &NetMultiTx) == 6);
-                break;
-            }
-        }
-        fclose(input);
-    }
-    return Ok;
+    char Buffer[4096];
+    const char * Cursor;
+    return
+        ReadSampledFile(ProcNetDev, Buffer, sizeof(Buffer))  &&
+        (Cursor = FindEth0(Buffer)) != NULL  &&
+        TEST_OK(
+            ParseUnsigned(Cursor, NetBytesRx)  &&
+            ParseUnsigned(Cursor, NetPacketsRx)  &&
+            SkipFields(Cursor, 5)  &&
+            ParseUnsigned(Cursor, NetMultiRx)  &&
+            ParseUnsigned(Cursor, NetBytesTx)  &&
+            ParseUnsigned(Cursor, NetPacketsTx)  &&
+            SkipFields(Cursor, 5)  &&
+            ParseUnsigned(Cursor, NetMultiTx));
 }
 
 static void ProcessNetworkStats()
@@ -422,6 +639,34 @@ static void PublishNetworkStats()
 
 
 
+/* Worst case hold and wait times for each hardware lock over the last
+ * sensors update interval, in microseconds. */
+static int HardwareLockHold[HARDWARE_LOCK_COUNT];
+static int HardwareLockWait[HARDWARE_LOCK_COUNT];
+
+/* Rate of I/O Intr scan requests to EPICS over the last interval. */
+static int IoIntrRate;
+static unsigned int LastIoIntrCount;
+
+static void ProcessIoIntrRate()
+{
+    unsigned int Count = GetIoIntrCount();
+    IoIntrRate = (Count - LastIoIntrCount) / SENSORS_POLL_INTERVAL;
+    LastIoIntrCount = Count;
+}
+
+static void PublishHardwareLocks()
+{
+    for (int i = 0; i < HARDWARE_LOCK_COUNT; i ++)
+    {
+        const char * Name = HardwareLockName((HARDWARE_LOCK_ID) i);
+        Publish_ai(Concat("SE:LOCK_", Name), HardwareLockHold[i]);
+        Publish_ai(Concat("SE:LOCKWAIT_", Name), HardwareLockWait[i]);
+    }
+}
+
+
+
 /*****************************************************************************/
 /*                                                                           */
 /*                           NTP Status Monitoring                           */
@@ -439,7 +684,12 @@ enum {
 static int NTP_status = NTP_NOT_MONITORED;
 static int NTP_stratum = 16;    // 16 means unreachable/invalid server
 static EPICS_STRING NTP_server;
+static int NTP_offset;          // Clock offset from server in microseconds
+static int NTP_delay;           // Round trip delay in microseconds
+static int NTP_jitter;          // Smoothed offset jitter in microseconds
+static bool NTP_responding;     // Set while offset, delay, jitter are valid
 static bool MonitorNtp; // Can be disabled
+static const char * NtpServer;  // Server to probe, as <address>[:<port>]
 
 
 /* The NTP server can take more than 20 minutes to satisfy itself before
@@ -447,6 +697,16 @@ static bool MonitorNtp; // Can be disabled
  * error if synchronisation has not been established. */
 static const int NTP_startup_window = 1500;
 
+/* Interval between probes and time to wait for a response, in milliseconds.
+ * We never wait longer than NTP_PROBE_WAKEUP in one go so that shutdown
+ * requests are seen promptly. */
+#define NTP_PROBE_INTERVAL      (1000 * SENSORS_POLL_INTERVAL)
+#define NTP_PROBE_TIMEOUT       1000
+#define NTP_PROBE_WAKEUP        1000
+
+/* Offset from 1900 (NTP epoch) to 1970 (Unix epoch) in seconds. */
+#define NTP_EPOCH_OFFSET        2208988800U
+
 
 /* NTP/SNTP message packet (except for NTP control messages).  See RFC 1305
  * for NTP and RFC 2030 for SNTP.
@@ -473,75 +733,43 @@ struct ntp_pkt {
 };
 
 
-/* This routine sends a single UDP message to the specified address and port,
- * and waits until timeout for a reply.  If a reply of some sort was received
- * this is returned with success.  Normal failure to receive a reply is
- * silent, as this is operationally normal and reported elsewhere.
- *     The timeout is in milliseconds, and cannot be more than 999. */
+/* NTP timestamps are 64-bit fixed point seconds since 1900 with the binary
+ * point in the middle, transmitted as two big endian 32-bit words. */
 
-static bool UdpExchange(
-    const char * address, int port, time_t timeout_ms,
-    const void * tx_buffer, size_t tx_length,
-    void * rx_buffer, size_t *rx_length)
+static uint64_t ntp_timestamp(const struct timespec &ts)
 {
-    struct sockaddr_in ntp_server;
-    memset(&ntp_server, 0, sizeof(ntp_server));
-    ntp_server.sin_family = AF_INET;
-    ntp_server.sin_port = htons(port);
-    inet_aton(address, &ntp_server.sin_addr);
-
-    int sock;
-    ssize_t rx = 0;
-    bool Ok = TEST_IO(sock = socket(AF_INET, SOCK_DGRAM, 0));
-    if (Ok)
-    {
-        size_t sent;
-
-        fd_set rx_ready;
-        FD_ZERO(&rx_ready);
-        FD_SET(sock, &rx_ready);
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 1000 * timeout_ms;
-
-        int sel;
-        Ok =
-            TEST_IO(connect(sock,
-                (const struct sockaddr *) &ntp_server, sizeof(ntp_server)))  &&
-            TEST_IO(sent = send(sock, tx_buffer, tx_length, 0))  &&
-            TEST_OK(sent == tx_length)  &&
-            TEST_IO(sel = select(sock+1, &rx_ready, NULL, NULL, &timeout))  &&
-            /* Fail if select timed out. */
-            sel > 0  &&
-            /* Read can fail, and we don't actually want to log this. */
-            DO_(rx = recv(sock, rx_buffer, *rx_length, 0))  &&
-            rx != -1;
-
-        TEST_IO(close(sock));
-    }
-
-    *rx_length = Ok ? rx : 0;
-    return Ok;
+    uint64_t seconds = (uint64_t) ts.tv_sec + NTP_EPOCH_OFFSET;
+    uint64_t fraction = ((uint64_t) ts.tv_nsec << 32) / 1000000000;
+    return (seconds << 32) | fraction;
 }
 
+static uint64_t ntp_to_wire(uint64_t timestamp)
+{
+    uint32_t words[2] = {
+        htonl((uint32_t) (timestamp >> 32)), htonl((uint32_t) timestamp) };
+    uint64_t result;
+    memcpy(&result, words, sizeof(result));
+    return result;
+}
 
-/* Simply sends an SNTP packet to the given server, waits for a response or
- * timeout, and does simple validation of the response. */
+static uint64_t ntp_from_wire(uint64_t wire)
+{
+    uint32_t words[2];
+    memcpy(words, &wire, sizeof(words));
+    return ((uint64_t) ntohl(words[0]) << 32) | ntohl(words[1]);
+}
 
-static bool SNTP_exchange(
-    const char * address, time_t timeout_ms, ntp_pkt *result)
+/* Converts a difference between two NTP timestamps to microseconds,
+ * saturating at the limits of an int. */
+static int ntp_interval_us(int64_t interval)
 {
-    /* Might as well use the result packet for our transmit.  For a simple
-     * SNTP status request we can just set the whole packet to zero (except
-     * for the mode byte). */
-    memset(result, 0, sizeof(ntp_pkt));
-    result->li_vn_mode = (0 << 6) | (3 << 3) | (3 << 0);
-    size_t rx = sizeof(ntp_pkt);
-    return
-        UdpExchange(address, 123, timeout_ms, result, rx, result, &rx)  &&
-        /* Simple validation. */
-        rx == sizeof(ntp_pkt)  &&       // Complete packet received
-        (result->li_vn_mode & 7) == 4;  // Response is server mode response
+    double us = 1e6 * (double) interval / 4294967296.0;
+    if (us > INT_MAX)
+        return INT_MAX;
+    else if (us < -INT_MAX)
+        return -INT_MAX;
+    else
+        return (int) us;
 }
 
 
@@ -563,17 +791,276 @@ static void refid_to_string(int stratum, int refid, EPICS_STRING string)
 }
 
 
+/* The NTP server is probed by its own thread using a single persistent
+ * non-blocking UDP socket, so that a slow or absent server never holds up
+ * the rest of the sensors.  Each request carries its transmit time, which
+ * the server echoes back as the originate timestamp: this lets us discard
+ * stale responses and compute offset and round trip delay as in RFC 2030.
+ * The sensors thread picks up the most recent result on each poll. */
+
+class NTP_PROBE : public LOCKED_THREAD
+{
+public:
+    NTP_PROBE() :
+        LOCKED_THREAD("NTP_PROBE"),
+        Socket(-1),
+        Outstanding(false),
+        Responding(false),
+        LeapIndicator(3),
+        Stratum(16),
+        Offset(0),
+        Delay(0),
+        Jitter(0),
+        JitterSquared(0),
+        HaveOffset(false)
+    {
+        strcpy(Server, "no server");
+    }
+
+    bool Open(const char * Address)
+    {
+        /* The address may be followed by a port, which is useful for
+         * testing against a stand-in server. */
+        char Host[64];
+        int Port = 123;
+        const char * Colon = strchr(Address, ':');
+        size_t HostLength = Colon ? (size_t) (Colon - Address) : strlen(Address);
+        if (HostLength >= sizeof(Host))
+            HostLength = sizeof(Host) - 1;
+        memcpy(Host, Address, HostLength);
+        Host[HostLength] = '\0';
+        if (Colon != NULL)
+            Port = atoi(Colon + 1);
+
+        struct sockaddr_in ntp_server;
+        memset(&ntp_server, 0, sizeof(ntp_server));
+        ntp_server.sin_family = AF_INET;
+        ntp_server.sin_port = htons(Port);
+        return
+            TEST_OK(inet_aton(Host, &ntp_server.sin_addr))  &&
+            TEST_IO(Socket = socket(AF_INET, SOCK_DGRAM, 0))  &&
+            TEST_IO(fcntl(Socket, F_SETFL, O_NONBLOCK))  &&
+            TEST_IO(connect(Socket,
+                (const struct sockaddr *) &ntp_server, sizeof(ntp_server)));
+    }
+
+    /* Returns the latest probe results. */
+    bool Fetch(int &LI, int &stratum, EPICS_STRING server,
+        int &offset, int &delay, int &jitter)
+    {
+        bool Ok;
+        THREAD_LOCK(this);
+        LI = LeapIndicator;
+        stratum = Stratum;
+        memcpy(server, Server, sizeof(EPICS_STRING));
+        offset = Offset;
+        delay = Delay;
+        jitter = Jitter;
+        Ok = Responding;
+        THREAD_UNLOCK();
+        return Ok;
+    }
+
+private:
+    void Thread()
+    {
+        StartupOk();
+
+        /* Scheduling uses the monotonic clock so that steps in the real time
+         * clock, which NTP itself may cause, don't disturb probing. */
+        struct timespec Now, NextSend;
+        TEST_IO(clock_gettime(CLOCK_MONOTONIC, &NextSend));
+        while (Running())
+        {
+            TEST_IO(clock_gettime(CLOCK_MONOTONIC, &Now));
+            if (Outstanding  &&
+                Milliseconds(SentAt, Now) >= NTP_PROBE_TIMEOUT)
+                NoResponse();
+            if (Milliseconds(NextSend, Now) >= 0)
+            {
+                SendRequest(Now);
+                NextSend = Now;
+                NextSend.tv_sec += NTP_PROBE_INTERVAL / 1000;
+            }
+
+            /* Sleep until something arrives, the next request is due, or
+             * the outstanding request times out. */
+            int Wait = - Milliseconds(NextSend, Now);
+            if (Outstanding)
+            {
+                int Timeout = NTP_PROBE_TIMEOUT - Milliseconds(SentAt, Now);
+                if (Timeout < Wait)
+                    Wait = Timeout;
+            }
+            if (Wait > NTP_PROBE_WAKEUP)
+                Wait = NTP_PROBE_WAKEUP;
+            if (Wait < 0)
+                Wait = 0;
+            if (WaitForResponse(Wait))
+                ReadResponses();
+        }
+    }
+
+    void OnTerminate()
+    {
+        /* The thread polls Running() at least every NTP_PROBE_WAKEUP. */
+    }
+
+    /* Returns the interval from Start to End in milliseconds, saturating at
+     * the limits of an int. */
+    static int Milliseconds(
+        const struct timespec &Start, const struct timespec &End)
+    {
+        int64_t Interval =
+            1000 * (int64_t) (End.tv_sec - Start.tv_sec) +
+            (End.tv_nsec - Start.tv_nsec) / 1000000;
+        if (Interval > INT_MAX)
+            return INT_MAX;
+        else if (Interval < -INT_MAX)
+            return -INT_MAX;
+        else
+            return (int) Interval;
+    }
+
+    /* Now is the monotonic send time, used for timing out the request; the
+     * packet itself carries the real time. */
+    void SendRequest(const struct timespec &Now)
+    {
+        ntp_pkt pkt;
+        memset(&pkt, 0, sizeof(pkt));
+        pkt.li_vn_mode = (0 << 6) | (3 << 3) | (3 << 0);
+        struct timespec RealNow;
+        TEST_IO(clock_gettime(CLOCK_REALTIME, &RealNow));
+        SentTimestamp = ntp_timestamp(RealNow);
+        pkt.xmt = ntp_to_wire(SentTimestamp);
+        /* A failed send (typically ECONNREFUSED reported from an earlier
+         * ICMP response) is handled as a timeout. */
+        send(Socket, &pkt, sizeof(pkt), 0);
+        SentAt = Now;
+        Outstanding = true;
+    }
+
+    bool WaitForResponse(int Timeout)
+    {
+        fd_set rx_ready;
+        FD_ZERO(&rx_ready);
+        FD_SET(Socket, &rx_ready);
+        struct timeval timeout;
+        timeout.tv_sec = Timeout / 1000;
+        timeout.tv_usec = 1000 * (Timeout % 1000);
+        int sel = select(Socket + 1, &rx_ready, NULL, NULL, &timeout);
+        return sel > 0;
+    }
+
+    void ReadResponses()
+    {
+        ntp_pkt pkt;
+        ssize_t rx;
+        while (rx = recv(Socket, &pkt, sizeof(pkt), 0),  rx != -1)
+        {
+            struct timespec Received;
+            TEST_IO(clock_gettime(CLOCK_REALTIME, &Received));
+            if (Outstanding  &&
+                rx == sizeof(ntp_pkt)  &&           // Complete packet
+                (pkt.li_vn_mode & 7) == 4  &&       // Server mode response
+                ntp_from_wire(pkt.org) == SentTimestamp)    // Our request
+                ProcessResponse(pkt, ntp_timestamp(Received));
+        }
+    }
+
+    void ProcessResponse(const ntp_pkt &pkt, uint64_t T4)
+    {
+        uint64_t T1 = SentTimestamp;
+        uint64_t T2 = ntp_from_wire(pkt.rec);
+        uint64_t T3 = ntp_from_wire(pkt.xmt);
+        int NewOffset = ntp_interval_us(
+            ((int64_t) (T2 - T1) + (int64_t) (T3 - T4)) / 2);
+        int NewDelay = ntp_interval_us(
+            (int64_t) (T4 - T1) - (int64_t) (T3 - T2));
+
+        THREAD_LOCK(this);
+        Outstanding = false;
+        Responding = true;
+        LeapIndicator = (pkt.li_vn_mode >> 6) & 3;
+        Stratum = pkt.stratum;
+        refid_to_string(pkt.stratum, pkt.refid, Server);
+        /* Jitter is the exponentially smoothed RMS difference between
+         * successive offsets, as in RFC 5905. */
+        if (HaveOffset)
+        {
+            double Difference = (double) NewOffset - Offset;
+            JitterSquared += (Difference * Difference - JitterSquared) / 4;
+            Jitter = (int) sqrt(JitterSquared);
+        }
+        HaveOffset = true;
+        Offset = NewOffset;
+        Delay = NewDelay;
+        THREAD_UNLOCK();
+    }
+
+    void NoResponse()
+    {
+        THREAD_LOCK(this);
+        Outstanding = false;
+        Responding = false;
+        HaveOffset = false;
+        JitterSquared = 0;
+        Jitter = 0;
+        THREAD_UNLOCK();
+    }
+
+    int Socket;
+    bool Outstanding;           // Set while waiting for a response
+    struct timespec SentAt;     // Time request was sent
+    uint64_t SentTimestamp;     // Same time in NTP format
+
+    /* Results of the last successful probe. */
+    bool Responding;
+    int LeapIndicator;
+    int Stratum;
+    EPICS_STRING Server;
+    int Offset;
+    int Delay;
+    int Jitter;
+    double JitterSquared;
+    bool HaveOffset;
+};
+
+
+static NTP_PROBE * NtpProbe = NULL;
+
+
+/* The NTP measurements are only meaningful while the server is responding,
+ * otherwise the published values are stale and are marked invalid. */
+class NTP_MEASUREMENT : public I_ai
+{
+public:
+    NTP_MEASUREMENT(int &Value) : Value(Value) {}
+    bool read(int &Result)
+    {
+        Result = Value;
+        return true;
+    }
+    epicsAlarmSeverity AlarmStatus()
+    {
+        return NTP_responding ? epicsSevNone : epicsSevInvalid;
+    }
+private:
+    int &Value;
+};
+
+
 static void ProcessNtpHealth()
 {
-    ntp_pkt pkt;
-    if (SNTP_exchange("127.0.0.1", 100, &pkt))
+    int LI, stratum;
+    NTP_responding = NtpProbe->Fetch(LI, stratum, NTP_server,
+        NTP_offset, NTP_delay, NTP_jitter);
+    if (NTP_responding)
     {
-        int LI = (pkt.li_vn_mode >> 6) & 3;
         NTP_status = LI == 3 ?
             (LastUptime < NTP_startup_window ?
                 NTP_STARTUP : NTP_NO_SYNC) : NTP_OK;
-        NTP_stratum = pkt.stratum == 0 ? 16 : pkt.stratum;
-        refid_to_string(pkt.stratum, pkt.refid, NTP_server);
+        NTP_stratum = stratum == 0 ? 16 : stratum;
     }
     else
     {
@@ -584,6 +1071,15 @@ static void ProcessNtpHealth()
 }
 
 
+static bool InitialiseNtpProbe()
+{
+    NtpProbe = new NTP_PROBE();
+    return
+        NtpProbe->Open(NtpServer)  &&
+        NtpProbe->StartThread();
+}
+
+
 
 
 /*****************************************************************************/
@@ -603,6 +1099,9 @@ static void ProcessSensors()
         ReadHealth();
     if (MonitorNtp)
         ProcessNtpHealth();
+    UpdateThreadJitter();
+    ReadHardwareLockStatistics(HardwareLockHold, HardwareLockWait);
+    ProcessIoIntrRate();
 }
 
 
@@ -680,9 +1179,10 @@ static void SetTargetTemperature()
 #define I2C_DEVICE  "/sys/bus/i2c/devices/"
 #define PROC_DEVICE "/proc/sys/dev/sensors/"
 
-bool InitialiseSensors(bool _MonitorNtp)
+bool InitialiseSensors(bool _MonitorNtp, const char * _NtpServer)
 {
     MonitorNtp = _MonitorNtp;
+    NtpServer = _NtpServer;
 
     /* Figure out where to read our fan and temperature sensors: under Linux
      * 2.6 we read from the /sys file system, but under 2.4 we read from /proc
@@ -719,6 +1219,21 @@ bool InitialiseSensors(bool _MonitorNtp)
         proc_fan1_set = PROC_DEVICE "max6650-i2c-0-48/speed";
     }
 
+    OpenSampledFile(ProcUptime,  "/proc/uptime");
+    OpenSampledFile(ProcMeminfo, "/proc/meminfo");
+    OpenSampledFile(ProcNetDev,  "/proc/net/dev");
+    /* The RF board sensors are only read on Brilliance. */
+    if (LiberaBrilliance)
+    {
+        OpenSampledFile(TempRf1, proc_temp_rf1);
+        OpenSampledFile(TempRf2, proc_temp_rf2);
+    }
+    OpenSampledFile(TempMb,  proc_temp_mb);
+    OpenSampledFile(Fan0,    proc_fan0);
+    OpenSampledFile(Fan1,    proc_fan1);
+    OpenSampledFile(Fan0Set, proc_fan0_set);
+    OpenSampledFile(Fan1Set, proc_fan1_set);
+
     Publish_longin("SE:TEMP",
         LiberaBrilliance ? RfTemperature1 : MbTemperature);
     Publish_longin("SE:TEMP_RF1",  RfTemperature1);
@@ -734,6 +1249,8 @@ bool InitialiseSensors(bool _MonitorNtp)
     Publish_ai("SE:EPICSUP", EpicsUp);
     Publish_ai("SE:CPU",     CpuUsage);
     PublishNetworkStats();
+    PublishHardwareLocks();
+    Publish_ai("SE:IOINTR", IoIntrRate);
 
     PUBLISH_CONFIGURATION(mbbo, "SE:HEALTHD", EnableHealthd, SetEnableHealthd);
     PUBLISH_CONFIGURATION(longout, "SE:SETTEMP",
@@ -744,6 +1261,9 @@ bool InitialiseSensors(bool _MonitorNtp)
     Publish_mbbi("CK:NTPSTAT", NTP_status);
     Publish_longin("CK:STRATUM", NTP_stratum);
     Publish_stringin("CK:SERVER", NTP_server);
+    Publish_ai("CK:NTPOFF", *new NTP_MEASUREMENT(NTP_offset));
+    Publish_ai("CK:NTPDELAY", *new NTP_MEASUREMENT(NTP_delay));
+    Publish_ai("CK:NTPJITTER", *new NTP_MEASUREMENT(NTP_jitter));
 
     InitialiseUptime();
     if (EnableHealthd == SE_HEALTHD_SILENT)
@@ -755,6 +1275,7 @@ bool InitialiseSensors(bool _MonitorNtp)
     SensorsThread = new SENSORS_THREAD();
     return
         InitialiseRamfsUsage()  &&
+        IF_(MonitorNtp, InitialiseNtpProbe())  &&
         SensorsThread->StartThread();
 }
 
@@ -764,4 +1285,6 @@ void TerminateSensors()
 {
     if (SensorsThread != NULL)
         SensorsThread->Terminate();
+    if (NtpProbe != NULL)
+        NtpProbe->Terminate();
 }
@@ -28,5 +28,5 @@
 
 /* Interface to sensor implementions. */
 
-bool InitialiseSensors(bool MonitorNtp);
+bool InitialiseSensors(bool MonitorNtp, const char * NtpServer);
 void TerminateSensors();
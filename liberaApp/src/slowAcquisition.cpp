@@ -32,6 +32,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "device.h"
 #include "persistent.h"
@@ -44,6 +46,7 @@
 #include "waveform.h"
 #include "numeric.h"
 #include "interlock.h"
+#include "saHistory.h"
 
 #include "slowAcquisition.h"
 
@@ -91,11 +94,23 @@ void PowerAndCurrentFromS(int S, int &Power, int &Current)
 
 
 
+/* Slow acquisition updates normally arrive at 10Hz.  We wake up at least this
+ * often to check for termination, and if no update has arrived for
+ * SA_STALL_TIMEOUT we report the slow acquisition stream as stalled. */
+#define SA_POLL_INTERVAL    250     // ms
+#define SA_STALL_TIMEOUT    1000    // ms
+/* If we're told data is ready but can't read it we back off for a short while
+ * to avoid spinning. */
+#define SA_RETRY_INTERVAL   10000   // us
+
+
 class SLOW_ACQUISITION : public THREAD
 {
 public:
     SLOW_ACQUISITION() :
-        THREAD("SLOW_ACQUISITION")
+        THREAD("SLOW_ACQUISITION"),
+        Stalled(false),
+        Stalls(0)
     {
         Publish_ABCD("SA", ABCD);
         Publish_ABCD_N("SA", ABCD_Normalised);
@@ -104,6 +119,8 @@ public:
         Publish_ai("SA:CURRENT", Current);
         Publish_longin("SA:MAXADC", MaxAdc);
         Interlock.Publish("SA");
+        Publish_bi("SA:STALLED", Stalled);
+        Publish_longin("SA:STALLS", Stalls);
     }
 
 private:
@@ -111,15 +128,24 @@ private:
     {
         StartupOk();
 
-        /* We simply run until asked to stop.  Unfortunately we have no way
-         * to interrupt ReadSlowAcquisition(), so we might lock up if that
-         * stops responding. */
+        /* We run until asked to stop, never blocking for longer than
+         * SA_POLL_INTERVAL so that a silent driver is detected and reported
+         * rather than hanging this thread. */
+        int64_t LastUpdate = Now();
         while (Running())
         {
             ABCD_ROW NewABCD;
             XYQS_ROW NewXYQS;
-            if (ReadSlowAcquisition(NewABCD, NewXYQS))
+            bool Ready = WaitSlowAcquisition(SA_POLL_INTERVAL);
+            if (Ready  &&  ReadSlowAcquisition(NewABCD, NewXYQS))
             {
+                LastUpdate = Now();
+                if (Stalled.Read())
+                {
+                    printf("Slow acquisition resumed\n");
+                    Stalled.Write(false);
+                }
+
                 Interlock.Wait();
                 ABCD = NewABCD;
                 ABCDtoXYQS(&ABCD, &XYQS, 1);
@@ -130,10 +156,33 @@ private:
 
                 NotifyInterlockCurrent(Current);
                 NotifyMaxAdc(MaxAdc);
+                RecordSaHistory(ABCD, XYQS, Power, Current);
+            }
+            else if (Running())
+            {
+                if (Ready)
+                    usleep(SA_RETRY_INTERVAL);
+                if (!Stalled.Read()  &&
+                    Now() - LastUpdate >= SA_STALL_TIMEOUT)
+                {
+                    /* Interlock current tracking depends on this thread, so
+                     * make sure a stall doesn't go unnoticed. */
+                    printf("Slow acquisition stalled\n");
+                    Stalled.Write(true);
+                    Stalls.Write(Stalls.Read() + 1);
+                }
             }
         }
     }
 
+    /* Returns a monotonic time stamp in milliseconds. */
+    static int64_t Now()
+    {
+        struct timespec Time;
+        clock_gettime(CLOCK_MONOTONIC, &Time);
+        return (int64_t) Time.tv_sec * 1000 + Time.tv_nsec / 1000000;
+    }
+
     /* Computes ABCD_normalised = ABCD / XYQS.S. */
     void ComputeNormalisedABCD()
     {
@@ -157,10 +206,12 @@ private:
     }
 
 
-#ifdef UNSAFE_PTHREAD_CANCEL
-    /* Suppress use of pthread_cancel in this thread: it can cause trouble! */
-    void OnTerminate() { }
-#endif
+    /* Waking the thread is enough to make it notice Running() has gone
+     * false, so we avoid pthread_cancel which can cause trouble! */
+    void OnTerminate()
+    {
+        InterruptSlowAcquisition();
+    }
 
 
     INTERLOCK Interlock;
@@ -169,6 +220,8 @@ private:
     int Power;          // Power in dBm * 1e6
     int Current;        // Current in 10*nA
     int MaxAdc;         // Raw MaxADC reading
+    UPDATER_bool Stalled;   // Set if no SA update for SA_STALL_TIMEOUT
+    UPDATER_int Stalls;     // Number of stalls seen since startup
 };
 
 
@@ -178,6 +231,8 @@ static SLOW_ACQUISITION * SlowAcquisition = NULL;
 bool InitialiseSlowAcquisition(int S0_SA)
 {
     InitialisePowerAndCurrent(S0_SA);
+    if (!InitialiseSaHistory())
+        return false;
     SlowAcquisition = new SLOW_ACQUISITION();
     return SlowAcquisition->StartThread();
 }
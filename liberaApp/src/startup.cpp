@@ -0,0 +1,267 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Dependency ordered startup of IOC components. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hardware.h"
+#include "startup.h"
+
+
+/* Each step can depend on at most this many other steps. */
+#define MAX_DEPENDENCIES    8
+
+
+struct STEP_STATE
+{
+    const STARTUP_STEP * Step;
+    int Dependencies[MAX_DEPENDENCIES];
+    int DependencyCount;
+
+    bool Started;
+    bool Finished;
+    bool Ok;
+    pthread_t Thread;
+    struct timespec StartTime;
+    struct timespec EndTime;
+};
+
+
+/* All step state is guarded by this mutex, and StepDone is signalled each
+ * time a step completes. */
+static pthread_mutex_t StartupMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t StepDone = PTHREAD_COND_INITIALIZER;
+
+static STEP_STATE * States;
+static int StateCount;
+
+
+static double Milliseconds(
+    const struct timespec &Start, const struct timespec &End)
+{
+    return 1e3 * (End.tv_sec - Start.tv_sec) +
+        1e-6 * (End.tv_nsec - Start.tv_nsec);
+}
+
+
+/* Converts the After list for each step into indices of earlier steps.  By
+ * insisting that dependencies come earlier in the table we rule out cycles
+ * and guarantee that running the table in order is always valid. */
+
+static bool ResolveDependencies()
+{
+    bool Ok = true;
+    for (int i = 0; Ok  &&  i < StateCount; i ++)
+    {
+        STEP_STATE &State = States[i];
+        State.DependencyCount = 0;
+        const char * After = State.Step->After;
+        while (Ok  &&  After != NULL  &&  *After != '\0')
+        {
+            size_t Length = strcspn(After, " ");
+            if (Length > 0)
+            {
+                int Found = -1;
+                for (int j = 0; Found < 0  &&  j < i; j ++)
+                    if (strncmp(States[j].Step->Name, After, Length) == 0  &&
+                        States[j].Step->Name[Length] == '\0')
+                        Found = j;
+                if (Found < 0)
+                {
+                    printf("Startup step %s: unknown step \"%.*s\"\n",
+                        State.Step->Name, (int) Length, After);
+                    Ok = false;
+                }
+                else if (State.DependencyCount >= MAX_DEPENDENCIES)
+                {
+                    printf("Startup step %s: too many dependencies\n",
+                        State.Step->Name);
+                    Ok = false;
+                }
+                else
+                    State.Dependencies[State.DependencyCount++] = Found;
+            }
+            After += Length;
+            After += strspn(After, " ");
+        }
+    }
+    return Ok;
+}
+
+
+static void RunStep(STEP_STATE &State)
+{
+    clock_gettime(CLOCK_MONOTONIC, &State.StartTime);
+    bool Ok = State.Step->Action();
+    clock_gettime(CLOCK_MONOTONIC, &State.EndTime);
+    if (!Ok)
+        printf("Startup step %s failed\n", State.Step->Name);
+
+    TEST_0(pthread_mutex_lock(&StartupMutex));
+    State.Ok = Ok;
+    State.Finished = true;
+    TEST_0(pthread_cond_broadcast(&StepDone));
+    TEST_0(pthread_mutex_unlock(&StartupMutex));
+}
+
+static void * StepThread(void * Context)
+{
+    RunStep(*(STEP_STATE *) Context);
+    return NULL;
+}
+
+
+/* Returns true if all the dependencies of the given step have completed
+ * successfully. */
+
+static bool StepReady(const STEP_STATE &State)
+{
+    for (int i = 0; i < State.DependencyCount; i ++)
+    {
+        const STEP_STATE &Dependency = States[State.Dependencies[i]];
+        if (!Dependency.Finished  ||  !Dependency.Ok)
+            return false;
+    }
+    return true;
+}
+
+
+/* Repeatedly starts every step which is ready to run and then waits for a
+ * step to complete.  Once any step has failed no more steps are started, but
+ * we still wait for all running steps to finish. */
+
+static bool RunParallel()
+{
+    bool Ok = true;
+    TEST_0(pthread_mutex_lock(&StartupMutex));
+    while (true)
+    {
+        int Running = 0;
+        for (int i = 0; i < StateCount; i ++)
+        {
+            STEP_STATE &State = States[i];
+            if (State.Finished)
+                Ok = Ok  &&  State.Ok;
+            else if (State.Started)
+                Running += 1;
+        }
+        for (int i = 0; Ok  &&  i < StateCount; i ++)
+        {
+            STEP_STATE &State = States[i];
+            if (!State.Started  &&  StepReady(State))
+            {
+                State.Started = true;
+                Ok = TEST_0(pthread_create(
+                    &State.Thread, NULL, StepThread, &State));
+                if (Ok)
+                    Running += 1;
+                else
+                    /* Never started, so will be reported as not run. */
+                    State.Started = false;
+            }
+        }
+
+        if (Running == 0)
+            break;
+        TEST_0(pthread_cond_wait(&StepDone, &StartupMutex));
+    }
+    TEST_0(pthread_mutex_unlock(&StartupMutex));
+
+    for (int i = 0; i < StateCount; i ++)
+    {
+        if (States[i].Started)
+            TEST_0(pthread_join(States[i].Thread, NULL));
+        Ok = Ok  &&  States[i].Finished  &&  States[i].Ok;
+    }
+    return Ok;
+}
+
+
+static bool RunSerial()
+{
+    bool Ok = true;
+    for (int i = 0; Ok  &&  i < StateCount; i ++)
+    {
+        States[i].Started = true;
+        RunStep(States[i]);
+        Ok = States[i].Ok;
+    }
+    return Ok;
+}
+
+
+/* Reports the start and duration of each step relative to the start of the
+ * whole sequence, together with the total time. */
+
+static void ReportTimings(const struct timespec &Start, bool Parallel)
+{
+    struct timespec End;
+    clock_gettime(CLOCK_MONOTONIC, &End);
+    printf("Startup %s in %.1f ms:\n",
+        Parallel ? "(parallel)" : "(serial)", Milliseconds(Start, End));
+    for (int i = 0; i < StateCount; i ++)
+    {
+        const STEP_STATE &State = States[i];
+        if (State.Started  &&  State.Finished)
+            printf("    %-20s %8.1f %8.1f ms%s\n", State.Step->Name,
+                Milliseconds(Start, State.StartTime),
+                Milliseconds(State.StartTime, State.EndTime),
+                State.Ok ? "" : "  FAILED");
+        else
+            printf("    %-20s not run\n", State.Step->Name);
+    }
+}
+
+
+bool RunStartup(const STARTUP_STEP Steps[], int StepCount, bool Parallel)
+{
+    States = new STEP_STATE[StepCount];
+    StateCount = StepCount;
+    memset(States, 0, StepCount * sizeof(STEP_STATE));
+    for (int i = 0; i < StepCount; i ++)
+        States[i].Step = &Steps[i];
+
+    struct timespec Start;
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+    bool Ok = ResolveDependencies();
+    if (Ok)
+    {
+        Ok = Parallel ? RunParallel() : RunSerial();
+        ReportTimings(Start, Parallel);
+    }
+
+    delete [] States;
+    States = NULL;
+    return Ok;
+}
@@ -0,0 +1,53 @@
+/* This file is part of the Libera EPICS Driver,
+ * Copyright (C) 2005-2011  Michael Abbott, Diamond Light Source Ltd.
+ *
+ * The Libera EPICS Driver is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Libera EPICS Driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Contact:
+ *      Dr. Michael Abbott,
+ *      Diamond Light Source Ltd,
+ *      Diamond House,
+ *      Chilton,
+ *      Didcot,
+ *      Oxfordshire,
+ *      OX11 0DE
+ *      michael.abbott@diamond.ac.uk
+ */
+
+
+/* Dependency ordered startup of IOC components.
+ *
+ * Startup is described by a table of steps, each naming the steps which
+ * must have completed successfully before it can run.  Steps whose
+ * dependencies have all been met are run concurrently, each on its own
+ * thread, so that a component waiting on hardware or the file system doesn't
+ * hold up unrelated components. */
+
+struct STARTUP_STEP
+{
+    /* Name of this step, used for dependencies and for reporting. */
+    const char * Name;
+    /* Action to perform, returns false if startup should be abandoned. */
+    bool (*Action)();
+    /* Space separated list of steps which must complete before this one can
+     * start, or NULL if there are no dependencies.  Every dependency must
+     * appear earlier in the table. */
+    const char * After;
+};
+
+/* Runs all the steps in the given table, returning true iff every step
+ * succeeded.  If Parallel is false the steps are simply run in table order.
+ * In either case the time taken by each step is reported on completion. */
+bool RunStartup(const STARTUP_STEP Steps[], int StepCount, bool Parallel);
@@ -29,6 +29,7 @@
 /* Implementation of simple thread class. */
 
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <pthread.h>
 #include <signal.h>
@@ -38,6 +39,7 @@
 
 #include "hardware.h"
 #include "thread.h"
+#include "schedule.h"
 
 
 
@@ -64,6 +66,7 @@ SEMAPHORE::SEMAPHORE(bool InitialReady)
 {
     /* Initialise our internal resources. */
     Ready = InitialReady;
+    memset(&SignalTime, 0, sizeof(SignalTime));
     TEST_0(pthread_cond_init(&ReadyCondition, NULL));
     TEST_0(pthread_mutex_init(&ReadyMutex, NULL));
 }
@@ -93,36 +96,77 @@ bool SEMAPHORE::WaitFor(int milliseconds)
     return WaitUntil(target);
 }
 
+/* If either wait actually blocks then the wakeup latency is recorded, measured
+ * from the moment we were first signalled or from the timeout deadline.  All
+ * of these times are taken on CLOCK_MONOTONIC so that a step in the real time
+ * clock doesn't corrupt the measurement; the timeout deadline is converted
+ * before we start waiting. */
+
+static void DeadlineToMonotonic(
+    const struct timespec &target, struct timespec &Due)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_REALTIME, &Now);
+    clock_gettime(CLOCK_MONOTONIC, &Due);
+    int64_t Deadline =
+        (int64_t) (Due.tv_sec + target.tv_sec - Now.tv_sec) * S_NS +
+        Due.tv_nsec + target.tv_nsec - Now.tv_nsec;
+    Due.tv_sec = Deadline / S_NS;
+    Due.tv_nsec = Deadline % S_NS;
+}
+
 bool SEMAPHORE::WaitUntil(const struct timespec &target)
 {
     int ReturnCode = 0;
+    bool Blocked = false;
+    struct timespec Due;
+    DeadlineToMonotonic(target, Due);
     THREAD_LOCK(this);
     while (!Ready  &&  ReturnCode == 0)
+    {
+        Blocked = true;
         ReturnCode = pthread_cond_timedwait(
             &ReadyCondition, &ReadyMutex, &target);
+    }
     if (ReturnCode == 0)
+    {
         Ready = false;  // Only consume event if we didn't time out.
+        Due = SignalTime;
+    }
     THREAD_UNLOCK();
+    if (Blocked)
+        RecordWakeupLatency(Due);
     return ReturnCode == 0;
 }
 
 void SEMAPHORE::Wait()
 {
-    THREAD_LOCK(this);
+    bool Blocked = false;
     bool Ok = true;
+    struct timespec Due;
+    THREAD_LOCK(this);
     while (Ok  && !Ready)
     {
+        Blocked = true;
         Ok = TEST_0(pthread_cond_wait(&ReadyCondition, &ReadyMutex));
     }
     if (Ok)
         Ready = false;
+    Due = SignalTime;
     THREAD_UNLOCK();
+    if (Blocked  &&  Ok)
+        RecordWakeupLatency(Due);
 }
 
 bool SEMAPHORE::Signal()
 {
-    bool OldReady = Ready;
+    bool OldReady;
     THREAD_LOCK(this);
+    OldReady = Ready;
+    /* Only the first of a run of unconsumed signals is timed, otherwise
+     * repeated signals would hide the latency of the waiter. */
+    if (!Ready)
+        clock_gettime(CLOCK_MONOTONIC, &SignalTime);
     Ready = true;
     TEST_0(pthread_cond_signal(&ReadyCondition));
     THREAD_UNLOCK();
@@ -217,6 +261,7 @@ void * THREAD::StaticThread(void * Context)
 
 void THREAD::ThreadInit()
 {
+    ApplyThreadPolicy(Name);
     Thread();
     /* On thread termination ensure the thread status condition is signalled:
      * if we come here without ThreadOk() being called then the thread failed
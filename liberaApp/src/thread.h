@@ -114,6 +114,9 @@ private:
     bool Ready;
     pthread_cond_t ReadyCondition;
     pthread_mutex_t ReadyMutex;
+    /* Time of the first unconsumed signal on CLOCK_MONOTONIC, used to
+     * measure wakeup latency. */
+    struct timespec SignalTime;
 };
 
 
@@ -44,7 +44,6 @@
 #include <errno.h>
 #include <limits.h>
 #include <time.h>
-#include <poll.h>
 #include <ctype.h>
 #include <stdint.h>
 
@@ -57,6 +56,7 @@
 #include "events.h"
 #include "thread.h"
 #include "trigger.h"
+#include "waveform.h"
 
 #include "timestamps.h"
 
@@ -81,25 +81,45 @@ static bool EnableOpenLoop = false;
 
 
 
-/* Sends a command to the clockPll daemon.  We close the file handle between
- * commands to allow other (generally debugging) commands to be sent from
- * other processes. */
+/* Interval between polls of the shared status block, and how long we wait
+ * without any status before deciding that the daemon has gone away. */
+#define PLL_POLL_INTERVAL       100     // ms
+#define PLL_STATUS_TIMEOUT      2000    // ms
+
+
+/* Status block shared with the clockPll daemon, or NULL if not currently
+ * mapped.  The mutex serialises writes to the command mailbox against each
+ * other and against mapping and unmapping the block. */
+static CLOCK_PLL_SHARED * PllShared = NULL;
+static pthread_mutex_t PllSharedMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Sends a command to the clockPll daemon through the shared mailbox.  If the
+ * daemon isn't running the command is discarded: the complete state is sent
+ * again by UpdatePllState() when contact is established. */
 
 static void SendPllCommand(const char * format, ...)
 {
-    int pll;
-    if (TEST_IO(pll = open(CLOCK_PLL_COMMAND_FIFO, O_WRONLY | O_NDELAY)))
+    char command[CLOCK_PLL_COMMAND_LENGTH];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(command, sizeof(command), format, args);
+    va_end(args);
+
+    TEST_0(pthread_mutex_lock(&PllSharedMutex));
+    if (PllShared != NULL)
     {
-        char command[80];
-        va_list args;
-        va_start(args, format);
-        int len = vsnprintf(command, sizeof(command), format, args);
-        strcat(command, "\n");
-        int written;
-        TEST_IO(written = write(pll, command, len+1))  &&
-        TEST_OK(written == len+1);
-        close(pll);
+        CLOCK_PLL_MAILBOX &Mailbox = PllShared->Mailbox;
+        unsigned int Head = Mailbox.Head;
+        if (TEST_OK(Head - Mailbox.Tail < CLOCK_PLL_MAILBOX_SIZE))
+        {
+            memcpy(Mailbox.Commands[Head % CLOCK_PLL_MAILBOX_SIZE],
+                command, sizeof(command));
+            CLOCK_PLL_BARRIER();
+            Mailbox.Head = Head + 1;
+        }
     }
+    TEST_0(pthread_mutex_unlock(&PllSharedMutex));
 }
 
 
@@ -113,112 +133,47 @@ static void UpdatePllState()
     SendPllCommand("mp%d", PhaseOffset);
     SendPllCommand("n%d",  IfClockDetune + SampleClockDetune);
 
-    SendPllCommand("mv%d", Verbose);
-    SendPllCommand("sv%d", Verbose);
     SendPllCommand("mc%d", EnableOpenLoop);
     SendPllCommand("sc%d", EnableOpenLoop);
 }
 
 
 
-/* Class for reading lines with timeout. */
+/* Tries to map the status block published by the daemon.  Failure here is
+ * normal if the daemon isn't running, so is not reported. */
 
-class GETLINE
+static bool MapPllShared()
 {
-public:
-    GETLINE(const char * FileName, int BufferLength) :
-        FileName(FileName),
-        BufferLength(BufferLength),
-        Buffer(new char[BufferLength])
-    {
-        FileFd.fd = -1;
-        FileFd.events = POLLIN;
-        InPointer = 0;
-    }
-
-    ~GETLINE() { Close(); }
-
-    bool Ok() { return FileFd.fd != -1; }
-
-    bool Open(int Timeout)
-    {
-        FileFd.fd = open(FileName, O_RDONLY | O_NONBLOCK);
-        /* A little hack: if we can't open the file then sleep a little.
-         * This will give the rest of the system a bit more time to do
-         * something about it. */
-        if (FileFd.fd == -1)
-            sleep(Timeout / 1000);
-        return FileFd.fd != -1;
-    }
+    int File = open(CLOCK_PLL_SHARED_FILE, O_RDWR);
+    if (File == -1)
+        return false;
+    void * Mapping = mmap(NULL, sizeof(CLOCK_PLL_SHARED),
+        PROT_READ | PROT_WRITE, MAP_SHARED, File, 0);
+    close(File);
+    if (Mapping == MAP_FAILED)
+        return false;
 
-    void Close()
+    CLOCK_PLL_SHARED * Shared = (CLOCK_PLL_SHARED *) Mapping;
+    if (Shared->Magic != CLOCK_PLL_SHARED_MAGIC)
     {
-        if (Ok())
-        {
-            close(FileFd.fd);
-            FileFd.fd = -1;
-        }
+        munmap(Mapping, sizeof(CLOCK_PLL_SHARED));
+        return false;
     }
 
-    bool ReadLine(char * Line, int LineLength, int Timeout)
-    {
-        /* Try to open the file. */
-        if (!Ok()  &&  !Open(Timeout))
-            return false;
-
-        /* Read from the pipe until either there's a line in the buffer or
-         * we time out. */
-        char * newline;
-        while (
-            newline = (char *) memchr(Buffer, '\n', InPointer),
-            newline == NULL)
-        {
-            /* Check for possible buffer overflow.  If the buffer has filled
-             * up without a newline appearing then the simplest thing we can
-             * do is throw it all away and start again. */
-            if (!TEST_OK(InPointer < BufferLength))
-                InPointer = 0;
-
-            int Read;
-            bool Ok =
-                /* Wait for input to arrive with specified timeout in
-                 * milliseconds. */
-                TEST_IO(Read = poll(&FileFd, 1, Timeout))  &&
-                /* Check that the file is readable; if not, timed out. */
-                Read == 1  &&
-                /* Try to read the incoming data. */
-                TEST_IO(Read = read(
-                    FileFd.fd, Buffer + InPointer, BufferLength - InPointer));
-            if (!Ok)
-                return false;
-            else if (Read == 0)
-            {
-                Close();
-                return false;
-            }
-            else
-                InPointer += Read;
-        }
+    TEST_0(pthread_mutex_lock(&PllSharedMutex));
+    PllShared = Shared;
+    TEST_0(pthread_mutex_unlock(&PllSharedMutex));
+    return true;
+}
 
-        /* Copy one line of the read result back to the caller. */
-        *newline++ = '\0';
-        strncpy(Line, Buffer, LineLength);
-        /* If there is anything left in the buffer then for simplicity simply
-         * move it up to the start.  This is easier than managing a circular
-         * buffer, and is a rare case anyway. */
-        int Residue = Buffer + InPointer - newline;
-        memmove(Buffer, newline, Residue);
-        InPointer = Residue;
-        return true;
-    }
 
-private:
-    const char * FileName;      // Name of file to open
-    const int BufferLength;     // Length of allocated buffer
-    char * Buffer;              // Line buffer
-    struct pollfd FileFd;       // File handle and poll() event mask
-    int InPointer;              // Length of read data in buffer
-};
+static void UnmapPllShared()
+{
+    TEST_0(pthread_mutex_lock(&PllSharedMutex));
+    TEST_IO(munmap(PllShared, sizeof(CLOCK_PLL_SHARED)));
+    PllShared = NULL;
+    TEST_0(pthread_mutex_unlock(&PllSharedMutex));
+}
 
 
 
@@ -235,6 +190,14 @@ public:
         DacSetting = 0;
         PhaseError = 0;
         FrequencyError = 0;
+        Tail = 0;
+        TotalLost = 0;
+        LostRecords = 0;
+        HistoryIndex = 0;
+        memset(PhaseHistory, 0, sizeof(PhaseHistory));
+        memset(FrequencyHistory, 0, sizeof(FrequencyHistory));
+        memset(PhaseHistoryWf, 0, sizeof(PhaseHistoryWf));
+        memset(FrequencyHistoryWf, 0, sizeof(FrequencyHistoryWf));
 
         char Prefix[20];
         sprintf(Prefix, "CK:%s_", Clock);
@@ -244,6 +207,11 @@ public:
         Publish_longin(Concat(Prefix, "DAC"),     DacSetting);
         Publish_longin(Concat(Prefix, "PHASE_E"), PhaseError);
         Publish_longin(Concat(Prefix, "FREQ_E"),  FrequencyError);
+        Publish_longin(Concat(Prefix, "LOST"),    LostRecords);
+        PublishSimpleWaveform(int,
+            Concat(Prefix, "PHASE_WF"), PhaseHistoryWf);
+        PublishSimpleWaveform(int,
+            Concat(Prefix, "FREQ_WF"),  FrequencyHistoryWf);
 
         PUBLISH_METHOD_OUT(longout, Concat(Prefix, "DAC"),
             SetDac, DacSetting);
@@ -254,24 +222,86 @@ public:
             Concat(Clock, "_V_TRIG"), Concat(Clock, "_V_DONE"));
     }
 
-    void ProcessStatusLine(const char *Line)
+    /* Called on first contact with the daemon: we start reading from the
+     * current position in the ring. */
+    void Reset(const CLOCK_PLL_RING &Ring)
     {
-        switch(*Line++)
+        Tail = Ring.Head;
+    }
+
+    /* Consumes all new records from the ring, returning false if there were
+     * none.  Status is updated only when it changes, and the verbose
+     * readings are updated at most once per call. */
+    bool ProcessRecords(const CLOCK_PLL_RING &Ring)
+    {
+        unsigned int Head = Ring.Head;
+        CLOCK_PLL_BARRIER();
+        if (Head == Tail)
+            return false;
+
+        /* If we've fallen more than a whole ring behind skip what's gone. */
+        int Lost = 0;
+        if (Head - Tail > CLOCK_PLL_RING_SIZE)
+        {
+            Lost = Head - Tail - CLOCK_PLL_RING_SIZE;
+            Tail = Head - CLOCK_PLL_RING_SIZE;
+        }
+
+        CLOCK_PLL_RECORD Last;
+        memset(&Last, 0, sizeof(Last));
+        bool Valid = false;
+        for (; Tail != Head; Tail ++)
         {
-            case 's':
-                StatusInterlock.Wait();
-                TEST_OK(sscanf(Line, "%d %d", &State, &Synchronised) == 2);
-                StatusInterlock.Ready();
-                break;
-            case 'v':
-                VerboseInterlock.Wait();
-                TEST_OK(sscanf(Line, "%d %d %d",
-                    &FrequencyError, &PhaseError, &DacSetting) == 3);
-                VerboseInterlock.Ready();
-                break;
-            default:
-                TEST_OK(false);
+            CLOCK_PLL_RECORD Record = Ring.Records[Tail % CLOCK_PLL_RING_SIZE];
+            /* If the writer has lapped us while we were copying then this
+             * record may be torn and has to be discarded. */
+            CLOCK_PLL_BARRIER();
+            if (Ring.Head - Tail > CLOCK_PLL_RING_SIZE - 1)
+                Lost += 1;
+            else
+            {
+                PhaseHistory[HistoryIndex] = Record.PhaseError;
+                FrequencyHistory[HistoryIndex] = Record.FrequencyError;
+                HistoryIndex = (HistoryIndex + 1) % CLOCK_PLL_RING_SIZE;
+                Last = Record;
+                Valid = true;
+            }
         }
+        TotalLost += Lost;
+        if (!Valid)
+            return true;
+
+        LIBERA_TIMESTAMP Timestamp;
+        memset(&Timestamp, 0, sizeof(Timestamp));
+        Timestamp.st = Last.Timestamp;
+        if (Last.Stage != State  ||  Last.Synchronised != Synchronised)
+        {
+            StatusInterlock.Wait();
+            State = Last.Stage;
+            Synchronised = Last.Synchronised;
+            StatusInterlock.Ready(Timestamp);
+        }
+
+        if (Verbose)
+        {
+            VerboseInterlock.Wait();
+            DacSetting = Last.Dac;
+            PhaseError = Last.PhaseError;
+            FrequencyError = Last.FrequencyError;
+            LostRecords = TotalLost;
+            /* Unroll the history so that the oldest point comes first. */
+            size_t Split = CLOCK_PLL_RING_SIZE - HistoryIndex;
+            memcpy(PhaseHistoryWf, PhaseHistory + HistoryIndex,
+                Split * sizeof(int));
+            memcpy(PhaseHistoryWf + Split, PhaseHistory,
+                HistoryIndex * sizeof(int));
+            memcpy(FrequencyHistoryWf, FrequencyHistory + HistoryIndex,
+                Split * sizeof(int));
+            memcpy(FrequencyHistoryWf + Split, FrequencyHistory,
+                HistoryIndex * sizeof(int));
+            VerboseInterlock.Ready(Timestamp);
+        }
+        return true;
     }
 
     void ProcessStatusError()
@@ -312,6 +342,17 @@ private:
     int PhaseError;
     int FrequencyError;
 
+    /* Ring reading state and private history, from which the published
+     * waveforms are unrolled. */
+    unsigned int Tail;
+    int TotalLost;
+    int LostRecords;
+    unsigned int HistoryIndex;
+    int PhaseHistory[CLOCK_PLL_RING_SIZE];
+    int FrequencyHistory[CLOCK_PLL_RING_SIZE];
+    int PhaseHistoryWf[CLOCK_PLL_RING_SIZE];
+    int FrequencyHistoryWf[CLOCK_PLL_RING_SIZE];
+
     INTERLOCK StatusInterlock;
     INTERLOCK VerboseInterlock;
 };
@@ -336,29 +377,6 @@ public:
 
 
 private:
-    /* Decodes a single status line read from clockPll and ensures that
-     * updates are reported as appropriate. */
-    void ProcessStatusLine(const char * Line)
-    {
-        switch (*Line++)
-        {
-            case 'm':
-                MC_monitor->ProcessStatusLine(Line);
-                break;
-            case 's':
-                SC_monitor->ProcessStatusLine(Line);
-                break;
-            case 'x':
-                /* On receipt of reset reinitialise the PLL daemon. */
-                UpdatePllState();
-                break;
-            default:
-                printf("Invalid PLL status line: \"%s\"\n", Line);
-                ProcessStatusError();
-                break;
-        }
-    }
-
     /* If we lose communication with the PLL daemon then switch all our state
      * into the default error state. */
     void ProcessStatusError()
@@ -371,14 +389,39 @@ private:
     {
         StartupOk();
 
-        GETLINE PllStatus(CLOCK_PLL_STATUS_FIFO, 128);
+        ProcessStatusError();
+        int IdleTime = 0;
         while (Running())
         {
-            char Line[128];
-            if (PllStatus.ReadLine(Line, sizeof(Line), 2000))
-                ProcessStatusLine(Line);
+            if (PllShared == NULL)
+            {
+                /* On (re)connection to the daemon bring it up to date. */
+                if (MapPllShared())
+                {
+                    MC_monitor->Reset(PllShared->Rings[CLOCK_PLL_MC_RING]);
+                    SC_monitor->Reset(PllShared->Rings[CLOCK_PLL_SC_RING]);
+                    IdleTime = 0;
+                    UpdatePllState();
+                }
+            }
             else
-                ProcessStatusError();
+            {
+                /* Note that both rings must be processed. */
+                bool Active =
+                    MC_monitor->ProcessRecords(
+                        PllShared->Rings[CLOCK_PLL_MC_RING]) |
+                    SC_monitor->ProcessRecords(
+                        PllShared->Rings[CLOCK_PLL_SC_RING]);
+                IdleTime = Active ? 0 : IdleTime + PLL_POLL_INTERVAL;
+                if (IdleTime >= PLL_STATUS_TIMEOUT)
+                {
+                    /* The daemon has stopped: the next daemon will create a
+                     * fresh block, so let this one go. */
+                    UnmapPllShared();
+                    ProcessStatusError();
+                }
+            }
+            usleep(1000 * PLL_POLL_INTERVAL);
         }
     }
 
@@ -624,7 +667,7 @@ bool InitialiseTimestamps()
     PUBLISH_CONFIGURATION(longout, "CK:PHASE",
         PhaseOffset, UpdatePllState);
     PUBLISH_CONFIGURATION(bo, "CK:TIMESTAMP", UseSystemTime, NULL_ACTION);
-    PUBLISH_FUNCTION_OUT(bo, "CK:VERBOSE", Verbose, UpdatePllState);
+    PUBLISH_FUNCTION_OUT(bo, "CK:VERBOSE", Verbose, NULL_ACTION);
 
     /* Open loop direct DAC control. */
     PUBLISH_FUNCTION_OUT(bo, "CK:OPEN_LOOP",  EnableOpenLoop, UpdatePllState);
@@ -79,8 +79,9 @@ void TRIGGER::Ready(const struct timespec *NewTimestamp)
     else
         Timestamp = *NewTimestamp;
 
-    /* Notify EPICS that we've changed. */
-    Write(true);
+    /* Notify EPICS that we've changed: every call to Ready() is a new event,
+     * even though the value never changes. */
+    Notify(true);
 }
 
 
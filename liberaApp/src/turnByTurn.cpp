@@ -44,6 +44,7 @@
 #include "convert.h"
 #include "waveform.h"
 #include "statistics.h"
+#include "decimate.h"
 
 #include "turnByTurn.h"
 
@@ -65,6 +66,7 @@ public:
         WindowOffset = 0;
         CaptureOffset = 0;
         Decimated = false;
+        SoftDecimation = 1;
         UpdateWaveformOnCapture = true;
         /* Make the default capture length equal to one window. */
         WindowLength = WindowWaveformLength;
@@ -95,6 +97,8 @@ public:
         Publish_longin("TT:OFFSET", WindowOffset);
         Publish_longout("TT:DELAY", CaptureOffset);
         Publish_bo("TT:DECIMATION", Decimated);
+        PUBLISH_METHOD_OUT(longout, "TT:DECIMATE",
+            SetSoftDecimation, SoftDecimation);
         Publish_bo("TT:DOREFRESH", UpdateWaveformOnCapture);
 
         /* Turn by turn triggering is rather complicated, and needs to occur
@@ -202,6 +206,27 @@ private:
         }
     }
 
+    /* Further decimation of the captured waveform is done in software as
+     * the window is extracted, so changing it takes effect immediately on
+     * the data already captured. */
+    bool SetSoftDecimation(int Factor)
+    {
+        if (1 <= Factor  &&  Factor <= MAX_SOFT_DECIMATION)
+        {
+            if (Factor != SoftDecimation)
+            {
+                SoftDecimation = Factor;
+                ProcessShortWaveform();
+            }
+            return true;
+        }
+        else
+        {
+            printf("TT:DECIMATE %d is out of range\n", Factor);
+            return false;
+        }
+    }
+
     bool GetCapturedLength(int &Length)
     {
         Length = LongWaveform.WorkingLength();
@@ -232,9 +257,13 @@ private:
     {
         Interlock.Wait();
 
-        /* We copy our desired segment from the long waveform and do all the
-         * usual processing. */
-        WindowIq.CaptureFrom(LongWaveform, WindowOffset);
+        /* We copy (or decimate) our desired segment from the long waveform
+         * and do all the usual processing. */
+        if (SoftDecimation > 1)
+            WindowIq.CaptureDecimated(
+                LongWaveform, WindowOffset, SoftDecimation);
+        else
+            WindowIq.CaptureFrom(LongWaveform, WindowOffset);
         WindowAbcd.CaptureCordic(WindowIq);
         WindowXyqs.CaptureConvert(WindowAbcd);
         StatsXY.Update();
@@ -278,6 +307,8 @@ private:
     int CaptureOffset;
     /* Whether to apply decimation reduction on captured waveform. */
     bool Decimated;
+    /* Further software decimation applied when reading out the window. */
+    int SoftDecimation;
     /* Whether to process short waveform on fresh waveform capture. */
     bool UpdateWaveformOnCapture;
 };
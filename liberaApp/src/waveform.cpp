@@ -46,6 +46,8 @@
 #include "cordic.h"
 #include "complex.h"
 #include "timestamps.h"
+#include "decimate.h"
+#include "arena.h"
 
 #include "waveform.h"
 
@@ -76,8 +78,8 @@ SIMPLE_WAVEFORM<T>::SIMPLE_WAVEFORM(
     /* The length of the waveform is recorded in terms of EPICS points. */
     WaveformLength(WaveformLength * sizeof(T) / EpicsPointSize),
     /* If we've been given an existing waveform then we use that, otherwise
-     * create our own waveform buffer. */
-    Waveform(ExternalWaveform ? ExternalWaveform : new T[WaveformLength])
+     * create our own waveform buffer in the waveform arena. */
+    Waveform(ExternalWaveform ? ExternalWaveform : ArenaNew<T>(WaveformLength))
 {
 }
 
@@ -170,7 +172,7 @@ private:
 template<class T>
 WAVEFORMS<T>::WAVEFORMS(size_t WaveformSize, bool FullSize) :
     WaveformSize(WaveformSize),
-    Data(new T[WaveformSize])
+    Data(ArenaNew<T>(WaveformSize))
 {
     CurrentLength = WaveformSize;
     ActiveLength = FullSize ? CurrentLength : 0;
@@ -179,7 +181,7 @@ WAVEFORMS<T>::WAVEFORMS(size_t WaveformSize, bool FullSize) :
 
 
 template<class T>
-void WAVEFORMS<T>::SetLength(size_t NewLength)
+void WAVEFORMS<T>::SetLength(size_t NewLength, bool FullSize)
 {
     /* First ensure that the requested length is no longer than we actually
      * have room for. */
@@ -187,7 +189,7 @@ void WAVEFORMS<T>::SetLength(size_t NewLength)
         NewLength = WaveformSize;
     CurrentLength = NewLength;
     /* Also truncate the active length to track the requested length. */
-    if (ActiveLength > CurrentLength)
+    if (ActiveLength > CurrentLength  ||  FullSize)
         ActiveLength = CurrentLength;
 }
 
@@ -249,6 +251,19 @@ void WAVEFORMS<T>::CaptureFrom(const WAVEFORMS<T> & Source, size_t Offset)
     Timestamp = Source.Timestamp;
 }
 
+template<class T>
+void WAVEFORMS<T>::CaptureDecimated(
+    const WAVEFORMS<T> & Source, size_t Offset, int Factor)
+{
+    /* Each of our rows consumes Factor rows of the source.  All of our row
+     * types are simple rows of integers, which DecimateRows relies on. */
+    size_t Length = Source.CaptureLength(Offset, CurrentLength * Factor);
+    ActiveLength = DecimateRows(Factor,
+        (const int *) (const void *) (Source.Data + Offset),
+        (int *) (void *) Data, Length, sizeof(T) / sizeof(int));
+    Timestamp = Source.Timestamp;
+}
+
 
 /* Helper routine for publishing a column of the waveforms block to EPICS.
  * Uses the COLUMN_WAVEFORM class to build the appropriate access method.
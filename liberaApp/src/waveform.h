@@ -120,8 +120,10 @@ public:
     void Publish(const char * Prefix, const char *SubName="WF") const;
 
     /* This changes the active length of the waveform: all other operations
-     * will then operate only on the initial segment of length NewLength. */
-    void SetLength(size_t NewLength);
+     * will then operate only on the initial segment of length NewLength.  If
+     * FullSize is set then the working length is also set to NewLength, as
+     * for the constructor. */
+    void SetLength(size_t NewLength, bool FullSize=false);
 
     /* Interrogate the set length of this waveform: this is the desired
      * length as set through the EPICS interface. */
@@ -149,6 +151,10 @@ public:
     /* Capture a waveform by copying from an existing instance of the same
      * waveform. */
     void CaptureFrom(const WAVEFORMS<T> & Source, size_t Offset);
+    /* Capture a waveform by decimating an existing instance of the same
+     * waveform, starting at Offset, by the given Factor. */
+    void CaptureDecimated(
+        const WAVEFORMS<T> & Source, size_t Offset, int Factor);
 
     /* Reads the timestamp. */
     const LIBERA_TIMESTAMP & GetTimestamp() { return Timestamp; }
@@ -0,0 +1,56 @@
+#!/usr/bin/env dls-python
+
+# Stand-in SNTP server for testing the IOC NTP probe.
+#
+# Usage: ntp-responder.py [port [offset [delay [stratum [li]]]]]
+#
+# Responds to SNTP client requests on the given port (default 123) with the
+# local time shifted by offset seconds, simulating a symmetric network round
+# trip delay of delay seconds.  Run the IOC with
+#   -t 127.0.0.1:<port>
+# to monitor this server instead of the local NTP daemon.
+
+from __future__ import print_function
+
+import sys
+import socket
+import struct
+import time
+
+
+# Offset from 1900 (NTP epoch) to 1970 (Unix epoch) in seconds.
+ntp_epoch = (365 * 70 + 17) * 24 * 3600
+
+def ntp_time(offset):
+    now = time.time() + offset + ntp_epoch
+    return int(now * 2**32)
+
+
+args = sys.argv[1:] + [None] * 5
+port    = int(args[0] or 123)
+offset  = float(args[1] or 0)
+delay   = float(args[2] or 0)
+stratum = int(args[3] or 2)
+li      = int(args[4] or 0)
+
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, 0)
+sock.bind(('', port))
+print('Listening on port %d, offset %gs, delay %gs' % (port, offset, delay))
+
+while True:
+    request, client = sock.recvfrom(256)
+    if len(request) < 48 or (bytearray(request)[0] & 7) != 3:
+        print('Ignoring malformed request from %s' % (client,))
+        continue
+
+    time.sleep(delay / 2)
+    rec = ntp_time(offset)
+    # The client transmit timestamp is returned as our originate timestamp.
+    org = struct.unpack('!Q', request[40:48])[0]
+    refid = struct.unpack('!i', socket.inet_aton('127.127.1.0'))[0]
+    response = struct.pack('!BBbbiiiQQQQ',
+        (li << 6) | (4 << 3) | 4, stratum, 4, -20,
+        0, 0, refid, rec, org, rec, ntp_time(offset))
+    time.sleep(delay / 2)
+    sock.sendto(response, client)
+    print('Responded to %s' % (client,))
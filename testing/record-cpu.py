@@ -0,0 +1,75 @@
+#!/usr/bin/env python2.4
+
+# Measures the CPU cost of IOC record processing.
+#
+# Usage: record-cpu.py [-t seconds] ioc pv...
+#
+# Monitors each of the given PVs on the named IOC together with the IOC's
+# SE:CPU reading, and reports for each interval (default 30 seconds) the
+# number of record updates per second, the mean CPU usage, and the CPU time
+# spent per record update.  The update rate is fixed by the triggering, so it
+# is the CPU figures that show the cost of record processing.  Pick a group
+# of records processed together by a single I/O Intr event and drive them at
+# a fixed high rate: for example the FT group with a fast trigger, eg
+#   record-cpu.py TS-DI-EBPM-01 FT:X FT:Y FT:Q FT:S FT:A FT:B FT:C FT:D
+# Run this before and after an IOC change under identical triggering and
+# compare the CPU per update.  SE:CPU is a whole machine figure updated at
+# the sensors poll interval, so use a long enough interval to average over
+# several polls and keep other activity on the Libera constant.
+
+if __name__ == '__main__':
+    from pkg_resources import require
+    require('cothread')
+
+from cothread import *
+from cothread.catools import *
+
+import sys
+import time
+
+
+args = sys.argv[1:]
+interval = 30
+if args[:1] == ['-t']:
+    interval = float(args[1])
+    args = args[2:]
+if len(args) < 2:
+    print >>sys.stderr, 'Usage: %s [-t seconds] ioc pv...' % sys.argv[0]
+    sys.exit(1)
+
+ioc, pvs = args[0], args[1:]
+
+updates = [0]
+def on_update(value, index):
+    updates[0] += 1
+
+cpu = []
+def on_cpu(value):
+    cpu.append(value)
+
+# Count every update: without all_updates bursts would be coalesced.
+monitors = camonitor(['%s:%s' % (ioc, pv) for pv in pvs], on_update,
+    all_updates = True)
+cpu_monitor = camonitor('%s:SE:CPU' % ioc, on_cpu)
+
+print 'Monitoring %d PVs on %s' % (len(pvs), ioc)
+Sleep(interval)             # Discard initial connection updates
+updates[0] = 0
+del cpu[:]
+start = time.time()
+while True:
+    Sleep(interval)
+    now = time.time()
+    rate = updates[0] / (now - start)
+    if cpu:
+        usage = sum(cpu) / len(cpu)
+        if rate > 0:
+            per_update = '%.1f us/update' % (1e4 * usage / rate)
+        else:
+            per_update = 'no updates'
+        print '%.1f updates/s, CPU %.1f%%, %s' % (rate, usage, per_update)
+    else:
+        print '%.1f updates/s, no SE:CPU readings' % rate
+    updates[0] = 0
+    del cpu[:]
+    start = now